@@ -0,0 +1,88 @@
+#version 450 core
+
+#define DENOISE_TILE (16)
+#define ALBEDO_EPSILON (1e-3)
+#define DEPTH_EPSILON (1e-3)
+
+layout (local_size_x = DENOISE_TILE, local_size_y = DENOISE_TILE) in;
+
+layout (binding = 0, rgba32f) uniform readonly image2D Accumulation;
+layout (binding = 3, rgba32f) uniform readonly image2D Albedo;
+layout (binding = 4, rgba32f) uniform readonly image2D NormalDepth;
+layout (binding = 5, rgba32f) uniform readonly image2D Source;
+layout (binding = 6, rgba32f) uniform writeonly image2D Target;
+
+layout (location = 0) uniform int StepWidth;
+layout (location = 1) uniform bool FirstPass;
+layout (location = 2) uniform bool LastPass;
+layout (location = 3) uniform float ColorPhi;
+layout (location = 4) uniform float NormalPhi;
+layout (location = 5) uniform float DepthPhi;
+
+const float KERNEL[5] = float[](1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+float sample_count(in ivec2 pixel) {
+    return max(imageLoad(Accumulation, pixel).a, 1.0);
+}
+
+vec3 albedo_at(in ivec2 pixel) {
+    return imageLoad(Albedo, pixel).rgb / sample_count(pixel) + ALBEDO_EPSILON;
+}
+
+// the first pass reads the accumulated mean and divides the albedo out, so texture detail never gets blurred
+vec3 color_at(in ivec2 pixel) {
+    if (FirstPass) {
+        vec4 accum = imageLoad(Accumulation, pixel);
+        return accum.rgb / max(accum.a, 1.0) / albedo_at(pixel);
+    }
+    return imageLoad(Source, pixel).rgb;
+}
+
+vec4 normal_depth_at(in ivec2 pixel) {
+    vec4 normal_depth = imageLoad(NormalDepth, pixel) / sample_count(pixel);
+    float len = length(normal_depth.xyz);
+    return vec4(len > 0.0 ? normal_depth.xyz / len : vec3(0.0), normal_depth.w);
+}
+
+// one level of the edge-avoiding a-trous wavelet transform (dammertz et al. 2010): a 5x5 b3-spline kernel whose
+// taps are spread StepWidth pixels apart and weighted down across color, normal and relative depth edges
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(Accumulation);
+    if (any(greaterThanEqual(pixel, size))) {
+        return;
+    }
+
+    vec3 color = color_at(pixel);
+    vec4 normal_depth = normal_depth_at(pixel);
+
+    float inv_color = 1.0 / ColorPhi;
+    float inv_normal = 1.0 / (NormalPhi * float(StepWidth * StepWidth));
+    float inv_depth = 1.0 / (DepthPhi * float(StepWidth) * max(normal_depth.w, DEPTH_EPSILON));
+
+    vec3 sum = vec3(0.0);
+    float weight_sum = 0.0;
+    for (int j = 0; j < 5; ++j) {
+        for (int i = 0; i < 5; ++i) {
+            ivec2 tap = clamp(pixel + ivec2(i - 2, j - 2) * StepWidth, ivec2(0), size - 1);
+
+            vec3 tap_color = color_at(tap);
+            vec4 tap_normal_depth = normal_depth_at(tap);
+
+            vec3 dc = tap_color - color;
+            vec3 dn = tap_normal_depth.xyz - normal_depth.xyz;
+            float dz = abs(tap_normal_depth.w - normal_depth.w);
+
+            float weight = KERNEL[i] * KERNEL[j]
+                           * exp(-(dot(dc, dc) * inv_color + dot(dn, dn) * inv_normal + dz * inv_depth));
+            sum += tap_color * weight;
+            weight_sum += weight;
+        }
+    }
+
+    vec3 result = sum / weight_sum;
+    if (LastPass) {
+        result *= albedo_at(pixel);
+    }
+    imageStore(Target, pixel, vec4(result, 1.0));
+}
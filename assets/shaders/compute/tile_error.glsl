@@ -0,0 +1,63 @@
+#version 450 core
+
+#define ADAPTIVE_TILE (16)
+#define UNEVALUATED (1e30)
+
+layout (local_size_x = ADAPTIVE_TILE, local_size_y = ADAPTIVE_TILE) in;
+
+layout (binding = 0, rgba32f) uniform readonly image2D Accumulation;
+layout (binding = 1, rgba32f) uniform readonly image2D Moments;
+layout (binding = 2, r32f) uniform writeonly image2D TileError;
+
+layout (binding = 7, std430) buffer AdaptiveBuffer {
+    uint active_tiles;
+};
+
+layout (location = 0) uniform float ErrorThreshold;
+layout (location = 1) uniform uint MinSamples;
+
+shared float errors[ADAPTIVE_TILE * ADAPTIVE_TILE];
+
+float luminance(in vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// relative standard error of the pixel mean, from the luminance moments
+float pixel_error(in ivec2 pixel) {
+    vec4 accum = imageLoad(Accumulation, pixel);
+    float n = accum.a;
+    if (n < float(MinSamples)) {
+        return UNEVALUATED;
+    }
+
+    float mean = luminance(accum.rgb) / n;
+    float second = imageLoad(Moments, pixel).r / n;
+    float variance = max(second - mean * mean, 0.0) * n / (n - 1.0);
+
+    // the floor keeps almost black pixels from demanding samples for noise nobody can see
+    return sqrt(variance / n) / max(mean, 0.1);
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    uint index = gl_LocalInvocationIndex;
+
+    errors[index] = all(lessThan(pixel, imageSize(Accumulation))) ? pixel_error(pixel) : 0.0;
+    barrier();
+
+    // a tile is only as converged as its worst pixel
+    for (uint stride = uint(ADAPTIVE_TILE * ADAPTIVE_TILE) / 2u; stride > 0u; stride >>= 1u) {
+        if (index < stride) {
+            errors[index] = max(errors[index], errors[index + stride]);
+        }
+        barrier();
+    }
+
+    if (index == 0u) {
+        float error = errors[0] >= UNEVALUATED ? -1.0 : errors[0];
+        imageStore(TileError, ivec2(gl_WorkGroupID.xy), vec4(error));
+        if (error < 0.0 || error > ErrorThreshold) {
+            atomicAdd(active_tiles, 1u);
+        }
+    }
+}
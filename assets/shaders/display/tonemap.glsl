@@ -0,0 +1,63 @@
+#version 450 core
+
+#define TONEMAP_NONE (0)
+#define TONEMAP_REINHARD (1)
+#define TONEMAP_ACES (2)
+#define TONEMAP_FILMIC (3)
+
+layout (location = 0) in vec2 Sample;
+layout (location = 0) out vec4 Color;
+
+// the accumulated sums or the denoised image, the mean is rgb / a either way
+layout (binding = 8) uniform sampler2D Image;
+
+layout (location = 0) uniform float Exposure;
+layout (location = 1) uniform int Tonemap;
+layout (location = 2) uniform bool EncodeSrgb;
+
+// narkowicz' fit of the aces reference rendering transform, scaled so 1.0 stays close to 0.8
+vec3 aces(in vec3 x) {
+    x *= 0.6;
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+// hable's filmic curve, normalized to a linear white point of 11.2
+vec3 hable(in vec3 x) {
+    const float A = 0.15, B = 0.50, C = 0.10, D = 0.20, E = 0.02, F = 0.30;
+    return ((x * (A * x + C * B) + D * E) / (x * (A * x + B) + D * F)) - E / F;
+}
+
+vec3 filmic(in vec3 x) {
+    return hable(2.0 * x) / hable(vec3(11.2));
+}
+
+vec3 srgb_encode(in vec3 x) {
+    return mix(12.92 * x, 1.055 * pow(x, vec3(1.0 / 2.4)) - 0.055, greaterThan(x, vec3(0.0031308)));
+}
+
+void main() {
+    vec4 texel = texelFetch(Image, ivec2(gl_FragCoord.xy), 0);
+    vec3 color = texel.rgb / max(texel.a, 1.0) * Exposure;
+
+    switch (Tonemap) {
+        case TONEMAP_REINHARD:
+            color = color / (1.0 + color);
+            break;
+        case TONEMAP_ACES:
+            color = aces(color);
+            break;
+        case TONEMAP_FILMIC:
+            color = filmic(color);
+            break;
+        default:
+            break;
+    }
+
+    color = clamp(color, 0.0, 1.0);
+
+    // the framebuffer encodes by itself when it is srgb capable
+    if (EncodeSrgb) {
+        color = srgb_encode(color);
+    }
+    Color = vec4(color, 1.0);
+}
@@ -1,10 +1,6 @@
 #version 450 core
 
-#include "common.incl"
-
-layout (binding = 3, std430) readonly buffer BVHBuffer {
-    BVHNode nodes[];
-};
+#include "buffers.incl"
 
 bool BVHNode_Hit(in uint index, in Ray ray, in Interval ray_t) {
 
@@ -0,0 +1,76 @@
+#version 450 core
+
+#include "common.incl"
+
+layout (binding = 1) uniform sampler2D EnvironmentMap;
+layout (binding = 2) uniform sampler2D EnvironmentConditional;
+layout (binding = 3) uniform sampler2D EnvironmentMarginal;
+
+layout (location = 5) uniform bool EnvironmentEnabled;
+layout (location = 6) uniform mat3 EnvironmentRotation;
+layout (location = 7) uniform float EnvironmentIntegral;
+
+vec2 direction_to_uv(in vec3 direction) {
+    vec3 d = transpose(EnvironmentRotation) * normalize(direction);
+    return vec2(fract(atan(d.z, d.x) / (2.0 * PI)), acos(clamp(d.y, -1.0, 1.0)) / PI);
+}
+
+vec3 uv_to_direction(in vec2 uv) {
+    float phi = 2.0 * PI * uv.x;
+    float theta = PI * uv.y;
+    return EnvironmentRotation * vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+// index of the first cdf entry above u, with u remapped into that entry's own [0, 1) range
+int search_cdf(in sampler2D cdf, in int row, in int count, inout float u) {
+    int lo = 0;
+    int hi = count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (texelFetch(cdf, ivec2(mid, row), 0).r <= u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    float below = lo > 0 ? texelFetch(cdf, ivec2(lo - 1, row), 0).r : 0.0;
+    float above = texelFetch(cdf, ivec2(lo, row), 0).r;
+    u = above > below ? clamp((u - below) / (above - below), 0.0, 1.0) : 0.5;
+    return lo;
+}
+
+bool Environment_Enabled() {
+    return EnvironmentEnabled;
+}
+
+vec3 Environment_Eval(in vec3 direction) {
+    return textureLod(EnvironmentMap, direction_to_uv(direction), 0.0).rgb;
+}
+
+float Environment_Pdf(in vec3 direction) {
+    vec2 uv = direction_to_uv(direction);
+    float sin_theta = sin(PI * uv.y);
+    if (sin_theta <= 0.0) {
+        return 0.0;
+    }
+
+    ivec2 size = textureSize(EnvironmentMap, 0);
+    ivec2 texel = min(ivec2(uv * vec2(size)), size - 1);
+    float texel_sin_theta = sin(PI * (float(texel.y) + 0.5) / float(size.y));
+    float value = Luminance(texelFetch(EnvironmentMap, texel, 0).rgb) * texel_sin_theta;
+
+    return value / EnvironmentIntegral / (2.0 * PI * PI * sin_theta);
+}
+
+vec3 Environment_Sample(out vec3 direction, out float pdf) {
+    ivec2 size = textureSize(EnvironmentMap, 0);
+    vec2 u = RandomVec2();
+
+    int y = search_cdf(EnvironmentMarginal, 0, size.y, u.y);
+    int x = search_cdf(EnvironmentConditional, y, size.x, u.x);
+
+    direction = uv_to_direction((vec2(x, y) + u) / vec2(size));
+    pdf = Environment_Pdf(direction);
+    return Environment_Eval(direction);
+}
@@ -3,44 +3,181 @@
 #include "common.incl"
 
 layout (location = 0) in vec2 Sample;
-layout (location = 0) out vec4 Color;
+
+// only the images are written here, the display pass turns them into pixels
 
 uniform layout (binding = 0, rgba32f) image2D Accumulation;
+uniform layout (binding = 1, rgba32f) image2D Moments;
+layout (binding = 2, r32f) uniform readonly image2D TileError;
+// first-hit guides for the denoiser, summed like the color: albedo in rgb, normal in xyz and depth in w
+layout (binding = 3, rgba32f) uniform image2D Albedo;
+layout (binding = 4, rgba32f) uniform image2D NormalDepth;
 
-uniform uint SampleCount;
-uniform uint MaxSampleCount = 20000u;
-uniform vec3 Origin;
-uniform mat4 CameraToWorld;
-uniform mat4 ScreenToCamera;
+// the images of the previous camera, only read in the frame after a camera move
+layout (binding = 4) uniform sampler2D HistoryAccumulation;
+layout (binding = 5) uniform sampler2D HistoryMoments;
+layout (binding = 6) uniform sampler2D HistoryAlbedo;
+layout (binding = 7) uniform sampler2D HistoryNormalDepth;
 
-void main() {
+layout (location = 0) uniform uint SampleCount;
+layout (location = 1) uniform vec3 Origin;
+layout (location = 2) uniform mat4 CameraToWorld;
+layout (location = 3) uniform mat4 ScreenToCamera;
+layout (location = 11) uniform float ErrorThreshold;
+layout (location = 12) uniform bool Reproject;
+layout (location = 13) uniform mat4 PreviousWorldToScreen;
+layout (location = 14) uniform vec3 PreviousOrigin;
+layout (location = 15) uniform float HistoryLimit;
+layout (location = 16) uniform uint Frame;
 
-    ivec2 pixel_coord = ivec2(gl_FragCoord.xy);
-    vec3 accum = imageLoad(Accumulation, pixel_coord).rgb;
+vec3 primary_direction(in vec2 screen) {
+    vec4 target = ScreenToCamera * vec4(screen, 1.0, 1.0);
+    return normalize(mat3(CameraToWorld) * (normalize(target.xyz) / target.w));
+}
 
-    if (SampleCount >= MaxSampleCount) {
-        Color = vec4(accum / MaxSampleCount, 1.0);
-        return;
+// the sums the previous camera gathered for the surface this pixel sees now: each bilinear tap has to agree on depth
+// and normal, taps across a disocclusion are dropped and the rest renormalized, and the reused sample count is capped
+// so stale shading fades out while moving
+bool reproject(in vec3 direction, in vec3 normal, in float depth, out vec4 accum, out float moment, out vec3 albedo) {
+    bool miss = normal == vec3(0.0);
+    vec3 position = Origin + direction * depth;
+
+    // misses are compared by direction alone, the sky sits at infinity
+    vec4 clip = PreviousWorldToScreen * (miss ? vec4(direction, 0.0) : vec4(position, 1.0));
+    if (clip.w <= 0.0) {
+        return false;
     }
 
-    vec2 pixel_delta = 1.0 / vec2(imageSize(Accumulation));
-    Seed(uint(pixel_coord.x + pixel_coord.y / pixel_delta.x) * SampleCount);
+    ivec2 size = textureSize(HistoryAccumulation, 0);
+    vec2 coord = (clip.xy / clip.w * 0.5 + 0.5) * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(coord));
+    vec2 f = coord - vec2(base);
+    float expected = length(position - PreviousOrigin);
+
+    vec4 mean = vec4(0.0);
+    float moment_mean = 0.0;
+    vec3 albedo_mean = vec3(0.0);
+    float weight_sum = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 tap = base + ivec2(i & 1, i >> 1);
+        if (any(lessThan(tap, ivec2(0))) || any(greaterThanEqual(tap, size))) {
+            continue;
+        }
+
+        vec4 history = texelFetch(HistoryAccumulation, tap, 0);
+        if (history.a < 1.0) {
+            continue;
+        }
+
+        vec4 normal_depth = texelFetch(HistoryNormalDepth, tap, 0) / history.a;
+        float len = length(normal_depth.xyz);
+        if (miss != (len == 0.0)) {
+            continue;
+        }
+        if (!miss && (dot(normal_depth.xyz / len, normal) < REPROJECT_NORMAL_TOLERANCE
+                      || abs(normal_depth.w - expected) > REPROJECT_DEPTH_TOLERANCE * expected)) {
+            continue;
+        }
+
+        float weight = ((i & 1) != 0 ? f.x : 1.0 - f.x) * ((i >> 1) != 0 ? f.y : 1.0 - f.y);
+        mean += vec4(history.rgb / history.a, history.a) * weight;
+        moment_mean += texelFetch(HistoryMoments, tap, 0).r / history.a * weight;
+        albedo_mean += texelFetch(HistoryAlbedo, tap, 0).rgb / history.a * weight;
+        weight_sum += weight;
+    }
+
+    if (weight_sum < EPSILON) {
+        return false;
+    }
+
+    float count = floor(min(mean.a / weight_sum, HistoryLimit));
+    if (count < 1.0) {
+        return false;
+    }
+
+    accum = vec4(mean.rgb / weight_sum * count, count);
+    moment = moment_mean / weight_sum * count;
+    albedo = albedo_mean / weight_sum * count;
+    return true;
+}
 
+vec3 trace_sample(in uint n, in vec2 pixel_delta, out vec3 albedo, out vec3 normal, out float depth) {
     uint sqrt_max_samples = uint(sqrt(float(MaxSampleCount)));
     float inv_sqrt_max_samples = 1.0 / float(sqrt_max_samples - 1);
-    float sample_i = float(SampleCount % sqrt_max_samples) * inv_sqrt_max_samples - 0.5;
-    float sample_j = float(SampleCount / sqrt_max_samples) * inv_sqrt_max_samples - 0.5;
+    float sample_i = float(n % sqrt_max_samples) * inv_sqrt_max_samples - 0.5;
+    float sample_j = float(n / sqrt_max_samples) * inv_sqrt_max_samples - 0.5;
 
-    vec4 target = ScreenToCamera * vec4(Sample + vec2(sample_i, sample_j) * pixel_delta, 1.0, 1.0);
-    vec3 ray_direction = mat3(CameraToWorld) * (normalize(target.xyz) / target.w);
-    Ray ray = Ray(Origin, normalize(ray_direction));
+    Ray ray = Ray(Origin, primary_direction(Sample + vec2(sample_i, sample_j) * pixel_delta));
 
-    vec3 ray_color = SendRay(ray);
+    vec3 ray_color = SendRay(ray, albedo, normal, depth);
     if (ray_color.r < 0.0 || ray_color.r != ray_color.r) ray_color.r = 0.0;
     if (ray_color.g < 0.0 || ray_color.g != ray_color.g) ray_color.g = 0.0;
     if (ray_color.b < 0.0 || ray_color.b != ray_color.b) ray_color.b = 0.0;
-    accum += ray_color;
-    imageStore(Accumulation, pixel_coord, vec4(accum, 1.0));
+    return ray_color;
+}
+
+void main() {
+
+    ivec2 pixel_coord = ivec2(gl_FragCoord.xy);
+    // rgb is the running sum and a the number of samples this pixel has taken
+    vec4 accum = imageLoad(Accumulation, pixel_coord);
+    uint n = uint(accum.a);
+    uint first = n;
 
-    Color = vec4(accum / SampleCount, 1.0);
+    // tiles start unevaluated (negative) and are traced once per frame until the error pass has an estimate,
+    // afterwards converged tiles are skipped and noisy ones get more samples per frame
+    uint samples = 1u;
+    float tile_error = imageLoad(TileError, pixel_coord / ADAPTIVE_TILE).r;
+    if (ErrorThreshold > 0.0 && tile_error >= 0.0) {
+        samples = tile_error <= ErrorThreshold
+                  ? 0u
+                  : min(uint(ceil(tile_error / ErrorThreshold)), MAX_ADAPTIVE_SAMPLES);
+    }
+    samples = min(samples, MaxSampleCount - min(n, MaxSampleCount));
+
+    if (samples == 0u) {
+        return;
+    }
+
+    vec2 pixel_delta = 1.0 / vec2(imageSize(Accumulation));
+    // the frame keeps pixels that restart after every camera move from repeating their paths
+    Seed(uint(pixel_coord.x + pixel_coord.y / pixel_delta.x) * (n + 1u) ^ Frame * 2654435761u);
+
+    float moment = imageLoad(Moments, pixel_coord).r;
+    vec4 albedo_sum = imageLoad(Albedo, pixel_coord);
+    vec4 normal_depth_sum = imageLoad(NormalDepth, pixel_coord);
+    for (uint i = 0u; i < samples; ++i, ++n) {
+        vec3 albedo, normal;
+        float depth;
+        vec3 ray_color = trace_sample(n, pixel_delta, albedo, normal, depth);
+        float luminance = Luminance(ray_color);
+        accum.rgb += ray_color;
+        moment += luminance * luminance;
+        albedo_sum.rgb += albedo;
+        normal_depth_sum += vec4(normal, depth);
+    }
+
+    accum.a = float(n);
+
+    // the camera just moved and this pixel restarted, its first samples locate the surface in the history
+    if (Reproject && first == 0u) {
+        float normal_len = length(normal_depth_sum.xyz);
+        vec3 normal = normal_len > 0.0 ? normal_depth_sum.xyz / normal_len : vec3(0.0);
+
+        vec4 history;
+        float history_moment;
+        vec3 history_albedo;
+        float depth = normal_depth_sum.w / accum.a;
+        if (reproject(primary_direction(Sample), normal, depth, history, history_moment, history_albedo)) {
+            // depth is relative to the new origin, so the guides keep the fresh value at the merged weight
+            normal_depth_sum *= (accum.a + history.a) / accum.a;
+            accum += history;
+            moment += history_moment;
+            albedo_sum.rgb += history_albedo;
+        }
+    }
+    imageStore(Accumulation, pixel_coord, accum);
+    imageStore(Moments, pixel_coord, vec4(moment, 0.0, 0.0, 0.0));
+    imageStore(Albedo, pixel_coord, albedo_sum);
+    imageStore(NormalDepth, pixel_coord, normal_depth_sum);
 }
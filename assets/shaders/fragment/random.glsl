@@ -41,17 +41,47 @@ vec3 RandomVec3(in float min, in float max) {
     return vec3(Random(min, max), Random(min, max), Random(min, max));
 }
 
+// orthonormal basis with the given normal as z axis (Duff et al. 2017), branch-free
+mat3 Basis(in vec3 normal) {
+    float s = normal.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (s + normal.z);
+    float b = normal.x * normal.y * a;
+    vec3 t = vec3(1.0 + s * normal.x * normal.x * a, s * b, -s * normal.x);
+    vec3 bt = vec3(b, s + normal.y * normal.y * a, -normal.y);
+    return mat3(t, bt, normal);
+}
+
+// uniform on the unit sphere, 2 random numbers
 vec3 RandomUnitVec3() {
-    return normalize(RandomVec3(-1.0, 1.0));
+    vec2 u = RandomVec2();
+    float z = 1.0 - 2.0 * u.x;
+    float r = sqrt(max(0.0, 1.0 - z * z));
+    float phi = 2.0 * PI * u.y;
+    return vec3(r * cos(phi), r * sin(phi), z);
 }
 
+// uniform in the unit ball, 3 random numbers
 vec3 RandomInUnitSphere() {
-    vec3 v;
-    for (int i = 0; i < 10; ++i) {
-        v = RandomVec3(-1.0, 1.0);
-        if (dot(v, v) > 1.0) {
-            return v;
-        }
-    }
-    return normalize(v);
+    return RandomUnitVec3() * pow(Random(), 1.0 / 3.0);
+}
+
+// cosine-weighted around the normal, pdf = cos(theta) / PI, 2 random numbers
+vec3 RandomCosineHemisphere(in vec3 normal) {
+    vec2 u = RandomVec2();
+    float r = sqrt(u.x);
+    float phi = 2.0 * PI * u.y;
+    vec3 local = vec3(r * cos(phi), r * sin(phi), sqrt(max(0.0, 1.0 - u.x)));
+    return Basis(normal) * local;
+}
+
+// GGX visible normal in the local frame (z up) for the view direction, 2 random numbers
+// "Sampling Visible GGX Normals with Spherical Caps" (Dupuy & Benyoub 2023)
+vec3 RandomGGXVNDF(in vec3 view, in vec2 alpha) {
+    vec2 u = RandomVec2();
+    vec3 v = normalize(vec3(alpha * view.xy, view.z));
+    float phi = 2.0 * PI * u.x;
+    float z = (1.0 - u.y) * (1.0 + v.z) - v.z;
+    float r = sqrt(clamp(1.0 - z * z, 0.0, 1.0));
+    vec3 h = vec3(r * cos(phi), r * sin(phi), z) + v;
+    return normalize(vec3(alpha * h.xy, max(h.z, 0.0)));
 }
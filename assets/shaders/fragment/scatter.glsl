@@ -1,10 +1,19 @@
 #version 450 core
 
-#include "common.incl"
+#include "buffers.incl"
 
-layout (binding = 1, std430) readonly buffer MaterialBuffer {
-    Material materials[];
-};
+Material Material_At(in Record rec) {
+    Material mat = materials[rec.material];
+    // ray cone footprint in uv units, there are no screen-space derivatives after the first hit
+    float footprint = rec.cone * rec.texel_density;
+    if (mat.diffuse_texture >= 0) {
+        mat.diffuse *= VirtualTexture_Sample(mat.diffuse_texture, rec.uv, footprint);
+    }
+    if (mat.emissive_texture >= 0) {
+        mat.emissive *= VirtualTexture_Sample(mat.emissive_texture, rec.uv, footprint);
+    }
+    return mat;
+}
 
 float schlick(in float cosine, in float ref_idx) {
     float r0 = (1.0 - ref_idx) / (1.0 + ref_idx);
@@ -12,38 +21,151 @@ float schlick(in float cosine, in float ref_idx) {
     return r0 + (1.0 - r0) * pow((1.0 - cosine), 5.0);
 }
 
-vec3 get_direction(in Ray ray, in Record rec) {
-    vec3 reflected = reflect(ray.direction, rec.normal);
+vec3 fresnel_schlick(in vec3 f0, in float cosine) {
+    return f0 + (1.0 - f0) * pow(1.0 - clamp(cosine, 0.0, 1.0), 5.0);
+}
 
-    Material mat = materials[rec.material];
-    if (mat.transparency > 0.0) {
-        float eta = rec.front_face ? 1.0 / mat.ir : mat.ir;
-        vec3 refracted = refract(ray.direction, rec.normal, eta);
+float Luminance(in vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
 
-        if (refracted == vec3(0.0)) {
-            return reflected;
-        }
+float PowerHeuristic(in float a, in float b) {
+    float a2 = a * a;
+    float b2 = b * b;
+    return a2 + b2 > 0.0 ? a2 / (a2 + b2) : 0.0;
+}
 
-        float cosine = -dot(ray.direction, rec.normal) / length(ray.direction);
-        float probability = Random();
-        if (probability > schlick(cosine, mat.ir)) {
-            return refracted;
-        }
+float ggx_alpha(in Material mat) {
+    return max(mat.roughness * mat.roughness, 1e-3);
+}
+
+// Trowbridge-Reitz normal distribution, cos_h is the cosine between normal and half vector
+float ggx_d(in float cos_h, in float alpha) {
+    float a2 = alpha * alpha;
+    float d = cos_h * cos_h * (a2 - 1.0) + 1.0;
+    return a2 / (PI * d * d);
+}
+
+// Smith lambda for the GGX distribution
+float ggx_lambda(in float cosine, in float alpha) {
+    float c2 = cosine * cosine;
+    float tan2 = max(1.0 - c2, 0.0) / max(c2, EPSILON);
+    return 0.5 * (sqrt(1.0 + alpha * alpha * tan2) - 1.0);
+}
+
+vec3 specular_f0(in Material mat) {
+    return mix(vec3(0.04), mat.diffuse, mat.metalness);
+}
+
+// probability of sampling the specular lobe, estimated from the albedo of each lobe as seen from wo
+float specular_probability(in Material mat, in float cos_o) {
+    float spec = Luminance(fresnel_schlick(specular_f0(mat), cos_o));
+    float diff = (1.0 - mat.metalness) * Luminance(mat.diffuse) * (1.0 - spec);
+    if (diff <= 0.0) {
+        return 1.0;
+    }
+    return clamp(spec / (spec + diff), 0.05, 0.95);
+}
+
+vec3 BSDF_Eval(in Material mat, in vec3 normal, in vec3 wo, in vec3 wi, out float pdf) {
+    pdf = 0.0;
+
+    float cos_o = dot(normal, wo);
+    float cos_i = dot(normal, wi);
+    if (cos_o <= 0.0 || cos_i <= 0.0) {
+        return vec3(0.0);
+    }
+
+    if (DiffuseOnly) {
+        pdf = cos_i / PI;
+        return mat.diffuse / PI;
+    }
+
+    vec3 h = normalize(wo + wi);
+    float cos_h = dot(normal, h);
+    float cos_oh = max(dot(wo, h), EPSILON);
+
+    float alpha = ggx_alpha(mat);
+    float d = ggx_d(cos_h, alpha);
+    float lambda_o = ggx_lambda(cos_o, alpha);
+    float lambda_i = ggx_lambda(cos_i, alpha);
+    vec3 f = fresnel_schlick(specular_f0(mat), cos_oh);
+
+    vec3 specular = f * d / ((1.0 + lambda_o + lambda_i) * 4.0 * cos_o * cos_i);
+    vec3 diffuse = (1.0 - mat.metalness) * (1.0 - f) * mat.diffuse / PI;
+
+    // VNDF pdf of the half vector, mapped to wi by the reflection jacobian 1 / (4 dot(wo, h))
+    float pdf_specular = d / ((1.0 + lambda_o) * 4.0 * cos_o);
+    float pdf_diffuse = cos_i / PI;
+    float p = specular_probability(mat, cos_o);
+    pdf = p * pdf_specular + (1.0 - p) * pdf_diffuse;
 
+    return specular + diffuse;
+}
+
+bool BSDF_Sample(in Material mat, in vec3 normal, in vec3 wo, out vec3 wi, out vec3 weight, out float pdf) {
+    float cos_o = dot(normal, wo);
+    if (cos_o <= 0.0) {
+        return false;
+    }
+
+    if (!DiffuseOnly && Random() < specular_probability(mat, cos_o)) {
+        mat3 basis = Basis(normal);
+        vec3 h = basis * RandomGGXVNDF(transpose(basis) * wo, vec2(ggx_alpha(mat)));
+        wi = reflect(-wo, h);
+    } else {
+        wi = RandomCosineHemisphere(normal);
+    }
+
+    vec3 f = BSDF_Eval(mat, normal, wo, wi, pdf);
+    if (pdf <= 0.0) {
+        return false;
+    }
+
+    weight = f * dot(normal, wi) / pdf;
+    return true;
+}
+
+// next event estimation towards the environment, weighted against bsdf sampling of the same direction
+vec3 direct_environment(in Material mat, in Record rec, in vec3 wo) {
+    vec3 direction;
+    float light_pdf;
+    vec3 radiance = Environment_Sample(direction, light_pdf);
+    if (light_pdf <= 0.0 || dot(direction, rec.normal) <= 0.0) {
+        return vec3(0.0);
+    }
+
+    float bsdf_pdf;
+    vec3 f = BSDF_Eval(mat, rec.normal, wo, direction, bsdf_pdf);
+    if (bsdf_pdf <= 0.0 || Occluded(Ray(rec.p, direction), Interval(0.1, 100.0))) {
+        return vec3(0.0);
+    }
+
+    return f * radiance * dot(direction, rec.normal) * PowerHeuristic(light_pdf, bsdf_pdf) / light_pdf;
+}
+
+// smooth dielectric, a delta lobe: the returned pdf is 0 so light sampling never competes with it
+vec3 dielectric_direction(in Ray ray, in Record rec, in Material mat) {
+    vec3 reflected = reflect(ray.direction, rec.normal);
+
+    float eta = rec.front_face ? 1.0 / mat.ir : mat.ir;
+    vec3 refracted = refract(ray.direction, rec.normal, eta);
+
+    if (refracted == vec3(0.0)) {
         return reflected;
     }
 
-    vec3 direction = reflected;
-    if (mat.metalness < 1.0) {
-        vec3 offset = rec.normal + RandomUnitVec3();
-        direction = mix(offset, direction, mat.metalness);
+    float cosine = -dot(ray.direction, rec.normal) / length(ray.direction);
+    float probability = Random();
+    if (probability > schlick(cosine, mat.ir)) {
+        return refracted;
     }
 
-    return normalize(direction + mat.roughness * RandomInUnitSphere());
+    return reflected;
 }
 
-bool Scatter(inout Ray ray, in Record rec, inout vec3 contribution, inout vec3 light) {
-    Material mat = materials[rec.material];
+bool Scatter(inout Ray ray, in Record rec, in Material mat, inout vec3 contribution, inout vec3 light, out float pdf) {
+    pdf = 0.0;
 
     if (length(mat.emissive) > 0.0) {
         if (rec.front_face) {
@@ -52,12 +174,27 @@ bool Scatter(inout Ray ray, in Record rec, inout vec3 contribution, inout vec3 l
         return false;
     }
 
-    contribution *= mat.diffuse;
+    if (!DiffuseOnly && mat.transparency > 0.0) {
+        contribution *= mat.diffuse;
+        ray.origin = rec.p;
+        ray.direction = dielectric_direction(ray, rec, mat);
+        return true;
+    }
+
+    vec3 wo = -normalize(ray.direction);
+    if (Environment_Enabled()) {
+        light += contribution * direct_environment(mat, rec, wo);
+    }
+
+    vec3 wi, weight;
+    if (!BSDF_Sample(mat, rec.normal, wo, wi, weight, pdf)) {
+        return false;
+    }
 
-    vec3 direction = get_direction(ray, rec);
+    contribution *= weight;
 
     ray.origin = rec.p;
-    ray.direction = direction;
+    ray.direction = wi;
 
     return true;
 }
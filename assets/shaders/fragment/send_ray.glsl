@@ -1,34 +1,36 @@
 #version 450 core
 
-#include "common.incl"
+#include "buffers.incl"
 
-layout (binding = 2, std430) readonly buffer ModelBuffer {
-    Model models[];
-};
-
-layout (binding = 3, std430) readonly buffer BVHBuffer {
-    BVHNode nodes[];
-};
+layout (location = 4) uniform float PixelSpread;
 
 bool models_hit(in Ray ray, in Interval ray_t, inout Record rec) {
 
     Record tmp_rec;
     bool hit = false;
 
-    uint stack[32];
+    uint stack[BVH_STACK_SIZE];
     uint stack_ptr = 0u;
 
+    uint node_count = 0u;
+    uint triangle_count = 0u;
+
     for (uint model_index = 0u; model_index < models.length(); ++model_index) {
         Model model = models[model_index];
 
         vec4 o = model.inverse_transform * vec4(ray.origin, 1.0);
         vec3 d = mat3(model.inverse_transform) * ray.direction;
         Ray tmp_ray = Ray(o.xyz / o.w, d);
+        mat3 normal_matrix = transpose(mat3(model.inverse_transform));
+        float volume_scale = abs(determinant(mat3(model.transform)));
 
         stack[stack_ptr++] = model.root;
 
         while (stack_ptr != 0u) {
             uint node_index = stack[--stack_ptr];
+            if (StatsEnabled) {
+                ++node_count;
+            }
 
             if (!BVHNode_Hit(node_index, tmp_ray, ray_t)) {
                 continue;
@@ -42,36 +44,85 @@ bool models_hit(in Ray ray, in Interval ray_t, inout Record rec) {
                 continue;
             }
 
-            for (uint triangle_index = node.start; triangle_index < node.end; ++triangle_index) {
-                if (!Triangle_Hit(triangle_index, tmp_ray, ray_t, tmp_rec)) {
+            if (StatsEnabled) {
+                triangle_count += node.end - node.start;
+            }
+            for (uint i = node.start; i < node.end; ++i) {
+                if (!Triangle_Hit(triangle_indices[i], tmp_ray, ray_t, tmp_rec)) {
                     continue;
                 }
 
                 hit = true;
                 ray_t.max = tmp_rec.t;
                 rec = tmp_rec;
+                if (model.material >= 0) {
+                    rec.material = uint(model.material);
+                }
                 vec4 p = model.transform * vec4(rec.p, 1.0);
                 rec.p = p.xyz / p.w;
+                // texel density comes from object space edges while the cone is in world space; the transform
+                // scales the area of the surface by |det| times the length of the transformed unit normal
+                vec3 unit_normal = normalize(rec.normal);
+                rec.texel_density *= inversesqrt(max(volume_scale * length(normal_matrix * unit_normal), EPSILON));
+                // shading happens in world space, the inverse transpose keeps the normal perpendicular
+                rec.normal = normalize(normal_matrix * rec.normal);
             }
         }
     }
 
+    if (StatsEnabled) {
+        Stats_Count(STATS_RAYS, 1u);
+        Stats_Count(STATS_NODES, node_count);
+        Stats_Count(STATS_TRIANGLES, triangle_count);
+    }
+
     return hit;
 }
 
-vec3 SendRay(in Ray ray) {
+bool Occluded(in Ray ray, in Interval ray_t) {
+    Record rec;
+    return models_hit(ray, ray_t, rec);
+}
+
+// the first hit also yields the guides of the denoiser: albedo, normal and distance along the primary ray; where
+// the radiance is already exact (misses and lights) the albedo is that radiance so demodulation leaves nothing to blur
+vec3 SendRay(in Ray ray, out vec3 aov_albedo, out vec3 aov_normal, out float aov_depth) {
 
     vec3 light = vec3(0.0);
     vec3 contribution = vec3(1.0);
 
     Record rec;
+    float pdf = 0.0;
+    float distance = 0.0;
     bool ok = true;
-    for (int depth = 0; depth < 20 && ok; ++depth) {
+
+    aov_albedo = vec3(0.0);
+    aov_normal = vec3(0.0);
+    aov_depth = 0.0;
+
+    for (int depth = 0; depth < MaxDepth && ok; ++depth) {
         ok = models_hit(ray, Interval(0.1, 100.0), rec);
         if (!ok) {
-            light += contribution * Miss(ray);
+            // the environment was already sampled directly at the previous non-delta bounce
+            float weight = 1.0;
+            if (pdf > 0.0 && Environment_Enabled()) {
+                weight = PowerHeuristic(pdf, Environment_Pdf(ray.direction));
+            }
+            vec3 miss = Miss(ray);
+            light += contribution * miss * weight;
+            if (depth == 0) {
+                aov_albedo = miss;
+            }
         } else {
-            ok = Scatter(ray, rec, contribution, light);
+            distance += length(rec.p - ray.origin);
+            rec.cone = distance * PixelSpread;
+            Material mat = Material_At(rec);
+            if (depth == 0) {
+                aov_albedo = length(mat.emissive) > 0.0 ? mat.emissive : mat.diffuse;
+                aov_normal = rec.normal;
+                aov_depth = rec.t;
+            }
+            ok = Scatter(ray, rec, mat, contribution, light, pdf);
         }
     }
 
@@ -0,0 +1,11 @@
+#version 450 core
+
+#include "common.incl"
+
+layout (binding = 6, std430) buffer StatsBuffer {
+    uint counters[];
+};
+
+void Stats_Count(in uint counter, in uint count) {
+    atomicAdd(counters[counter], count);
+}
@@ -1,10 +1,6 @@
 #version 450 core
 
-#include "common.incl"
-
-layout (binding = 0, std430) readonly buffer TriangleBuffer {
-    Triangle triangles[];
-};
+#include "buffers.incl"
 
 bool Triangle_Hit(in uint index, in Ray ray, in Interval ray_t, inout Record rec) {
 
@@ -45,6 +41,9 @@ bool Triangle_Hit(in uint index, in Ray ray, in Interval ray_t, inout Record rec
     rec.t = t;
     rec.p = Ray_At(ray, t);
     rec.uv = self.uv0 * w + self.uv1 * u + self.uv2 * v;
+    vec2 duv1 = self.uv1 - self.uv0;
+    vec2 duv2 = self.uv2 - self.uv0;
+    rec.texel_density = sqrt(abs(duv1.x * duv2.y - duv1.y * duv2.x) / max(length(cross(edge1, edge2)), EPSILON));
     vec3 outward_normal = self.n0 * w + self.n1 * u + self.n2 * v;
     Record_SetNormal(rec, ray, outward_normal);
     rec.material = self.material;
@@ -0,0 +1,103 @@
+#version 450 core
+
+#include "common.incl"
+
+const uint TILE_SIZE = 128u;
+const uint TILE_BORDER = 4u;
+const uint TILE_STRIDE = TILE_SIZE + 2u * TILE_BORDER;
+const uint PAGE_TILES = 16u;
+const uint NOT_RESIDENT = 0xffffffffu;
+
+// per texture a descriptor (level 0 tiles per side, levels, first entry, size), followed by one slot per tile
+layout (binding = 4, std430) readonly buffer PageTableBuffer {
+    uint page_table[];
+};
+
+// request flags, one bit per page table entry, followed by the frame each atlas slot was last used in
+layout (binding = 5, std430) buffer FeedbackBuffer {
+    uint request_count;
+    uint requests[MAX_TILE_REQUESTS];
+    uint feedback[];
+};
+
+layout (binding = 0) uniform sampler2DArray TileAtlas;
+
+layout (location = 8) uniform int TextureCount;
+layout (location = 9) uniform uint TextureFrame;
+layout (location = 10) uniform uint FeedbackUsageOffset;
+
+void request_tile(in uint entry) {
+    uint bit = 1u << (entry & 31u);
+    if ((atomicOr(feedback[entry >> 5u], bit) & bit) == 0u) {
+        uint i = atomicAdd(request_count, 1u);
+        if (i < MAX_TILE_REQUESTS) {
+            requests[i] = entry;
+        }
+    }
+}
+
+bool sample_level(in uvec4 desc, in uint level, in vec2 uv, in bool request, out vec3 color) {
+    uint size = max(desc.w >> level, 1u);
+    uint grid = max(desc.x >> level, 1u);
+
+    uint entry = desc.z;
+    for (uint l = 0u; l < level; ++l) {
+        uint g = max(desc.x >> l, 1u);
+        entry += g * g;
+    }
+
+    vec2 texel = fract(uv) * float(size);
+    uvec2 tile = min(uvec2(texel) / TILE_SIZE, uvec2(grid - 1u));
+    entry += tile.y * grid + tile.x;
+
+    uint slot = page_table[4u * uint(TextureCount) + entry];
+    if (slot == NOT_RESIDENT) {
+        if (request) {
+            request_tile(entry);
+        }
+        return false;
+    }
+    feedback[FeedbackUsageOffset + slot] = TextureFrame;
+
+    uint page = slot / (PAGE_TILES * PAGE_TILES);
+    uint index = slot % (PAGE_TILES * PAGE_TILES);
+    vec2 origin = vec2(uvec2(index % PAGE_TILES, index / PAGE_TILES) * TILE_STRIDE + TILE_BORDER);
+    vec2 local = texel - vec2(tile * TILE_SIZE);
+
+    color = textureLod(TileAtlas, vec3((origin + local) / float(PAGE_TILES * TILE_STRIDE), float(page)), 0.0).rgb;
+    return true;
+}
+
+// finest resident level at or above the requested one, asking for the requested tile if it is missing
+vec3 sample_resident(in uvec4 desc, in uint level, in vec2 uv) {
+    vec3 color = vec3(1.0);
+    bool request = true;
+    for (uint l = level; l < desc.y; ++l) {
+        if (sample_level(desc, l, uv, request, color)) {
+            break;
+        }
+        request = false;
+    }
+    return color;
+}
+
+vec3 VirtualTexture_Sample(in int index, in vec2 uv, in float footprint) {
+    if (index < 0 || index >= TextureCount) {
+        return vec3(1.0);
+    }
+
+    uint base = 4u * uint(index);
+    uvec4 desc = uvec4(page_table[base], page_table[base + 1u], page_table[base + 2u], page_table[base + 3u]);
+    if (desc.y == 0u) {
+        return vec3(1.0);
+    }
+
+    float lod = clamp(log2(max(footprint * float(desc.w), 1.0)), 0.0, float(desc.y - 1u));
+    uint level = uint(lod);
+
+    vec3 fine = sample_resident(desc, level, uv);
+    if (level + 1u >= desc.y) {
+        return fine;
+    }
+    return mix(fine, sample_resident(desc, level + 1u, uv), fract(lod));
+}
@@ -1,9 +1,20 @@
 #pragma once
 
+#include <chrono>
+#include <map>
 #include <glm/glm.hpp>
 #include <pathtracer/buffer.hpp>
+#include <pathtracer/checkpoint.hpp>
+#include <pathtracer/denoiser.hpp>
+#include <pathtracer/distributed.hpp>
+#include <pathtracer/environment.hpp>
+#include <pathtracer/file_watcher.hpp>
+#include <pathtracer/image_export.hpp>
+#include <pathtracer/options.hpp>
 #include <pathtracer/scene.hpp>
 #include <pathtracer/shader.hpp>
+#include <pathtracer/shader_compiler.hpp>
+#include <pathtracer/thread_pool.hpp>
 #include <pathtracer/vertex_array.hpp>
 #include <pathtracer/window.hpp>
 
@@ -12,34 +23,172 @@ namespace pathtracer
     class App
     {
     public:
-        App();
+        explicit App(const Options &options);
         ~App();
 
         void OnStart();
         void OnFrame();
 
     private:
+        void ResetAccumulation();
+        void Resize(int width, int height);
+        void Trace(int width, int height);
+        [[nodiscard]] bool StatsEnabled() const;
+        void BindImages() const;
+        void UpdateCamera();
+
+        void LoadScene(const std::filesystem::path &path);
+        void ApplySceneSettings(const SceneFile &file);
+        void WatchSources();
+        void ReloadChanged();
+        void SelectShader();
+        void EstimateError(int width, int height);
+        void Denoise(int width, int height);
+        void Display();
+        void Export(int width, int height);
+        void WriteCheckpoint(int width, int height);
+        void ResumeCheckpoint(int width, int height);
+        [[nodiscard]] std::uint64_t SceneHash() const;
+
+        void WaitForScene();
+        void RunWorker(const std::string &address);
+        void RenderTile(const RenderJob &job, RenderResult &result);
+        void RunSequence(const std::filesystem::path &output);
+        void RunBenchmark(int width, int height);
+
         std::filesystem::path m_Assets;
+        std::unique_ptr<ThreadPool> m_ThreadPool;
         std::unique_ptr<Window> m_Window;
 
         std::unique_ptr<Scene> m_Scene;
 
-        std::unique_ptr<Shader> m_Shader;
+        // camera and render settings of a scene file are applied when it is opened, not when it is reloaded
+        std::string m_ScenePath;
+        std::filesystem::path m_LoadedScenePath;
+        std::unique_ptr<EnvironmentMap> m_Environment;
+        std::string m_EnvironmentPath;
+        float m_EnvironmentRotation = 0.f;
+
+        // specialized programs by permutation, compiled the first time a permutation is selected
+        std::map<ShaderDefines, std::unique_ptr<Shader> > m_Shaders;
+        Shader *m_Shader = nullptr;
+        std::vector<ShaderPermutation> m_Permutations;
+        ShaderDefines m_Defines;
+        std::unique_ptr<Buffer> m_StatsBuffer;
+        GLuint m_Stats[3]{};
+
+        // draw time per link mode, measured with a small ring of timer queries so reading never stalls
+        static constexpr unsigned TIMER_QUERIES = 4;
+        GLuint m_TimerQueries[TIMER_QUERIES]{};
+        std::string m_TimerLinks[TIMER_QUERIES];
+        unsigned m_TimerIndex = 0;
+        std::map<std::string, double> m_DrawTimes;
+        std::unique_ptr<ShaderCompiler> m_ShaderCompiler;
+        std::unique_ptr<FileWatcher> m_FileWatcher;
+        std::string m_ShaderError;
+        std::string m_SceneError;
         std::unique_ptr<VertexArray> m_VertexArray;
         std::unique_ptr<Buffer> m_VertexBuffer;
 
         GLuint m_AccumulationTexture{};
 
+        // moved with wasd, space and shift, turned by dragging with the right mouse button
+        glm::vec3 m_CameraPosition = ORIGIN;
+        float m_CameraYaw = -90.f;
+        float m_CameraPitch = 0.f;
+        float m_CameraSpeed = 1.f;
+        float m_Fov = FOV;
+        double m_LastTime = 0.0;
+        glm::dvec2 m_LastCursor{};
+        bool m_CameraMoved = false;
+
+        // temporal reprojection: on a camera move the images become the history (accumulation, moments, albedo,
+        // normal/depth) and every pixel merges what the previous camera saw of its surface into its first samples
+        GLuint m_HistoryTextures[4]{};
+        bool m_Reprojection = true;
+        bool m_Reproject = false;
+        int m_HistoryLimit = 64;
+        glm::mat4 m_WorldToScreen{1.f};
+        glm::vec3 m_ViewOrigin{};
+        glm::mat4 m_PreviousWorldToScreen{1.f};
+        glm::vec3 m_PreviousOrigin{};
+        unsigned m_Frame = 0;
+
+        // adaptive sampling: luminance moments per pixel, relative error per tile and the number of tiles that
+        // still need samples, read back through a fence once the estimate pass has finished
+        std::unique_ptr<Shader> m_ErrorShader;
+        std::unique_ptr<Buffer> m_AdaptiveBuffer;
+        GLuint m_MomentsTexture{};
+        GLuint m_TileErrorTexture{};
+        GLsync m_AdaptiveFence = nullptr;
+        GLuint m_ActiveTiles = 0;
+        float m_ErrorThreshold = 0.02f;
+        bool m_Converged = false;
+
+        // denoising: first-hit albedo and normal/depth are summed next to the color and guide an a-trous filter,
+        // either compute passes ping-ponging between two textures or the cpu filter on a read back copy
+        enum class DenoiseMode
+        {
+            Off,
+            Gpu,
+            Cpu,
+        };
+
+        std::unique_ptr<Shader> m_DenoiseShader;
+        std::unique_ptr<Denoiser> m_Denoiser;
+        GLuint m_AlbedoTexture{};
+        GLuint m_NormalDepthTexture{};
+        GLuint m_DenoiseTextures[2]{};
+        DenoiseMode m_DenoiseMode = DenoiseMode::Off;
+        DenoiseSettings m_DenoiseSettings;
+        int m_DenoiseResult = -1;
+        bool m_DenoiseDirty = true;
+        unsigned m_AccumulationGeneration = 0;
+        unsigned m_DenoiseGeneration = 0;
+
+        // checkpoints: every interval samples the images go to disk together with what it takes to continue them;
+        // with --resume the first checkpoint is uploaded once nothing else restarts the image
+        std::unique_ptr<CheckpointWriter> m_CheckpointWriter;
+        std::filesystem::path m_CheckpointPath;
+        std::unique_ptr<Checkpoint> m_Resume;
+        int m_CheckpointInterval = 1024;
+        unsigned m_CheckpointSamples = 0;
+        bool m_CheckpointRequested = false;
+        std::string m_CheckpointStatus;
+
+        // presentation only, none of these touch the accumulation
+        std::unique_ptr<Shader> m_DisplayShader;
+        float m_Exposure = 0.f;
+        Tonemap m_Tonemap = Tonemap::Aces;
+        bool m_EncodeSrgb = false;
+
+        // exports read back whatever is displayed, once on request or every interval samples for a time lapse
+        std::unique_ptr<ImageExporter> m_Exporter;
+        std::string m_ExportPath;
+        ExportFormat m_ExportFormat = ExportFormat::ExrHalf;
+        int m_ExportInterval = 0;
+        unsigned m_ExportSamples = 0;
+        bool m_ExportRequested = false;
+        std::string m_ExportStatus;
+
         unsigned m_SampleCount = 1u;
+        bool m_ResetRequested = false;
+        bool m_UniformsDirty = true;
         int m_PreviousWidth = 0;
         int m_PreviousHeight = 0;
 
         static constexpr GLfloat VERTICES[]{-1.f, -1.f, -1.f, 1.f, 1.f, 1.f, 1.f, -1.f};
         static constexpr GLuint INDICES[]{0u, 1u, 2u, 2u, 3u, 0u};
         static constexpr glm::vec3 ORIGIN{0.f, 0.f, 3.75f};
-        static constexpr glm::vec3 TARGET{0.f, 0.f, 0.f};
         static constexpr glm::vec3 UP{0.f, 1.f, 0.f};
-
-        static glm::mat4 CAMERA_TO_WORLD;
+        static constexpr float FOV = 40.f;
+        static constexpr float LOOK_SPEED = .2f;
+        static constexpr size_t TEXTURE_BUDGET = 256ull << 20;
+        static constexpr int ADAPTIVE_TILE = 16;
+        static constexpr unsigned ADAPTIVE_INTERVAL = 16;
+        static constexpr unsigned ADAPTIVE_MIN_SAMPLES = 16;
+        static constexpr unsigned WORKER_RESTARTS = 4;
+        static constexpr std::chrono::milliseconds SEQUENCE_PRESENT_INTERVAL{250};
+        static constexpr size_t BENCHMARK_PACKETS_PER_TASK = 16;
     };
 }
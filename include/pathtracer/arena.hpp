@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace pathtracer
+{
+    // linear allocator over one block: allocations only move an offset and are dropped all at once by Reset, the
+    // block is kept so the next user of the arena allocates nothing unless it needs more
+    class Arena
+    {
+    public:
+        Arena() = default;
+
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        // bytes needed for count objects wherever the previous allocation ended
+        template<typename T>
+        static constexpr size_t Footprint(const size_t count)
+        {
+            return count * sizeof(T) + alignof(T) - 1;
+        }
+
+        // grows the block to at least bytes, which also resets it
+        void Reserve(size_t bytes);
+        void Reset();
+
+        void *Allocate(size_t bytes, size_t alignment);
+
+        template<typename T>
+        T *Allocate(const size_t count)
+        {
+            static_assert(std::is_trivially_destructible_v<T>, "arena memory is released without destructors");
+            const auto memory = static_cast<T *>(Allocate(count * sizeof(T), alignof(T)));
+            std::uninitialized_default_construct_n(memory, count);
+            return memory;
+        }
+
+        [[nodiscard]] size_t GetUsed() const;
+        [[nodiscard]] size_t GetCapacity() const;
+
+    private:
+        std::unique_ptr<std::byte[]> m_Memory;
+        size_t m_Capacity = 0;
+        size_t m_Used = 0;
+    };
+}
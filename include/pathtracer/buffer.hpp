@@ -17,8 +17,12 @@ namespace pathtracer
 
         void Data(GLsizeiptr size, const void *data) const;
 
+        void SubData(GLintptr offset, GLsizeiptr size, const void *data) const;
+
         void BindBase(GLuint i) const;
 
+        [[nodiscard]] GLuint Handle() const;
+
     private:
         GLuint m_Handle = 0;
         GLenum m_Target;
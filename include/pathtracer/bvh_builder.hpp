@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <pathtracer/arena.hpp>
+#include <pathtracer/scene.hpp>
+#include <pathtracer/shader_limits.hpp>
+#include <pathtracer/thread_pool.hpp>
+
+namespace pathtracer
+{
+    // nodes come as parent and then the subtrees of both children, so every subtree covers one run of the indices;
+    // leaves range over the indices, which index the triangles
+    struct BvhTree
+    {
+        std::vector<BVHNode> Nodes;
+        std::vector<std::uint32_t> Indices;
+    };
+
+    // median splits reference every triangle once and build large subtrees in parallel; spatial splits choose
+    // between object and spatial planes by surface area and may reference a triangle from several leaves, as long as
+    // the duplication budget of the mesh allows. the depth first layout then stores the larger child of every node
+    // right behind it, and the triangles are sorted into leaf order. scratch comes from an arena that is kept per
+    // thread and reset per build, nodes are reserved for the largest tree that fits
+    class BvhBuilder
+    {
+    public:
+        BvhBuilder(ThreadPool &pool, BuildStats &stats);
+        ~BvhBuilder();
+
+        BvhBuilder(const BvhBuilder &) = delete;
+        BvhBuilder &operator=(const BvhBuilder &) = delete;
+
+        BvhTree Build(std::vector<Triangle> &triangles, const SceneBvh &settings);
+
+        static constexpr unsigned PARALLEL_BUILD_TRIANGLES = 4096;
+        static constexpr unsigned SPATIAL_BINS = 32;
+        static constexpr unsigned OBJECT_BINS = 32;
+        static constexpr unsigned MAX_LEAF_TRIANGLES = 8;
+        // a leaf at depth d leaves d + 1 entries on the shader stack, right children are popped first
+        static constexpr unsigned MAX_DEPTH = BVH_STACK_SIZE - 1;
+
+    private:
+        BvhTree BuildMedian(const std::vector<Triangle> &triangles);
+        BvhTree BuildSpatial(const std::vector<Triangle> &triangles, float duplication);
+        void LayOut(BvhTree &tree);
+        void SortTriangles(BvhTree &tree, std::vector<Triangle> &triangles);
+
+        ThreadPool &m_Pool;
+        BuildStats &m_Stats;
+        std::optional<Arena> m_OwnArena;
+        Arena *m_Arena;
+        bool m_Lease;
+    };
+}
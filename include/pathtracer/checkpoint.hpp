@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <pathtracer/readback.hpp>
+#include <pathtracer/thread_pool.hpp>
+
+namespace pathtracer
+{
+    struct CheckpointHeader
+    {
+        char Magic[4];
+        std::uint32_t Version;
+        std::uint32_t Width;
+        std::uint32_t Height;
+        std::uint32_t SampleCount;
+        std::uint32_t Frame;
+        std::uint64_t SceneHash;
+        float Camera[6];
+        std::uint32_t SceneLength;
+    };
+
+    // accumulation, moments, albedo and normal/depth: everything a pixel needs to continue where it stopped
+    static constexpr unsigned CHECKPOINT_IMAGES = 4;
+
+    struct Checkpoint
+    {
+        // camera is position, yaw, pitch and fov; the frame seeds the sampler of the next frame
+        CheckpointHeader Header{};
+        std::string Scene;
+
+        // rgba rows as uploaded, only filled when read from disk
+        std::vector<float> Images[CHECKPOINT_IMAGES];
+
+        static Checkpoint Read(const std::filesystem::path &path);
+
+        // images holds CHECKPOINT_IMAGES images of the header size back to back; the file is synced before it
+        // replaces path, so a preempted run finds either the previous checkpoint or this one
+        void Write(const std::filesystem::path &path, const float *images) const;
+
+        // a sibling of path that no file uses yet, where a refused checkpoint is not overwritten
+        static std::filesystem::path FreshPath(const std::filesystem::path &path);
+
+        // why these images cannot continue a framebuffer of this size and scene, empty when they can
+        [[nodiscard]] std::string Mismatch(int width, int height, std::uint64_t scene_hash) const;
+    };
+
+    // reads the images back without stalling, and the pool writes them straight from the mapping to a temporary
+    // file that replaces the previous checkpoint
+    class CheckpointWriter
+    {
+    public:
+        explicit CheckpointWriter(ThreadPool &pool);
+
+        CheckpointWriter(const CheckpointWriter &) = delete;
+        CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+        // false while the previous checkpoint is still in flight
+        bool Start(const std::filesystem::path &path, const GLuint (&images)[CHECKPOINT_IMAGES], Checkpoint state);
+
+        // true once per finished write, the error is empty on success
+        bool Poll(std::string &error);
+
+        [[nodiscard]] bool IsBusy() const;
+
+    private:
+        TextureReadback m_Readback;
+    };
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+#include <pathtracer/scene.hpp>
+
+namespace pathtracer
+{
+    // the interval is open like Interval_Surrounds, the shaders trace with (0.1, 100)
+    struct CpuRay
+    {
+        glm::vec3 Origin{0.f};
+        float TMin = .1f;
+        glm::vec3 Direction{0.f, 0.f, -1.f};
+        float TMax = 100.f;
+    };
+
+    struct CpuHit
+    {
+        float T = std::numeric_limits<float>::infinity();
+        std::uint32_t Triangle = ~0u;
+        std::uint32_t Model = ~0u;
+        float U = 0.f;
+        float V = 0.f;
+
+        [[nodiscard]] bool IsHit() const { return Triangle != ~0u; }
+    };
+
+    enum class SimdLevel
+    {
+        Scalar,
+        Sse42,
+        Avx2,
+        Avx512,
+    };
+
+    // the trees of a scene for tracing on the host: the binary nodes, indices and triangles as uploaded for the
+    // scalar port of models_hit, and a copy collapsed to four children per node with bounds and triangles stored as
+    // structures of arrays, so one instruction tests four boxes or eight triangles against a ray, or one box or
+    // triangle against a packet of up to sixteen rays; the kernel matching the cpu is picked at runtime
+    class CpuBvh
+    {
+    public:
+        static constexpr unsigned NODE_WIDTH = 4;
+        static constexpr unsigned TRIANGLE_WIDTH = 8;
+        static constexpr unsigned MAX_PACKET = 16;
+        static constexpr std::uint32_t EMPTY = ~0u;
+
+        // children with a count are leaves, the child is then the first of count triangle blocks
+        struct alignas(64) Node
+        {
+            float MinX[NODE_WIDTH], MinY[NODE_WIDTH], MinZ[NODE_WIDTH];
+            float MaxX[NODE_WIDTH], MaxY[NODE_WIDTH], MaxZ[NODE_WIDTH];
+            std::uint32_t Child[NODE_WIDTH];
+            std::uint32_t Count[NODE_WIDTH];
+        };
+
+        // unused lanes have zero edges, the determinant test rejects them
+        struct alignas(32) TriangleBlock
+        {
+            float P0X[TRIANGLE_WIDTH], P0Y[TRIANGLE_WIDTH], P0Z[TRIANGLE_WIDTH];
+            float E1X[TRIANGLE_WIDTH], E1Y[TRIANGLE_WIDTH], E1Z[TRIANGLE_WIDTH];
+            float E2X[TRIANGLE_WIDTH], E2Y[TRIANGLE_WIDTH], E2Z[TRIANGLE_WIDTH];
+            std::uint32_t Index[TRIANGLE_WIDTH];
+        };
+
+        // cache lines the scalar traversal reads and how many of them a modelled cache misses, for comparing layouts
+        // rather than predicting a particular cpu
+        struct CacheStats
+        {
+            size_t Rays = 0;
+            size_t Lines = 0;
+            size_t L1Misses = 0;
+            size_t L2Misses = 0;
+        };
+
+        // rows of the inverse transform, rays are moved into the space of the model like in the shader
+        struct Instance
+        {
+            float ToObject[3][4];
+            std::uint32_t BinaryRoot;
+            std::uint32_t Root;
+        };
+
+        // the collapsed tree as raw arrays for the kernels, which may not call into std::vector
+        struct View
+        {
+            const Node *Nodes;
+            const TriangleBlock *Blocks;
+            const Instance *Instances;
+            std::uint32_t InstanceCount;
+        };
+
+        explicit CpuBvh(const Scene &scene);
+        CpuBvh(
+            const std::vector<Triangle> &triangles,
+            const std::vector<std::uint32_t> &indices,
+            const std::vector<BVHNode> &nodes,
+            const std::vector<Model> &models);
+
+        static SimdLevel Detect();
+        static const char *Name(SimdLevel level);
+
+        // the number of rays one packet instruction covers, packets of other sizes are split or padded
+        static unsigned PacketSize(SimdLevel level);
+
+        void Intersect(const CpuRay &ray, CpuHit &hit, SimdLevel level) const;
+
+        // rays should be coherent, primary rays of a small screen tile; count is at most MAX_PACKET
+        void IntersectPacket(const CpuRay *rays, CpuHit *hits, unsigned count, SimdLevel level) const;
+
+        // traces the rays in order through one cache that stays warm from ray to ray
+        CacheStats MeasureCache(const std::vector<CpuRay> &rays) const;
+
+        [[nodiscard]] const std::vector<Node> &GetNodes() const;
+        [[nodiscard]] const std::vector<TriangleBlock> &GetBlocks() const;
+        [[nodiscard]] const std::vector<Instance> &GetInstances() const;
+        [[nodiscard]] View GetView() const;
+
+    private:
+        std::uint32_t Collapse(std::uint32_t binary);
+        std::uint32_t AddBlocks(std::uint32_t start, std::uint32_t end);
+
+        // touch(address, bytes) is told about every node, index and triangle read
+        template<typename F>
+        void IntersectScalar(const CpuRay &ray, CpuHit &hit, const F &touch) const;
+
+        std::vector<Triangle> m_Triangles;
+        std::vector<std::uint32_t> m_Indices;
+        std::vector<BVHNode> m_BinaryNodes;
+
+        // index range below every binary node, the builder stores every subtree as a contiguous run
+        std::vector<std::pair<std::uint32_t, std::uint32_t> > m_Ranges;
+
+        std::vector<Node> m_Nodes;
+        std::vector<TriangleBlock> m_Blocks;
+        std::vector<Instance> m_Instances;
+    };
+}
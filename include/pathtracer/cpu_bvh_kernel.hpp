@@ -0,0 +1,477 @@
+#pragma once
+
+// the traversal kernels of CpuBvh, included by one translation unit per instruction set with PATHTRACER_ISA naming
+// its namespace; every unit is compiled with its own target flags, so nothing in here may be shared between them.
+// that includes inline and template code from other headers: the linker keeps one copy of each, which may be the one
+// built for a wider instruction set than the cpu has, so the kernels stick to raw arrays, plain loops and intrinsics
+
+#ifndef PATHTRACER_ISA
+#error "define PATHTRACER_ISA before including the kernels"
+#endif
+
+#include <immintrin.h>
+#include <pathtracer/cpu_bvh.hpp>
+
+namespace pathtracer::PATHTRACER_ISA
+{
+    void Intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit);
+    void IntersectPacket(const CpuBvh::View &bvh, const CpuRay *rays, CpuHit *hits, unsigned count);
+
+    // the same threshold as EPSILON in the shaders
+    static constexpr float DETERMINANT_EPSILON = 1e-7f;
+    static constexpr unsigned STACK_SIZE = 512;
+
+    struct Mask4
+    {
+        __m128 V;
+
+        [[nodiscard]] unsigned Bits() const { return static_cast<unsigned>(_mm_movemask_ps(V)); }
+        friend Mask4 operator&(const Mask4 a, const Mask4 b) { return {_mm_and_ps(a.V, b.V)}; }
+    };
+
+    struct Float4
+    {
+        using Mask = Mask4;
+        static constexpr unsigned WIDTH = 4;
+
+        __m128 V;
+
+        static Float4 Broadcast(const float x) { return {_mm_set1_ps(x)}; }
+        static Float4 Load(const float *p) { return {_mm_load_ps(p)}; }
+        void Store(float *p) const { _mm_store_ps(p, V); }
+
+        friend Float4 operator+(const Float4 a, const Float4 b) { return {_mm_add_ps(a.V, b.V)}; }
+        friend Float4 operator-(const Float4 a, const Float4 b) { return {_mm_sub_ps(a.V, b.V)}; }
+        friend Float4 operator*(const Float4 a, const Float4 b) { return {_mm_mul_ps(a.V, b.V)}; }
+        friend Float4 operator/(const Float4 a, const Float4 b) { return {_mm_div_ps(a.V, b.V)}; }
+        friend Mask4 operator<(const Float4 a, const Float4 b) { return {_mm_cmplt_ps(a.V, b.V)}; }
+        friend Mask4 operator<=(const Float4 a, const Float4 b) { return {_mm_cmple_ps(a.V, b.V)}; }
+        friend Mask4 operator>(const Float4 a, const Float4 b) { return {_mm_cmpgt_ps(a.V, b.V)}; }
+        friend Mask4 operator>=(const Float4 a, const Float4 b) { return {_mm_cmpge_ps(a.V, b.V)}; }
+        friend Float4 Min(const Float4 a, const Float4 b) { return {_mm_min_ps(a.V, b.V)}; }
+        friend Float4 Max(const Float4 a, const Float4 b) { return {_mm_max_ps(a.V, b.V)}; }
+        friend Float4 Abs(const Float4 a) { return {_mm_andnot_ps(_mm_set1_ps(-0.f), a.V)}; }
+        friend Float4 Select(const Mask4 m, const Float4 a, const Float4 b) { return {_mm_blendv_ps(b.V, a.V, m.V)}; }
+    };
+
+#if defined(__AVX2__)
+    struct Mask8
+    {
+        __m256 V;
+
+        [[nodiscard]] unsigned Bits() const { return static_cast<unsigned>(_mm256_movemask_ps(V)); }
+        friend Mask8 operator&(const Mask8 a, const Mask8 b) { return {_mm256_and_ps(a.V, b.V)}; }
+    };
+
+    struct Float8
+    {
+        using Mask = Mask8;
+        static constexpr unsigned WIDTH = 8;
+
+        __m256 V;
+
+        static Float8 Broadcast(const float x) { return {_mm256_set1_ps(x)}; }
+        static Float8 Load(const float *p) { return {_mm256_load_ps(p)}; }
+        void Store(float *p) const { _mm256_store_ps(p, V); }
+
+        friend Float8 operator+(const Float8 a, const Float8 b) { return {_mm256_add_ps(a.V, b.V)}; }
+        friend Float8 operator-(const Float8 a, const Float8 b) { return {_mm256_sub_ps(a.V, b.V)}; }
+        friend Float8 operator*(const Float8 a, const Float8 b) { return {_mm256_mul_ps(a.V, b.V)}; }
+        friend Float8 operator/(const Float8 a, const Float8 b) { return {_mm256_div_ps(a.V, b.V)}; }
+        friend Mask8 operator<(const Float8 a, const Float8 b) { return {_mm256_cmp_ps(a.V, b.V, _CMP_LT_OQ)}; }
+        friend Mask8 operator<=(const Float8 a, const Float8 b) { return {_mm256_cmp_ps(a.V, b.V, _CMP_LE_OQ)}; }
+        friend Mask8 operator>(const Float8 a, const Float8 b) { return {_mm256_cmp_ps(a.V, b.V, _CMP_GT_OQ)}; }
+        friend Mask8 operator>=(const Float8 a, const Float8 b) { return {_mm256_cmp_ps(a.V, b.V, _CMP_GE_OQ)}; }
+        friend Float8 Min(const Float8 a, const Float8 b) { return {_mm256_min_ps(a.V, b.V)}; }
+        friend Float8 Max(const Float8 a, const Float8 b) { return {_mm256_max_ps(a.V, b.V)}; }
+        friend Float8 Abs(const Float8 a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.f), a.V)}; }
+        friend Float8 Select(const Mask8 m, const Float8 a, const Float8 b) { return {_mm256_blendv_ps(b.V, a.V, m.V)}; }
+    };
+#endif
+
+#if defined(__AVX512F__)
+    struct Mask16
+    {
+        __mmask16 V;
+
+        [[nodiscard]] unsigned Bits() const { return V; }
+        friend Mask16 operator&(const Mask16 a, const Mask16 b) { return {static_cast<__mmask16>(a.V & b.V)}; }
+    };
+
+    struct Float16
+    {
+        using Mask = Mask16;
+        static constexpr unsigned WIDTH = 16;
+
+        __m512 V;
+
+        static Float16 Broadcast(const float x) { return {_mm512_set1_ps(x)}; }
+        static Float16 Load(const float *p) { return {_mm512_load_ps(p)}; }
+        void Store(float *p) const { _mm512_store_ps(p, V); }
+
+        friend Float16 operator+(const Float16 a, const Float16 b) { return {_mm512_add_ps(a.V, b.V)}; }
+        friend Float16 operator-(const Float16 a, const Float16 b) { return {_mm512_sub_ps(a.V, b.V)}; }
+        friend Float16 operator*(const Float16 a, const Float16 b) { return {_mm512_mul_ps(a.V, b.V)}; }
+        friend Float16 operator/(const Float16 a, const Float16 b) { return {_mm512_div_ps(a.V, b.V)}; }
+        friend Mask16 operator<(const Float16 a, const Float16 b) { return {_mm512_cmp_ps_mask(a.V, b.V, _CMP_LT_OQ)}; }
+        friend Mask16 operator<=(const Float16 a, const Float16 b) { return {_mm512_cmp_ps_mask(a.V, b.V, _CMP_LE_OQ)}; }
+        friend Mask16 operator>(const Float16 a, const Float16 b) { return {_mm512_cmp_ps_mask(a.V, b.V, _CMP_GT_OQ)}; }
+        friend Mask16 operator>=(const Float16 a, const Float16 b) { return {_mm512_cmp_ps_mask(a.V, b.V, _CMP_GE_OQ)}; }
+        friend Float16 Min(const Float16 a, const Float16 b) { return {_mm512_min_ps(a.V, b.V)}; }
+        friend Float16 Max(const Float16 a, const Float16 b) { return {_mm512_max_ps(a.V, b.V)}; }
+        friend Float16 Abs(const Float16 a) { return {_mm512_abs_ps(a.V)}; }
+        friend Float16 Select(const Mask16 m, const Float16 a, const Float16 b) { return {_mm512_mask_blend_ps(m.V, b.V, a.V)}; }
+    };
+#endif
+
+    // rays, boxes and triangles as lanes, either one ray broadcast against several boxes or triangles or one box or
+    // triangle broadcast against several rays
+    template<typename F>
+    struct Lanes3
+    {
+        F X, Y, Z;
+    };
+
+    // slab test, near is where each lane enters its box
+    template<typename F>
+    typename F::Mask box_test(
+        const Lanes3<F> &min,
+        const Lanes3<F> &max,
+        const Lanes3<F> &origin,
+        const Lanes3<F> &inverse,
+        const F &t_min,
+        const F &t_max,
+        F &near)
+    {
+        const auto x0 = (min.X - origin.X) * inverse.X;
+        const auto x1 = (max.X - origin.X) * inverse.X;
+        const auto y0 = (min.Y - origin.Y) * inverse.Y;
+        const auto y1 = (max.Y - origin.Y) * inverse.Y;
+        const auto z0 = (min.Z - origin.Z) * inverse.Z;
+        const auto z1 = (max.Z - origin.Z) * inverse.Z;
+
+        near = Max(Max(Min(x0, x1), Min(y0, y1)), Max(Min(z0, z1), t_min));
+        const auto far = Min(Min(Max(x0, x1), Max(y0, y1)), Min(Max(z0, z1), t_max));
+        return near <= far;
+    }
+
+    // moller-trumbore in the order of Triangle_Hit, so hits agree with the shader and the scalar path
+    template<typename F>
+    typename F::Mask triangle_test(
+        const Lanes3<F> &origin,
+        const Lanes3<F> &direction,
+        const Lanes3<F> &p0,
+        const Lanes3<F> &e1,
+        const Lanes3<F> &e2,
+        const F &t_min,
+        const F &t_max,
+        F &t,
+        F &u,
+        F &v)
+    {
+        const auto zero = F::Broadcast(0.f);
+        const auto one = F::Broadcast(1.f);
+
+        const auto px = direction.Y * e2.Z - direction.Z * e2.Y;
+        const auto py = direction.Z * e2.X - direction.X * e2.Z;
+        const auto pz = direction.X * e2.Y - direction.Y * e2.X;
+        const auto det = e1.X * px + e1.Y * py + e1.Z * pz;
+        auto valid = Abs(det) >= F::Broadcast(DETERMINANT_EPSILON);
+
+        const auto inv_det = one / det;
+        const auto sx = origin.X - p0.X;
+        const auto sy = origin.Y - p0.Y;
+        const auto sz = origin.Z - p0.Z;
+        u = inv_det * (sx * px + sy * py + sz * pz);
+        valid = valid & (u >= zero) & (u <= one);
+
+        const auto qx = sy * e1.Z - sz * e1.Y;
+        const auto qy = sz * e1.X - sx * e1.Z;
+        const auto qz = sx * e1.Y - sy * e1.X;
+        v = inv_det * (direction.X * qx + direction.Y * qy + direction.Z * qz);
+        valid = valid & (v >= zero) & (u + v <= one);
+
+        t = inv_det * (e2.X * qx + e2.Y * qy + e2.Z * qz);
+        return valid & (t > t_min) & (t < t_max);
+    }
+
+    inline void to_object(const CpuBvh::Instance &instance, const CpuRay &ray, float (&origin)[3], float (&direction)[3])
+    {
+        const auto &m = instance.ToObject;
+        for (int r = 0; r < 3; ++r)
+        {
+            origin[r] = m[r][0] * ray.Origin.x + m[r][1] * ray.Origin.y + m[r][2] * ray.Origin.z + m[r][3];
+            direction[r] = m[r][0] * ray.Direction.x + m[r][1] * ray.Direction.y + m[r][2] * ray.Direction.z;
+        }
+    }
+
+    inline unsigned valid_children(const CpuBvh::Node &node)
+    {
+        unsigned bits = 0;
+        for (unsigned i = 0; i < CpuBvh::NODE_WIDTH; ++i)
+            if (node.Child[i] != CpuBvh::EMPTY)
+                bits |= 1u << i;
+        return bits;
+    }
+
+    struct StackEntry
+    {
+        std::uint32_t Index;
+        std::uint32_t Count;
+        float Near;
+    };
+
+    // pushes the children in the mask farthest first, so the nearest one is popped next
+    inline void push_children(
+        const CpuBvh::Node &node,
+        unsigned bits,
+        const float (&near)[CpuBvh::NODE_WIDTH],
+        StackEntry *stack,
+        unsigned &size)
+    {
+        StackEntry children[CpuBvh::NODE_WIDTH];
+        unsigned count = 0;
+        for (; bits; bits &= bits - 1)
+        {
+            const auto i = static_cast<unsigned>(__builtin_ctz(bits));
+            children[count++] = {node.Child[i], node.Count[i], near[i]};
+        }
+
+        // at most four, insertion sort by falling distance
+        for (unsigned i = 1; i < count; ++i)
+        {
+            const auto child = children[i];
+            auto j = i;
+            for (; j && children[j - 1].Near < child.Near; --j)
+                children[j] = children[j - 1];
+            children[j] = child;
+        }
+
+        for (unsigned i = 0; i < count && size < STACK_SIZE; ++i)
+            stack[size++] = children[i];
+    }
+
+    // one ray against four boxes per node and TRIANGLE_WIDTH / F::WIDTH instructions per triangle block
+    template<typename F>
+    void intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit)
+    {
+        const auto nodes = bvh.Nodes;
+        const auto blocks = bvh.Blocks;
+        const auto instances = bvh.Instances;
+
+        auto t_max = ray.TMax;
+        for (std::uint32_t model = 0; model < bvh.InstanceCount; ++model)
+        {
+            float o[3], d[3];
+            to_object(instances[model], ray, o, d);
+
+            const Lanes3<Float4> origin4{Float4::Broadcast(o[0]), Float4::Broadcast(o[1]), Float4::Broadcast(o[2])};
+            const Lanes3<Float4> inverse4{
+                Float4::Broadcast(1.f / d[0]),
+                Float4::Broadcast(1.f / d[1]),
+                Float4::Broadcast(1.f / d[2]),
+            };
+            const Lanes3<F> origin{F::Broadcast(o[0]), F::Broadcast(o[1]), F::Broadcast(o[2])};
+            const Lanes3<F> direction{F::Broadcast(d[0]), F::Broadcast(d[1]), F::Broadcast(d[2])};
+            const auto t_min4 = Float4::Broadcast(ray.TMin);
+            const auto t_min = F::Broadcast(ray.TMin);
+
+            StackEntry stack[STACK_SIZE];
+            unsigned size = 0;
+            stack[size++] = {instances[model].Root, 0, ray.TMin};
+
+            while (size)
+            {
+                const auto entry = stack[--size];
+                if (entry.Near > t_max)
+                    continue;
+
+                if (!entry.Count)
+                {
+                    const auto &node = nodes[entry.Index];
+                    Float4 near;
+                    const auto bits = box_test(
+                                          {Float4::Load(node.MinX), Float4::Load(node.MinY), Float4::Load(node.MinZ)},
+                                          {Float4::Load(node.MaxX), Float4::Load(node.MaxY), Float4::Load(node.MaxZ)},
+                                          origin4,
+                                          inverse4,
+                                          t_min4,
+                                          Float4::Broadcast(t_max),
+                                          near).Bits() & valid_children(node);
+                    if (!bits)
+                        continue;
+
+                    alignas(16) float nears[CpuBvh::NODE_WIDTH];
+                    near.Store(nears);
+                    push_children(node, bits, nears, stack, size);
+                    continue;
+                }
+
+                for (auto b = entry.Index; b < entry.Index + entry.Count; ++b)
+                {
+                    const auto &block = blocks[b];
+                    for (unsigned lane = 0; lane < CpuBvh::TRIANGLE_WIDTH; lane += F::WIDTH)
+                    {
+                        F t, u, v;
+                        auto bits = triangle_test(
+                            origin,
+                            direction,
+                            {F::Load(block.P0X + lane), F::Load(block.P0Y + lane), F::Load(block.P0Z + lane)},
+                            {F::Load(block.E1X + lane), F::Load(block.E1Y + lane), F::Load(block.E1Z + lane)},
+                            {F::Load(block.E2X + lane), F::Load(block.E2Y + lane), F::Load(block.E2Z + lane)},
+                            t_min,
+                            F::Broadcast(t_max),
+                            t,
+                            u,
+                            v).Bits();
+                        if (!bits)
+                            continue;
+
+                        alignas(64) float ts[F::WIDTH], us[F::WIDTH], vs[F::WIDTH];
+                        t.Store(ts);
+                        u.Store(us);
+                        v.Store(vs);
+                        for (; bits; bits &= bits - 1)
+                        {
+                            const auto i = static_cast<unsigned>(__builtin_ctz(bits));
+                            if (ts[i] >= t_max)
+                                continue;
+
+                            t_max = ts[i];
+                            hit = {ts[i], block.Index[lane + i], model, us[i], vs[i]};
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // F::WIDTH rays against one box or triangle per instruction, a node is entered when any ray of the packet
+    // reaches it; lanes past count never hit anything
+    template<typename F>
+    void intersect_packet(const CpuBvh::View &bvh, const CpuRay *rays, CpuHit *hits, const unsigned count)
+    {
+        constexpr auto W = F::WIDTH;
+        const auto nodes = bvh.Nodes;
+        const auto blocks = bvh.Blocks;
+        const auto instances = bvh.Instances;
+
+        alignas(64) float t_min_lanes[W], t_max_lanes[W];
+        for (unsigned i = 0; i < W; ++i)
+        {
+            t_min_lanes[i] = i < count ? rays[i].TMin : 1.f;
+            t_max_lanes[i] = i < count ? rays[i].TMax : -1.f;
+        }
+        const auto t_min = F::Load(t_min_lanes);
+        auto t_max = F::Load(t_max_lanes);
+        auto hit_u = F::Broadcast(0.f);
+        auto hit_v = F::Broadcast(0.f);
+        std::uint32_t triangles[W], models[W];
+        for (unsigned i = 0; i < W; ++i)
+            triangles[i] = models[i] = CpuBvh::EMPTY;
+
+        for (std::uint32_t model = 0; model < bvh.InstanceCount; ++model)
+        {
+            alignas(64) float lanes[9][W]{};
+            for (unsigned i = 0; i < count; ++i)
+            {
+                float o[3], d[3];
+                to_object(instances[model], rays[i], o, d);
+                for (int a = 0; a < 3; ++a)
+                {
+                    lanes[a][i] = o[a];
+                    lanes[3 + a][i] = d[a];
+                    lanes[6 + a][i] = 1.f / d[a];
+                }
+            }
+            const Lanes3<F> origin{F::Load(lanes[0]), F::Load(lanes[1]), F::Load(lanes[2])};
+            const Lanes3<F> direction{F::Load(lanes[3]), F::Load(lanes[4]), F::Load(lanes[5])};
+            const Lanes3<F> inverse{F::Load(lanes[6]), F::Load(lanes[7]), F::Load(lanes[8])};
+
+            StackEntry stack[STACK_SIZE];
+            unsigned size = 0;
+            stack[size++] = {instances[model].Root, 0, 0.f};
+
+            while (size)
+            {
+                const auto entry = stack[--size];
+
+                if (!entry.Count)
+                {
+                    const auto &node = nodes[entry.Index];
+                    unsigned bits = 0;
+                    float nears[CpuBvh::NODE_WIDTH]{};
+                    for (unsigned c = 0; c < CpuBvh::NODE_WIDTH; ++c)
+                    {
+                        if (node.Child[c] == CpuBvh::EMPTY)
+                            continue;
+
+                        F near;
+                        const auto mask = box_test(
+                            {F::Broadcast(node.MinX[c]), F::Broadcast(node.MinY[c]), F::Broadcast(node.MinZ[c])},
+                            {F::Broadcast(node.MaxX[c]), F::Broadcast(node.MaxY[c]), F::Broadcast(node.MaxZ[c])},
+                            origin,
+                            inverse,
+                            t_min,
+                            t_max,
+                            near).Bits();
+                        if (!mask)
+                            continue;
+
+                        // ordered by the nearest entry of any ray that reaches the child
+                        alignas(64) float near_lanes[W];
+                        near.Store(near_lanes);
+                        nears[c] = near_lanes[__builtin_ctz(mask)];
+                        for (auto m = mask; m; m &= m - 1)
+                            if (near_lanes[__builtin_ctz(m)] < nears[c])
+                                nears[c] = near_lanes[__builtin_ctz(m)];
+                        bits |= 1u << c;
+                    }
+                    push_children(node, bits, nears, stack, size);
+                    continue;
+                }
+
+                for (auto b = entry.Index; b < entry.Index + entry.Count; ++b)
+                {
+                    const auto &block = blocks[b];
+                    for (unsigned lane = 0; lane < CpuBvh::TRIANGLE_WIDTH && block.Index[lane] != CpuBvh::EMPTY; ++lane)
+                    {
+                        F t, u, v;
+                        const auto mask = triangle_test(
+                            origin,
+                            direction,
+                            {F::Broadcast(block.P0X[lane]), F::Broadcast(block.P0Y[lane]), F::Broadcast(block.P0Z[lane])},
+                            {F::Broadcast(block.E1X[lane]), F::Broadcast(block.E1Y[lane]), F::Broadcast(block.E1Z[lane])},
+                            {F::Broadcast(block.E2X[lane]), F::Broadcast(block.E2Y[lane]), F::Broadcast(block.E2Z[lane])},
+                            t_min,
+                            t_max,
+                            t,
+                            u,
+                            v);
+                        const auto bits = mask.Bits();
+                        if (!bits)
+                            continue;
+
+                        t_max = Select(mask, t, t_max);
+                        hit_u = Select(mask, u, hit_u);
+                        hit_v = Select(mask, v, hit_v);
+                        for (auto m = bits; m; m &= m - 1)
+                        {
+                            const auto i = __builtin_ctz(m);
+                            triangles[i] = block.Index[lane];
+                            models[i] = model;
+                        }
+                    }
+                }
+            }
+        }
+
+        alignas(64) float ts[W], us[W], vs[W];
+        t_max.Store(ts);
+        hit_u.Store(us);
+        hit_v.Store(vs);
+        for (unsigned i = 0; i < count; ++i)
+            if (triangles[i] != CpuBvh::EMPTY)
+                hits[i] = {ts[i], triangles[i], models[i], us[i], vs[i]};
+    }
+}
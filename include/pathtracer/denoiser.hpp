@@ -0,0 +1,55 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <vector>
+#include <pathtracer/thread_pool.hpp>
+
+namespace pathtracer
+{
+    struct DenoiseSettings
+    {
+        int Passes = 5;
+        float ColorPhi = 1.f;
+        float NormalPhi = .1f;
+        float DepthPhi = .1f;
+    };
+
+    struct DenoiseImage
+    {
+        int Width = 0;
+        int Height = 0;
+
+        // rgba rows as read back from the accumulation, albedo and normal/depth textures, all of them sums
+        std::vector<float> Accumulation;
+        std::vector<float> Albedo;
+        std::vector<float> NormalDepth;
+
+        // rgba, written by the denoiser
+        std::vector<float> Result;
+    };
+
+    // cpu counterpart of shaders/compute/atrous.glsl for images that never reach the screen: the inputs are split
+    // into planes so every tap is a contiguous load, rows are spread over the pool and go through sse four at a time
+    class Denoiser
+    {
+    public:
+        explicit Denoiser(ThreadPool &pool);
+        ~Denoiser();
+
+        Denoiser(const Denoiser &) = delete;
+        Denoiser &operator=(const Denoiser &) = delete;
+
+        void Start(std::shared_ptr<DenoiseImage> image, const DenoiseSettings &settings);
+        bool Poll(std::shared_ptr<DenoiseImage> &image);
+
+        [[nodiscard]] bool IsBusy() const;
+
+        // blocks until the result is written, the calling thread works along with the pool
+        static void Run(ThreadPool &pool, DenoiseImage &image, const DenoiseSettings &settings);
+
+    private:
+        ThreadPool &m_Pool;
+        std::future<std::shared_ptr<DenoiseImage> > m_Job;
+    };
+}
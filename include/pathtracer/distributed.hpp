@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <variant>
+#include <vector>
+#include <pathtracer/image_export.hpp>
+#include <pathtracer/options.hpp>
+
+namespace pathtracer
+{
+    // a tile of the image and a range of its sample indices; ranges continue the stratification and seeding of
+    // the shader where the previous one stopped, so merged ranges sample the pixel like one long render would
+    struct RenderJob
+    {
+        std::uint32_t Id = 0;
+        std::int32_t X = 0;
+        std::int32_t Y = 0;
+        std::int32_t Width = 0;
+        std::int32_t Height = 0;
+        std::uint32_t FirstSample = 0;
+        std::uint32_t Samples = 0;
+        std::uint32_t ImageWidth = 0;
+        std::uint32_t ImageHeight = 0;
+        std::string Scene;
+    };
+
+    // rgba sums of the tile rows, alpha counts the samples of this job alone
+    struct RenderResult
+    {
+        std::uint32_t Id = 0;
+        std::vector<float> Pixels;
+    };
+
+    struct RenderDone
+    {
+    };
+
+    using Message = std::variant<RenderDone, RenderJob, RenderResult>;
+
+    // blocking length-prefixed messages over tcp
+    class Connection
+    {
+    public:
+        explicit Connection(int socket);
+        ~Connection();
+
+        Connection(const Connection &) = delete;
+        Connection &operator=(const Connection &) = delete;
+
+        Connection(Connection &&other) noexcept;
+        Connection &operator=(Connection &&other) noexcept;
+
+        // host:port
+        static Connection Connect(const std::string &address);
+
+        // jobs carry a few numbers and the scene path
+        static constexpr std::uint64_t MAX_JOB_SIZE = 64 * 1024;
+
+        void Send(const Message &message) const;
+
+        // false once the peer is gone, throws on a malformed message or one with a payload larger than limit
+        bool Receive(Message &message, std::uint64_t limit) const;
+
+        [[nodiscard]] int Handle() const;
+
+    private:
+        int m_Socket = -1;
+    };
+
+    // hands out jobs to every worker that connects, merges their results and writes the image; a job that is still
+    // out while others have finished is issued once more to an idle worker, whichever copy returns first counts
+    class Coordinator
+    {
+    public:
+        explicit Coordinator(const Options &options);
+        ~Coordinator();
+
+        Coordinator(const Coordinator &) = delete;
+        Coordinator &operator=(const Coordinator &) = delete;
+
+        void Run();
+
+    private:
+        struct Work
+        {
+            RenderJob Job;
+            bool Done = false;
+            unsigned Issued = 0;
+            std::chrono::steady_clock::time_point Sent;
+        };
+
+        struct Worker
+        {
+            Connection Link;
+            int Current = -1;
+
+            // when Current went out to this worker, a reissue to another one must not restart its clock
+            std::chrono::steady_clock::time_point Sent;
+        };
+
+        static constexpr unsigned MAX_ISSUES = 2;
+
+        // a message that starts has to arrive within this, so one stalled worker cannot block the others
+        static constexpr std::chrono::seconds RECEIVE_TIMEOUT{10};
+
+        // a worker holding its job this many times longer than jobs take on average, and at least the minimum that
+        // leaves room for loading the scene, is given up and its job handed out again
+        static constexpr unsigned DEADLINE_JOBS = 10;
+        static constexpr std::chrono::minutes MIN_DEADLINE{5};
+
+        [[nodiscard]] int NextWork() const;
+        void Merge(const RenderResult &result, std::chrono::steady_clock::time_point sent);
+
+        Options m_Options;
+        int m_Listener = -1;
+        std::vector<Work> m_Work;
+        std::vector<Worker> m_Workers;
+        ExportRequest m_Output;
+        std::vector<float> m_Image;
+        size_t m_Finished = 0;
+        std::chrono::steady_clock::duration m_WorkTime{};
+    };
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <GL/glew.h>
+#include <pathtracer/thread_pool.hpp>
+
+namespace pathtracer
+{
+    struct EnvironmentData
+    {
+        int Width = 0;
+        int Height = 0;
+        std::vector<float> Pixels;
+        std::vector<float> Conditional;
+        std::vector<float> RowSums;
+        std::vector<float> Marginal;
+        float Integral = 0.f;
+    };
+
+    // hdr sky with a marginal/conditional cdf over luminance * sin(theta) for importance sampling
+    class EnvironmentMap
+    {
+    public:
+        explicit EnvironmentMap(ThreadPool &pool);
+        ~EnvironmentMap();
+
+        EnvironmentMap(const EnvironmentMap &) = delete;
+        EnvironmentMap &operator=(const EnvironmentMap &) = delete;
+
+        // throws when the header of the file cannot be read, the pixels are only decoded by Load
+        static void Check(const std::filesystem::path &path);
+
+        void Load(const std::filesystem::path &path);
+        void Unload();
+
+        bool Poll();
+
+        void Bind(GLuint unit) const;
+
+        [[nodiscard]] bool IsLoaded() const;
+        [[nodiscard]] bool IsLoading() const;
+        [[nodiscard]] float GetIntegral() const;
+
+    private:
+        void Upload(const EnvironmentData &data);
+
+        ThreadPool &m_Pool;
+
+        // decoding and then building the distribution, the data is only read once that is done
+        ThreadPool::Task m_Distribution;
+        std::shared_ptr<EnvironmentData> m_Data;
+
+        GLuint m_Textures[3]{};
+        bool m_Loaded = false;
+        float m_Integral = 0.f;
+    };
+}
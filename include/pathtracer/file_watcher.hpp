@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+namespace pathtracer
+{
+    // reports files that were written, created, moved in or deleted in the watched directories
+    class FileWatcher
+    {
+    public:
+        FileWatcher();
+        ~FileWatcher();
+
+        FileWatcher(const FileWatcher &) = delete;
+        FileWatcher &operator=(const FileWatcher &) = delete;
+
+        void Watch(const std::filesystem::path &directory);
+        void Clear();
+
+        std::vector<std::filesystem::path> Poll();
+
+    private:
+#ifdef __linux__
+        int m_Descriptor = -1;
+        std::unordered_map<int, std::filesystem::path> m_Watches;
+#else
+        std::vector<std::filesystem::path> m_Directories;
+        std::unordered_map<std::string, std::filesystem::file_time_type> m_Times;
+        std::chrono::steady_clock::time_point m_LastPoll;
+#endif
+    };
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <GL/glew.h>
+#include <pathtracer/readback.hpp>
+#include <pathtracer/thread_pool.hpp>
+
+namespace pathtracer
+{
+    // same order and curves as shaders/display/tonemap.glsl
+    enum class Tonemap
+    {
+        None,
+        Reinhard,
+        Aces,
+        Filmic,
+    };
+
+    enum class ExportFormat
+    {
+        ExrHalf,
+        ExrFloat,
+        Pfm,
+        Png,
+    };
+
+    struct ExportRequest
+    {
+        // without extension, the format adds its own
+        std::filesystem::path Path;
+        ExportFormat Format = ExportFormat::ExrHalf;
+
+        // only applied to png, the float formats keep the mean radiance as is
+        float Exposure = 1.f;
+        pathtracer::Tonemap Tonemap = pathtracer::Tonemap::Aces;
+    };
+
+    // reads an rgba float image (sums with the sample count in alpha) back through one of two readbacks, the pool
+    // encodes from the mapping once the gpu is done so no frame ever waits
+    class ImageExporter
+    {
+    public:
+        static constexpr unsigned READBACK_COUNT = 2;
+
+        explicit ImageExporter(ThreadPool &pool);
+        ~ImageExporter();
+
+        ImageExporter(const ImageExporter &) = delete;
+        ImageExporter &operator=(const ImageExporter &) = delete;
+
+        // false while both buffers are copying or encoding
+        bool Capture(GLuint texture, int width, int height, ExportRequest request);
+
+        // true once per finished file, the message is its path or what went wrong
+        bool Poll(std::string &message);
+
+        [[nodiscard]] bool IsBusy() const;
+
+        // encodes and writes on the calling thread, returns the path or what went wrong
+        static std::string Write(const float *pixels, int width, int height, const ExportRequest &request);
+
+        static const char *Extension(ExportFormat format);
+
+        // float exrs for file names given on the command line, the half format is only picked in the ui
+        static ExportFormat FormatOf(const std::filesystem::path &path);
+
+    private:
+        std::unique_ptr<TextureReadback> m_Readbacks[READBACK_COUNT];
+    };
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace pathtracer
+{
+    struct Options
+    {
+        // interactive: where checkpoints go, and whether to continue the one found there
+        std::filesystem::path CheckpointPath;
+        bool Resume = false;
+
+        // distributed: the coordinator splits the image into tiles and the samples into ranges, every worker
+        // connects to it and renders whatever it is handed until the image is complete
+        bool Coordinator = false;
+        std::string Worker;
+        std::uint16_t Port = 7878;
+        std::filesystem::path Scene;
+        int Width = 800;
+        int Height = 600;
+        unsigned Samples = 1024;
+        int Tile = 128;
+        unsigned Chunk = 256;
+        std::filesystem::path Output;
+
+        // host kernels: rays per second of every instruction set against the scalar port, on the scene at size
+        bool Benchmark = false;
+
+        // batch: renders every frame of the animation of a scene file into numbered images next to the output
+        std::filesystem::path Sequence;
+
+        static Options Parse(const std::vector<std::string> &arguments);
+    };
+}
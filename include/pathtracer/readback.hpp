@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <span>
+#include <string>
+#include <GL/glew.h>
+#include <pathtracer/thread_pool.hpp>
+
+namespace pathtracer
+{
+    // copies rgba float textures back to back into a persistently mapped pixel pack buffer behind a fence, and once
+    // the gpu is done the pool runs a job that reads straight from the mapping, so no frame waits for the copy
+    class TextureReadback
+    {
+    public:
+        using Job = std::function<std::string(const float *pixels)>;
+
+        explicit TextureReadback(ThreadPool &pool);
+        ~TextureReadback();
+
+        TextureReadback(const TextureReadback &) = delete;
+        TextureReadback &operator=(const TextureReadback &) = delete;
+
+        // false while the previous copy or job is in flight; every texture takes texture_size bytes
+        bool Start(std::span<const GLuint> textures, size_t texture_size, Job job);
+
+        // true once per finished job, with what it returned
+        bool Poll(std::string &result);
+
+        [[nodiscard]] bool IsBusy() const;
+
+    private:
+        ThreadPool &m_Pool;
+
+        GLuint m_Buffer = 0;
+        size_t m_Size = 0;
+        const float *m_Mapped = nullptr;
+        GLsync m_Fence = nullptr;
+
+        Job m_Job;
+        std::future<std::string> m_Result;
+    };
+}
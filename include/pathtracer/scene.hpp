@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <vector>
 #include <glm/glm.hpp>
 #include <pathtracer/buffer.hpp>
+#include <pathtracer/scene_file.hpp>
+#include <pathtracer/texture_cache.hpp>
+#include <pathtracer/thread_pool.hpp>
 
 namespace pathtracer
 {
@@ -50,35 +54,97 @@ namespace pathtracer
     struct Model
     {
         alignas(4) unsigned Root;
+        alignas(4) int Material;
         alignas(16) glm::mat4 Transform;
         alignas(16) glm::mat4 InverseTransform;
         alignas(16) glm::mat3 NormalTransform;
     };
 
+    // times are summed over the meshes, the builds of different meshes overlap on the pool; references exceed the
+    // triangles by what spatial splits duplicated, the layout covers ordering the nodes and sorting the triangles
+    struct BuildStats
+    {
+        size_t Triangles = 0;
+        size_t References = 0;
+        size_t Nodes = 0;
+        size_t ScratchBytes = 0;
+        double AllocationMilliseconds = 0.;
+        double BuildMilliseconds = 0.;
+        double LayoutMilliseconds = 0.;
+        double PeakResidentBytes = 0.;
+    };
+
     class Scene
     {
     public:
-        Scene();
+        Scene(ThreadPool &pool, const std::filesystem::path &texture_cache, size_t texture_budget);
 
         void LoadModel(const std::filesystem::path &path, unsigned int flags);
 
-        size_t GenerateBVHTree(unsigned start, unsigned end, unsigned depth);
+        // imports every mesh of the file on the pool at once, then adds one model per instance sharing its tree
+        void Load(const SceneFile &file);
+
+        void Upload();
 
-        void Upload() const;
+        // moves a model without touching triangles or trees, UploadModels makes it visible to the shader
+        void SetTransform(size_t i, const glm::mat4 &transform);
+        void UploadModels();
+
+        bool Poll();
+
+        [[nodiscard]] const TextureCache &GetTextures() const;
 
         Model &GetModel(size_t i);
 
         Model &GetLastModel();
 
+        [[nodiscard]] const std::vector<std::filesystem::path> &GetSources() const;
+
+        [[nodiscard]] const std::vector<Triangle> &GetTriangles() const;
+        [[nodiscard]] const std::vector<BVHNode> &GetNodes() const;
+        [[nodiscard]] const std::vector<std::uint32_t> &GetTriangleIndices() const;
+        [[nodiscard]] const std::vector<Model> &GetModels() const;
+        [[nodiscard]] const BuildStats &GetBuildStats() const;
+
     private:
+        // node, index and triangle indices are local to the mesh
+        struct ImportedMesh
+        {
+            std::vector<Triangle> Triangles;
+            std::vector<SceneMaterial> Materials;
+            std::vector<BVHNode> Nodes;
+            std::vector<std::uint32_t> Indices;
+            BuildStats Stats;
+        };
+
+        static ImportedMesh Import(
+            ThreadPool &pool,
+            const std::filesystem::path &path,
+            unsigned int flags,
+            const SceneBvh &bvh);
+
+        unsigned AddMesh(const std::filesystem::path &path, ImportedMesh &mesh);
+
+        int AddMaterial(const SceneMaterial &material);
+
+        ThreadPool &m_Pool;
+
         std::vector<Triangle> m_Triangles;
         std::vector<Material> m_Materials;
         std::vector<Model> m_Models;
         std::vector<BVHNode> m_BVHNodes;
 
+        // leaves range over these, a triangle split by a spatial split is referenced from more than one leaf
+        std::vector<std::uint32_t> m_TriangleIndices;
+        std::vector<std::filesystem::path> m_Sources;
+        BuildStats m_BuildStats;
+
         Buffer m_TriangleBuffer;
         Buffer m_MaterialBuffer;
         Buffer m_ModelBuffer;
         Buffer m_BVHNodeBuffer;
+        Buffer m_TriangleIndexBuffer;
+
+        TextureCache m_Textures;
     };
 }
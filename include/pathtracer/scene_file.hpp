@@ -0,0 +1,138 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <pathtracer/shader.hpp>
+
+namespace pathtracer
+{
+    struct SceneMaterial
+    {
+        glm::vec3 Diffuse{.8f};
+        std::filesystem::path DiffuseTexture;
+        glm::vec3 Emission{0.f};
+        std::filesystem::path EmissionTexture;
+        float Roughness = .9f;
+        float Metalness = .1f;
+        float Transparency = 0.f;
+        float IR = 1.5f;
+    };
+
+    enum class BvhSplit
+    {
+        Median,
+        Spatial,
+    };
+
+    enum class BvhLayout
+    {
+        Build,
+        DepthFirst,
+    };
+
+    // duplication caps the references spatial splits may add, as a fraction of the triangles of the mesh; the
+    // layout decides whether the nodes stay in the order the split built them
+    struct SceneBvh
+    {
+        BvhSplit Split = BvhSplit::Median;
+        float Duplication = .3f;
+        BvhLayout Layout = BvhLayout::DepthFirst;
+    };
+
+    struct SceneMesh
+    {
+        std::filesystem::path Path;
+        unsigned Flags = 0;
+        SceneBvh Bvh;
+    };
+
+    struct SceneInstance
+    {
+        unsigned Mesh = 0;
+        glm::mat4 Transform{1.f};
+
+        // index into the materials of the file, replaces every material of the mesh when set
+        int Material = -1;
+    };
+
+    struct SceneCamera
+    {
+        glm::vec3 Position{0.f};
+        float Yaw = -90.f;
+        float Pitch = 0.f;
+        float Fov = 40.f;
+    };
+
+    // translate, rotate and scale kept apart so keyframes can be blended before they become a matrix
+    struct SceneTransform
+    {
+        glm::vec3 Translate{0.f};
+        glm::quat Rotate{1.f, 0.f, 0.f, 0.f};
+        glm::vec3 Scale{1.f};
+
+        [[nodiscard]] glm::mat4 Matrix() const;
+    };
+
+    struct CameraKey
+    {
+        float Frame = 0.f;
+        SceneCamera Camera;
+    };
+
+    struct TransformKey
+    {
+        float Frame = 0.f;
+        SceneTransform Transform;
+    };
+
+    struct InstanceTrack
+    {
+        unsigned Instance = 0;
+        std::vector<TransformKey> Keys;
+    };
+
+    // keys are sorted by frame and interpolated linearly, rotations along the shortest arc; before the first and
+    // after the last key a track holds its value
+    struct SceneAnimation
+    {
+        unsigned Frames = 1;
+
+        // a frame is done after this many samples, or earlier once the error threshold is met everywhere
+        unsigned Samples = 256;
+        std::optional<float> ErrorThreshold;
+
+        std::vector<CameraKey> Camera;
+        std::vector<InstanceTrack> Instances;
+
+        [[nodiscard]] SceneCamera CameraAt(float frame) const;
+        [[nodiscard]] static glm::mat4 TransformAt(const InstanceTrack &track, float frame);
+    };
+
+    struct SceneRender
+    {
+        std::optional<float> Exposure;
+        std::optional<std::string> Tonemap;
+        std::optional<float> ErrorThreshold;
+        std::optional<std::filesystem::path> Environment;
+        std::optional<float> EnvironmentRotation;
+        ShaderDefines Permutations;
+    };
+
+    // declarative scene description, every path is resolved against the directory of the file; meshes are unique
+    // per path and import flags, any number of instances may reference the same one
+    struct SceneFile
+    {
+        std::vector<SceneMesh> Meshes;
+        std::vector<SceneMaterial> Materials;
+        std::vector<SceneInstance> Instances;
+        std::optional<SceneCamera> Camera;
+        SceneRender Render;
+        std::optional<SceneAnimation> Animation;
+
+        static SceneFile Load(const std::filesystem::path &path);
+    };
+}
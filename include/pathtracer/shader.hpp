@@ -2,16 +2,76 @@
 
 #include <filesystem>
 #include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <GL/glew.h>
 
 namespace pathtracer
 {
     typedef std::function<void(GLint loc)> UniformConsumer;
 
+    // permutation key to value, keys missing here take the first value listed in the yaml
+    typedef std::map<std::string, std::string> ShaderDefines;
+
+    struct ShaderPermutation
+    {
+        std::string Name;
+        std::vector<std::string> Values;
+    };
+
+    // one compiled stage file, shared between programs so hot reloads and variants only recompile what changed
+    class ShaderUnit
+    {
+    public:
+        ShaderUnit(
+            std::filesystem::path path,
+            GLenum type,
+            std::string source,
+            std::vector<std::filesystem::path> files);
+
+        ~ShaderUnit();
+
+        ShaderUnit(const ShaderUnit &) = delete;
+        ShaderUnit &operator=(const ShaderUnit &) = delete;
+
+        void Compile();
+
+        [[nodiscard]] bool Matches(
+            GLenum type,
+            const std::string &source,
+            const std::vector<std::filesystem::path> &files) const;
+
+        [[nodiscard]] const std::filesystem::path &GetPath() const;
+
+        [[nodiscard]] GLenum GetType() const;
+
+        [[nodiscard]] const std::string &GetSource() const;
+
+        [[nodiscard]] const std::vector<std::filesystem::path> &GetFiles() const;
+
+        [[nodiscard]] GLuint Handle() const;
+
+    private:
+        std::filesystem::path m_Path;
+        GLenum m_Type;
+        std::string m_Source;
+        std::vector<std::filesystem::path> m_Files;
+        GLuint m_Handle = 0;
+    };
+
     class Shader
     {
     public:
-        explicit Shader(const std::filesystem::path &path);
+        explicit Shader(
+            const std::filesystem::path &path,
+            const std::filesystem::path &cache = {},
+            const ShaderDefines &defines = {},
+            const std::vector<std::shared_ptr<ShaderUnit> > &reuse = {});
+
+        static std::vector<ShaderPermutation> LoadPermutations(const std::filesystem::path &path);
 
         ~Shader();
 
@@ -21,7 +81,24 @@ namespace pathtracer
 
         void SetUniform(const std::string &name, const UniformConsumer &consumer) const;
 
+        [[nodiscard]] const std::vector<std::filesystem::path> &GetDependencies() const;
+
+        // stages given as directories, a stage file added below one of them joins the program on the next build
+        [[nodiscard]] const std::vector<std::filesystem::path> &GetStageDirectories() const;
+
+        [[nodiscard]] const ShaderDefines &GetDefines() const;
+
+        [[nodiscard]] const std::vector<std::shared_ptr<ShaderUnit> > &GetUnits() const;
+
+        [[nodiscard]] bool IsSpirv() const;
+
     private:
         GLuint m_Handle = 0;
+        std::vector<std::filesystem::path> m_Dependencies;
+        std::vector<std::filesystem::path> m_StageDirectories;
+        ShaderDefines m_Defines;
+        std::vector<std::shared_ptr<ShaderUnit> > m_Units;
+        bool m_Spirv = false;
+        std::unordered_map<std::string, GLint> m_Locations;
     };
 }
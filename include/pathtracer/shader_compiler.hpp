@@ -0,0 +1,67 @@
+#pragma once
+
+#define GLFW_INCLUDE_NONE
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <GLFW/glfw3.h>
+#include <pathtracer/shader.hpp>
+
+namespace pathtracer
+{
+    struct ShaderRequest
+    {
+        std::filesystem::path Path;
+        std::filesystem::path Cache;
+        ShaderDefines Defines;
+
+        // compiled units from a previous program, only stage files whose expansion changed get recompiled
+        std::vector<std::shared_ptr<ShaderUnit> > Reuse;
+    };
+
+    struct ShaderResult
+    {
+        std::filesystem::path Path;
+        ShaderDefines Defines;
+        std::unique_ptr<Shader> Program;
+        std::string Error;
+    };
+
+    // compiles programs on a worker thread with its own hidden context sharing objects with the main one
+    class ShaderCompiler
+    {
+    public:
+        explicit ShaderCompiler(GLFWwindow *share);
+        ~ShaderCompiler();
+
+        ShaderCompiler(const ShaderCompiler &) = delete;
+        ShaderCompiler &operator=(const ShaderCompiler &) = delete;
+
+        // replaces a request for the same file that has not started yet, requests for other files queue up
+        void Submit(ShaderRequest request);
+
+        // one finished request per call, in the order they finished
+        bool Poll(ShaderResult &result);
+
+        [[nodiscard]] bool IsBusy() const;
+
+    private:
+        void Run();
+
+        GLFWwindow *m_Context = nullptr;
+        std::thread m_Thread;
+
+        mutable std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        std::deque<ShaderRequest> m_Requests;
+        std::deque<ShaderResult> m_Results;
+        bool m_Busy = false;
+        bool m_Stop = false;
+    };
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+namespace pathtracer
+{
+    // entries of the traversal stack in models_hit; the preprocessor defines it ahead of every shader unit and the
+    // bvh builder keeps its trees shallow enough for it
+    static constexpr unsigned BVH_STACK_SIZE = 32;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <filesystem>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pathtracer
+{
+    struct PreprocessedSource
+    {
+        std::string Source;
+
+        // indexed by the source string number of the emitted #line directives, the unit itself comes first
+        std::vector<std::filesystem::path> Files;
+    };
+
+    // expands #include once per translation unit, ignoring directives inside comments, and emits #line
+    // directives so compiler messages can be mapped back to the original files
+    class ShaderPreprocessor
+    {
+    public:
+        // defines follow #version in every unit, after the limits of shader_limits.hpp
+        explicit ShaderPreprocessor(std::string defines = {});
+
+        PreprocessedSource Process(const std::filesystem::path &path);
+
+        // concatenates several files into one unit, every file following the includes it depends on
+        PreprocessedSource Process(const std::vector<std::filesystem::path> &paths);
+
+        // every .glsl file below path in a stable order, a single file is returned as is
+        static void Collect(const std::filesystem::path &path, std::vector<std::filesystem::path> &files);
+
+        static std::string MapLog(const std::string &log, const std::vector<std::filesystem::path> &files);
+
+    private:
+        enum class SegmentType
+        {
+            Text,
+            Include,
+            Version,
+        };
+
+        struct Segment
+        {
+            SegmentType Type;
+            unsigned Line;
+            std::string Text;
+        };
+
+        struct ParsedFile
+        {
+            std::vector<Segment> Segments;
+        };
+
+        const ParsedFile &Parse(const std::filesystem::path &path);
+
+        void Expand(
+            const std::filesystem::path &path,
+            PreprocessedSource &result,
+            std::set<std::filesystem::path> &included,
+            bool &version);
+
+        std::string m_Defines;
+
+        // files are parsed once per preprocessor and shared by every unit that includes them
+        std::unordered_map<std::string, ParsedFile> m_Parsed;
+    };
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <GL/glew.h>
+#include <pathtracer/buffer.hpp>
+#include <pathtracer/thread_pool.hpp>
+
+namespace pathtracer
+{
+    struct TextureCacheHeader
+    {
+        char Magic[4];
+        std::uint32_t Version;
+        std::uint32_t Size;
+        std::uint32_t Levels;
+        std::uint64_t SourceTime;
+        std::uint64_t SourceSize;
+    };
+
+    // virtual textures: sources are pre-converted to bc1 tiles on disk, and only the tiles the shader asks for
+    // through the feedback buffer become resident in a fixed-size atlas, evicting the least recently used ones
+    class TextureCache
+    {
+    public:
+        static constexpr unsigned TILE_SIZE = 128;
+        static constexpr unsigned TILE_BORDER = 4;
+        static constexpr unsigned TILE_STRIDE = TILE_SIZE + 2 * TILE_BORDER;
+        static constexpr unsigned TILE_BYTES = (TILE_STRIDE / 4) * (TILE_STRIDE / 4) * 8;
+        static constexpr unsigned PAGE_TILES = 16;
+        static constexpr unsigned MAX_REQUESTS = 1024;
+        static constexpr unsigned MAX_SIZE = 16384;
+        static constexpr unsigned MAX_LOADS = 64;
+        static constexpr unsigned READBACK_COUNT = 3;
+        static constexpr std::uint32_t NOT_RESIDENT = 0xffffffffu;
+
+        TextureCache(ThreadPool &pool, std::filesystem::path directory, size_t budget);
+        ~TextureCache();
+
+        TextureCache(const TextureCache &) = delete;
+        TextureCache &operator=(const TextureCache &) = delete;
+
+        int Request(const std::filesystem::path &path);
+
+        void Upload();
+        bool Poll();
+
+        void Bind(GLuint unit) const;
+
+        [[nodiscard]] GLsizei Count() const;
+        [[nodiscard]] unsigned GetFrame() const;
+        [[nodiscard]] unsigned GetUsageOffset() const;
+        [[nodiscard]] size_t GetResidentBytes() const;
+        [[nodiscard]] size_t GetBudget() const;
+
+    private:
+        struct VirtualTexture
+        {
+            std::filesystem::path Source;
+            std::filesystem::path Cache;
+            unsigned Size = 0;
+            unsigned Levels = 0;
+            unsigned FirstEntry = 0;
+            unsigned EntryCount = 0;
+            std::future<bool> Conversion;
+            bool Ready = false;
+        };
+
+        // a tile that failed to load is not asked for again, the shader keeps sampling the coarser levels instead
+        struct Entry
+        {
+            unsigned Texture;
+            unsigned Slot = NOT_RESIDENT;
+            bool Loading = false;
+            bool Pinned = false;
+            bool Failed = false;
+        };
+
+        struct Load
+        {
+            unsigned Entry;
+            std::future<std::vector<unsigned char> > Data;
+        };
+
+        struct Readback
+        {
+            GLuint Handle = 0;
+            const std::uint32_t *Mapped = nullptr;
+            GLsync Fence = nullptr;
+        };
+
+        void StartLoad(unsigned entry);
+        unsigned AllocateSlot();
+        void SetPageTableEntry(unsigned entry, std::uint32_t slot) const;
+        void SetDescriptor(unsigned texture) const;
+        void ProcessFeedback(const std::uint32_t *data);
+
+        ThreadPool &m_Pool;
+        std::filesystem::path m_Directory;
+        size_t m_Budget;
+
+        std::vector<VirtualTexture> m_Textures;
+        std::unordered_map<std::string, int> m_Indices;
+
+        std::vector<Entry> m_Entries;
+        std::vector<Load> m_Loads;
+
+        unsigned m_SlotCount = 0;
+        std::vector<unsigned> m_SlotEntry;
+        std::vector<std::uint32_t> m_SlotUsage;
+        std::vector<unsigned> m_FreeSlots;
+
+        GLuint m_Atlas = 0;
+        Buffer m_PageTableBuffer;
+        Buffer m_FeedbackBuffer;
+        unsigned m_FlagWords = 0;
+
+        Readback m_Readbacks[READBACK_COUNT];
+        unsigned m_ReadbackIndex = 0;
+
+        unsigned m_Frame = 0;
+        bool m_Uploaded = false;
+    };
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pathtracer
+{
+    // work stealing: every worker owns a deque, it pushes and pops its newest task at the back while idle workers
+    // steal the oldest from the front of the others, tasks from threads outside the pool go to a shared queue;
+    // waiting through the pool runs other tasks meanwhile, so tasks can wait for tasks without starving it
+    class ThreadPool
+    {
+        struct State;
+
+    public:
+        // a scheduled task, later tasks can depend on it
+        class Task
+        {
+        public:
+            Task() = default;
+
+            [[nodiscard]] bool IsValid() const;
+            [[nodiscard]] bool IsDone() const;
+
+        private:
+            friend class ThreadPool;
+
+            explicit Task(std::shared_ptr<State> state);
+
+            std::shared_ptr<State> m_State;
+        };
+
+        explicit ThreadPool(unsigned count = std::thread::hardware_concurrency());
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        template<typename F>
+        auto Submit(F &&task) -> std::future<std::invoke_result_t<F> >
+        {
+            using R = std::invoke_result_t<F>;
+
+            auto packaged = std::make_shared<std::packaged_task<R()> >(std::forward<F>(task));
+            auto future = packaged->get_future();
+            Schedule([packaged] { (*packaged)(); });
+            return future;
+        }
+
+        // starts once every dependency has finished; the task must not throw, Submit carries exceptions instead
+        Task Schedule(std::function<void()> task, const std::vector<Task> &dependencies = {});
+
+        void Wait(const Task &task);
+
+        template<typename R>
+        R Wait(std::future<R> &future)
+        {
+            while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                if (!RunOne())
+                    future.wait_for(IDLE_WAIT);
+            return future.get();
+        }
+
+        // calls function(i) for every i in [begin, end); chunks of grain indices are handed out through a shared
+        // counter that the caller takes from as well, helpers only make the chunks stealable
+        template<typename F>
+        void ParallelFor(const size_t begin, const size_t end, size_t grain, const F &function)
+        {
+            if (begin >= end)
+                return;
+
+            grain = std::max<size_t>(grain, 1);
+            const auto chunks = (end - begin + grain - 1) / grain;
+
+            std::atomic_size_t next = 0;
+            std::atomic_size_t finished = 0;
+            std::exception_ptr error;
+            std::mutex error_mutex;
+
+            const auto work = [&]
+            {
+                for (size_t chunk; (chunk = next++) < chunks;)
+                {
+                    try
+                    {
+                        const auto last = std::min(begin + (chunk + 1) * grain, end);
+                        for (auto i = begin + chunk * grain; i < last; ++i)
+                            function(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard lock(error_mutex);
+                        if (!error)
+                            error = std::current_exception();
+                        next = chunks;
+                    }
+                }
+            };
+
+            // late helpers find the counter exhausted and return without touching the function
+            const auto helpers = std::min<size_t>(Size(), chunks) - 1;
+            for (size_t i = 0; i < helpers; ++i)
+                Schedule(
+                    [&]
+                    {
+                        work();
+                        ++finished;
+                    });
+            work();
+
+            while (finished < helpers)
+                if (!RunOne())
+                    std::this_thread::sleep_for(IDLE_WAIT);
+
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        // map(first, last) reduces one chunk, the chunks are combined in index order so the result does not depend
+        // on which thread ran which chunk
+        template<typename T, typename M, typename C>
+        T ParallelReduce(
+            const size_t begin,
+            const size_t end,
+            size_t grain,
+            T identity,
+            const M &map,
+            const C &combine)
+        {
+            if (begin >= end)
+                return identity;
+
+            grain = std::max<size_t>(grain, 1);
+            std::vector<T> partials((end - begin + grain - 1) / grain, identity);
+            ParallelFor(
+                0,
+                partials.size(),
+                1,
+                [&](const size_t chunk)
+                {
+                    partials[chunk] = map(begin + chunk * grain, std::min(begin + (chunk + 1) * grain, end));
+                });
+
+            auto result = std::move(identity);
+            for (auto &partial: partials)
+                result = combine(std::move(result), std::move(partial));
+            return result;
+        }
+
+        [[nodiscard]] unsigned Size() const;
+
+    private:
+        // remaining counts the unfinished dependencies and one more held by Schedule until it has registered them
+        struct State
+        {
+            std::function<void()> Function;
+            std::atomic_size_t Remaining = 1;
+            std::mutex Mutex;
+            std::vector<std::shared_ptr<State> > Dependents;
+            std::atomic_bool Done = false;
+        };
+
+        struct Queue
+        {
+            std::mutex Mutex;
+            std::deque<std::shared_ptr<State> > Tasks;
+        };
+
+        static constexpr std::chrono::microseconds IDLE_WAIT{50};
+
+        void Run(unsigned index);
+        void Push(std::shared_ptr<State> state);
+        std::shared_ptr<State> Pop();
+        bool RunOne();
+        void Execute(const std::shared_ptr<State> &state);
+
+        std::vector<std::unique_ptr<Queue> > m_Queues;
+        Queue m_Shared;
+        std::atomic_size_t m_Queued = 0;
+
+        std::vector<std::thread> m_Threads;
+        std::mutex m_Mutex;
+        std::condition_variable m_Condition;
+        bool m_Stop = false;
+    };
+}
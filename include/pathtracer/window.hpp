@@ -27,7 +27,8 @@ namespace pathtracer
             int width,
             int height,
             const std::string &title,
-            const std::filesystem::path &icon);
+            const std::filesystem::path &icon,
+            bool visible = true);
         ~Window();
 
         Window(const Window &) = delete;
@@ -1,16 +1,20 @@
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <imgui.h>
 #include <iostream>
+#include <random>
+#include <thread>
 #include <assimp/postprocess.h>
 #include <backends/imgui_impl_glfw.h>
 #include <backends/imgui_impl_opengl3.h>
+#include <misc/cpp/imgui_stdlib.h>
 #include <GL/glew.h>
 #include <glm/ext.hpp>
 #include <pathtracer/app.hpp>
+#include <pathtracer/cpu_bvh.hpp>
 #include <pathtracer/window.hpp>
 
-glm::mat4 pathtracer::App::CAMERA_TO_WORLD = inverse(lookAt(ORIGIN, TARGET, UP));
-
 static void gl_debug_message_callback(
     const GLenum source,
     const GLenum type,
@@ -26,10 +30,49 @@ static void gl_debug_message_callback(
     std::cerr << "[GL 0x" << std::hex << id << std::dec << "] " << message << std::endl;
 }
 
-pathtracer::App::App()
+static glm::vec3 camera_forward(const float yaw, const float pitch)
+{
+    return {
+        std::cos(glm::radians(pitch)) * std::cos(glm::radians(yaw)),
+        std::sin(glm::radians(pitch)),
+        std::cos(glm::radians(pitch)) * std::sin(glm::radians(yaw)),
+    };
+}
+
+// fnv-1a, only ever compared against itself
+static void hash_bytes(std::uint64_t &hash, const void *data, const size_t size)
+{
+    const auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+pathtracer::App::App(const Options &options)
 {
     m_Assets = std::filesystem::canonical("assets");
-    m_Window = std::make_unique<Window>(600, 600, "PathTracer", m_Assets / "icon.png");
+    m_CheckpointPath = options.CheckpointPath.empty()
+                           ? m_Assets.parent_path() / ".cache" / "checkpoint.ptc"
+                           : options.CheckpointPath;
+    if (options.Resume)
+        m_Resume = std::make_unique<Checkpoint>(Checkpoint::Read(m_CheckpointPath));
+
+    // the images of a checkpoint only fit a framebuffer of the same size, workers and benchmarks need no window
+    const auto worker = !options.Worker.empty();
+    const auto benchmark = options.Benchmark;
+    const auto sequence = !options.Sequence.empty();
+    const auto width = m_Resume ? static_cast<int>(m_Resume->Header.Width) : sequence ? options.Width : 600;
+    const auto height = m_Resume ? static_cast<int>(m_Resume->Header.Height) : sequence ? options.Height : 600;
+
+    if (sequence)
+        m_ScenePath = options.Sequence.string();
+    else if (benchmark && !options.Scene.empty())
+        m_ScenePath = options.Scene.string();
+
+    m_ThreadPool = std::make_unique<ThreadPool>();
+    m_Window = std::make_unique<Window>(width, height, "PathTracer", m_Assets / "icon.png", !worker && !benchmark);
 
     if (const auto error = glewInit())
         throw std::runtime_error(
@@ -64,6 +107,22 @@ pathtracer::App::App()
         });
 
     OnStart();
+    if (worker)
+    {
+        RunWorker(options.Worker);
+        return;
+    }
+    if (sequence)
+    {
+        RunSequence(options.Output);
+        return;
+    }
+    if (benchmark)
+    {
+        RunBenchmark(options.Width, options.Height);
+        return;
+    }
+
     do
         OnFrame();
     while (m_Window->Spin());
@@ -71,6 +130,8 @@ pathtracer::App::App()
 
 pathtracer::App::~App()
 {
+    glDeleteQueries(TIMER_QUERIES, m_TimerQueries);
+
     ImGui_ImplGlfw_Shutdown();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui::DestroyContext();
@@ -90,33 +151,71 @@ void pathtracer::App::OnStart()
     m_VertexArray->Unbind();
 
     glGenTextures(1, &m_AccumulationTexture);
+    glGenTextures(1, &m_MomentsTexture);
+    glGenTextures(1, &m_TileErrorTexture);
+    glGenTextures(1, &m_AlbedoTexture);
+    glGenTextures(1, &m_NormalDepthTexture);
+    glGenTextures(2, m_DenoiseTextures);
+    glGenTextures(4, m_HistoryTextures);
+    glGenQueries(TIMER_QUERIES, m_TimerQueries);
+
+    m_Permutations = Shader::LoadPermutations(m_Assets / "main.yaml");
+    auto shader = std::make_unique<Shader>(m_Assets / "main.yaml", m_Assets.parent_path() / ".cache" / "shaders");
+    m_Defines = shader->GetDefines();
+    m_Shader = shader.get();
+    m_Shaders.emplace(m_Defines, std::move(shader));
 
-    m_Shader = std::make_unique<Shader>(m_Assets / "main.yaml");
+    m_StatsBuffer = std::make_unique<Buffer>(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_READ);
+    m_StatsBuffer->Bind();
+    m_StatsBuffer->Data(sizeof(m_Stats), nullptr);
+    m_StatsBuffer->Unbind();
+    m_StatsBuffer->BindBase(6);
 
-    m_Scene = std::make_unique<Scene>();
-    m_Scene->LoadModel(m_Assets / "objects" / "cornell_box.obj", aiProcess_GenNormals);
+    m_ErrorShader = std::make_unique<Shader>(m_Assets / "adaptive.yaml", m_Assets.parent_path() / ".cache" / "shaders");
+    m_AdaptiveBuffer = std::make_unique<Buffer>(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_READ);
+    m_AdaptiveBuffer->Bind();
+    m_AdaptiveBuffer->Data(sizeof(GLuint), nullptr);
+    m_AdaptiveBuffer->Unbind();
+    m_AdaptiveBuffer->BindBase(7);
 
-    m_Scene->LoadModel(m_Assets / "objects" / "cow.obj", aiProcess_GenSmoothNormals);
-    m_Scene->GetLastModel().Transform = scale(
-        rotate(
-            translate(glm::mat4(1.0f), glm::vec3(-0.5f, -0.65f, 0.0f)),
-            glm::radians(-135.0f),
-            normalize(glm::vec3(0.0f, 1.0f, 0.0f))),
-        glm::vec3(0.1f));
-    m_Scene->GetLastModel().InverseTransform = inverse(m_Scene->GetLastModel().Transform);
-    m_Scene->GetLastModel().NormalTransform = transpose(m_Scene->GetLastModel().InverseTransform);
+    m_DenoiseShader = std::make_unique<Shader>(m_Assets / "denoise.yaml", m_Assets.parent_path() / ".cache" / "shaders");
+    m_Denoiser = std::make_unique<Denoiser>(*m_ThreadPool);
 
-    m_Scene->LoadModel(m_Assets / "objects" / "teapot.obj", aiProcess_GenSmoothNormals);
-    m_Scene->GetLastModel().Transform = scale(
-        rotate(
-            translate(glm::mat4(1.0f), glm::vec3(0.5f, -1.0f, 0.0f)),
-            glm::radians(-45.0f),
-            normalize(glm::vec3(0.0f, 1.0f, 0.0f))),
-        glm::vec3(0.2f));
-    m_Scene->GetLastModel().InverseTransform = inverse(m_Scene->GetLastModel().Transform);
-    m_Scene->GetLastModel().NormalTransform = transpose(m_Scene->GetLastModel().InverseTransform);
+    m_DisplayShader = std::make_unique<Shader>(m_Assets / "display.yaml", m_Assets.parent_path() / ".cache" / "shaders");
 
-    m_Scene->Upload();
+    // without an srgb capable default framebuffer the display pass encodes by itself
+    GLint encoding = GL_LINEAR;
+    glGetFramebufferAttachmentParameteriv(
+        GL_DRAW_FRAMEBUFFER,
+        GL_BACK_LEFT,
+        GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING,
+        &encoding);
+    m_EncodeSrgb = encoding != GL_SRGB;
+
+    // the settings of the first scene may load an environment or select a permutation
+    m_Environment = std::make_unique<EnvironmentMap>(*m_ThreadPool);
+    m_ShaderCompiler = std::make_unique<ShaderCompiler>(m_Window->Handle());
+
+    if (m_Resume)
+        m_ScenePath = m_Resume->Scene;
+    else if (m_ScenePath.empty())
+        m_ScenePath = (m_Assets / "scenes" / "cornell_box.yaml").string();
+    LoadScene(m_ScenePath);
+    if (m_Resume)
+    {
+        const auto &camera = m_Resume->Header.Camera;
+        m_CameraPosition = {camera[0], camera[1], camera[2]};
+        m_CameraYaw = camera[3];
+        m_CameraPitch = camera[4];
+        m_Fov = camera[5];
+    }
+
+    m_CheckpointWriter = std::make_unique<CheckpointWriter>(*m_ThreadPool);
+    m_Exporter = std::make_unique<ImageExporter>(*m_ThreadPool);
+    m_ExportPath = (m_Assets.parent_path() / "exports" / "render").string();
+
+    m_FileWatcher = std::make_unique<FileWatcher>();
+    WatchSources();
 }
 
 void pathtracer::App::OnFrame()
@@ -130,40 +229,434 @@ void pathtracer::App::OnFrame()
         return;
     }
 
-    m_Shader->Bind();
+    ReloadChanged();
+    UpdateCamera();
+
+    // anything that restarts the image before the camera is handled invalidates the history as well
+    const auto generation = m_AccumulationGeneration;
+
+    if (m_Scene->Poll())
+        ResetAccumulation();
+    if (m_Environment->Poll())
+        ResetAccumulation();
+    if (m_ResetRequested)
+    {
+        m_ResetRequested = false;
+        ResetAccumulation();
+    }
+
     if (width != m_PreviousWidth || height != m_PreviousHeight)
+        Resize(width, height);
+
+    if (m_CameraMoved)
     {
-        m_SampleCount = 1u;
+        m_CameraMoved = false;
 
-        m_PreviousWidth = width;
-        m_PreviousHeight = height;
+        const auto reproject = m_Reprojection && generation == m_AccumulationGeneration;
+        if (reproject)
+        {
+            m_PreviousWorldToScreen = m_WorldToScreen;
+            m_PreviousOrigin = m_ViewOrigin;
 
-        glViewport(0, 0, width, height);
+            std::swap(m_AccumulationTexture, m_HistoryTextures[0]);
+            std::swap(m_MomentsTexture, m_HistoryTextures[1]);
+            std::swap(m_AlbedoTexture, m_HistoryTextures[2]);
+            std::swap(m_NormalDepthTexture, m_HistoryTextures[3]);
+            BindImages();
+        }
 
-        glBindTexture(GL_TEXTURE_2D, m_AccumulationTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glBindImageTexture(0, m_AccumulationTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+        ResetAccumulation();
+        m_Reproject = reproject;
+        m_UniformsDirty = true;
+    }
+
+    // a checkpoint restarted by a late texture, environment or shader would be lost, so it waits for a quiet frame
+    if (m_Resume
+        && generation == m_AccumulationGeneration
+        && !m_Environment->IsLoading()
+        && !m_ShaderCompiler->IsBusy())
+        ResumeCheckpoint(width, height);
+
+    if (StatsEnabled())
+    {
+        constexpr GLuint zero[3]{};
+        m_StatsBuffer->Bind();
+        m_StatsBuffer->SubData(0, sizeof(zero), zero);
+        m_StatsBuffer->Unbind();
+    }
+
+    Trace(width, height);
+
+    EstimateError(width, height);
+    Denoise(width, height);
+    Display();
+    Export(width, height);
+    WriteCheckpoint(width, height);
+
+    // reading the counters back stalls on the frame, which is acceptable for a debug permutation
+    const auto stats = StatsEnabled();
+    if (stats)
+    {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        m_StatsBuffer->Bind();
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(m_Stats), m_Stats);
+        m_StatsBuffer->Unbind();
+    }
+
+    ImGui_ImplGlfw_NewFrame();
+    ImGui_ImplOpenGL3_NewFrame();
+    ImGui::NewFrame();
+
+    ImGui::DockSpaceOverViewport(0, nullptr, ImGuiDockNodeFlags_PassthruCentralNode);
+
+    if (ImGui::Begin("Stats"))
+    {
+        const auto &textures = m_Scene->GetTextures();
+        ImGui::Text("Frame: %d", m_SampleCount);
+        ImGui::Text(
+            "Textures: %.1f / %.1f MiB",
+            static_cast<double>(textures.GetResidentBytes()) / (1 << 20),
+            static_cast<double>(textures.GetBudget()) / (1 << 20));
+        const auto tiles = ((m_PreviousWidth + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE)
+                           * ((m_PreviousHeight + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE);
+        ImGui::Text("Active Tiles: %u / %d%s", m_ActiveTiles, tiles, m_Converged ? " (converged)" : "");
+        const auto &build = m_Scene->GetBuildStats();
+        ImGui::Text(
+            "BVH: %zu nodes, %zu / %zu references in %.1f ms, %.2f ms allocating, %.1f ms layout",
+            build.Nodes,
+            build.References,
+            build.Triangles,
+            build.BuildMilliseconds,
+            build.AllocationMilliseconds,
+            build.LayoutMilliseconds);
+        ImGui::Text(
+            "BVH Scratch: %.1f MiB, Peak RSS: %.0f MiB",
+            static_cast<double>(build.ScratchBytes) / (1 << 20),
+            build.PeakResidentBytes / (1 << 20));
+        // a different threshold only changes which tiles are skipped, the samples taken so far stay valid
+        if (ImGui::SliderFloat(
+            "Error Threshold",
+            &m_ErrorThreshold,
+            0.f,
+            0.2f,
+            "%.4f",
+            ImGuiSliderFlags_Logarithmic))
+            m_Converged = false;
+        for (const auto &[mode, milliseconds]: m_DrawTimes)
+            ImGui::Text("Draw (%s): %.2f ms", mode.c_str(), milliseconds);
+        if (stats && m_Stats[0])
+        {
+            ImGui::Text("Rays: %u", m_Stats[0]);
+            ImGui::Text("Nodes / Ray: %.1f", static_cast<double>(m_Stats[1]) / m_Stats[0]);
+            ImGui::Text("Triangles / Ray: %.1f", static_cast<double>(m_Stats[2]) / m_Stats[0]);
+        }
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Camera"))
+    {
+        auto moved = ImGui::DragFloat3("Position", &m_CameraPosition[0], .01f);
+        moved |= ImGui::DragFloat("Yaw", &m_CameraYaw, .5f);
+        moved |= ImGui::DragFloat("Pitch", &m_CameraPitch, .5f, -89.f, 89.f);
+        moved |= ImGui::SliderFloat("FOV", &m_Fov, 10.f, 120.f, "%.0f deg");
+        if (moved)
+            m_CameraMoved = true;
+
+        ImGui::SliderFloat("Speed", &m_CameraSpeed, .1f, 10.f, "%.2f", ImGuiSliderFlags_Logarithmic);
+        ImGui::Checkbox("Reprojection", &m_Reprojection);
+        ImGui::SliderInt("History Limit", &m_HistoryLimit, 1, 1024, "%d", ImGuiSliderFlags_Logarithmic);
+        ImGui::Text("WASD, Space and Shift move, drag with the right mouse button to look");
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Display"))
+    {
+        ImGui::SliderFloat("Exposure", &m_Exposure, -8.f, 8.f, "%.1f EV");
+        constexpr const char *tonemaps[]{"None", "Reinhard", "ACES", "Filmic"};
+        auto tonemap = static_cast<int>(m_Tonemap);
+        if (ImGui::Combo("Tonemap", &tonemap, tonemaps, IM_ARRAYSIZE(tonemaps)))
+            m_Tonemap = static_cast<Tonemap>(tonemap);
+        ImGui::Text("Output: %s", m_EncodeSrgb ? "encoded in the shader" : "sRGB framebuffer");
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Denoise"))
+    {
+        constexpr const char *modes[]{"Off", "GPU", "CPU"};
+        auto mode = static_cast<int>(m_DenoiseMode);
+        if (ImGui::Combo("Mode", &mode, modes, IM_ARRAYSIZE(modes)))
+        {
+            m_DenoiseMode = static_cast<DenoiseMode>(mode);
+            m_DenoiseResult = -1;
+            m_DenoiseDirty = true;
+        }
+
+        // filter settings never touch the accumulation, only the filtered copy is redone
+        auto changed = ImGui::SliderInt("Passes", &m_DenoiseSettings.Passes, 1, 8);
+        changed |= ImGui::SliderFloat(
+            "Color Phi",
+            &m_DenoiseSettings.ColorPhi,
+            .01f,
+            10.f,
+            "%.3f",
+            ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat(
+            "Normal Phi",
+            &m_DenoiseSettings.NormalPhi,
+            .001f,
+            1.f,
+            "%.3f",
+            ImGuiSliderFlags_Logarithmic);
+        changed |= ImGui::SliderFloat(
+            "Depth Phi",
+            &m_DenoiseSettings.DepthPhi,
+            .001f,
+            1.f,
+            "%.3f",
+            ImGuiSliderFlags_Logarithmic);
+        if (changed)
+            m_DenoiseDirty = true;
+
+        if (m_Denoiser->IsBusy())
+            ImGui::Text("Denoising on the CPU...");
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Permutations"))
+    {
+        auto changed = false;
+        for (const auto &[Name, Values]: m_Permutations)
+        {
+            auto &current = m_Defines[Name];
+            if (!ImGui::BeginCombo(Name.c_str(), current.c_str()))
+                continue;
+
+            for (const auto &value: Values)
+                if (ImGui::Selectable(value.c_str(), value == current) && value != current)
+                {
+                    current = value;
+                    changed = true;
+                }
+            ImGui::EndCombo();
+        }
+
+        if (changed)
+            SelectShader();
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Reload"))
+    {
+        ImGui::Text("Program: %s", m_Shader->IsSpirv() ? "SPIR-V" : "GLSL");
+        if (m_ShaderCompiler->IsBusy())
+            ImGui::Text("Compiling shaders...");
+        if (!m_ShaderError.empty())
+            ImGui::TextColored(ImVec4(1.f, .4f, .4f, 1.f), "%s", m_ShaderError.c_str());
+        if (!m_SceneError.empty())
+            ImGui::TextColored(ImVec4(1.f, .4f, .4f, 1.f), "%s", m_SceneError.c_str());
+        if (!m_ShaderCompiler->IsBusy() && m_ShaderError.empty() && m_SceneError.empty())
+            ImGui::Text("Watching for changes");
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Export"))
+    {
+        ImGui::InputText("Path", &m_ExportPath);
+        constexpr const char *formats[]{"EXR (half)", "EXR (float)", "PFM", "PNG"};
+        auto format = static_cast<int>(m_ExportFormat);
+        if (ImGui::Combo("Format", &format, formats, IM_ARRAYSIZE(formats)))
+            m_ExportFormat = static_cast<ExportFormat>(format);
+        ImGui::SliderInt("Every", &m_ExportInterval, 0, 16384, "%d samples", ImGuiSliderFlags_Logarithmic);
+        if (ImGui::Button("Save Now"))
+            m_ExportRequested = true;
+        if (m_Exporter->IsBusy())
+            ImGui::Text("Exporting...");
+        if (!m_ExportStatus.empty())
+            ImGui::TextWrapped("%s", m_ExportStatus.c_str());
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Checkpoint"))
+    {
+        ImGui::TextWrapped("Path: %s", m_CheckpointPath.string().c_str());
+        ImGui::SliderInt("Interval", &m_CheckpointInterval, 0, 16384, "%d samples", ImGuiSliderFlags_Logarithmic);
+        if (ImGui::Button("Save Now"))
+            m_CheckpointRequested = true;
+        if (m_Resume)
+            ImGui::Text("Waiting to resume...");
+        else if (m_CheckpointWriter->IsBusy())
+            ImGui::Text("Saving...");
+        if (!m_CheckpointStatus.empty())
+            ImGui::TextWrapped("%s", m_CheckpointStatus.c_str());
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Scene"))
+    {
+        ImGui::InputText("Path", &m_ScenePath);
+        if (ImGui::Button("Load") && !m_ScenePath.empty())
+        {
+            LoadScene(m_ScenePath);
+            WatchSources();
+        }
+    }
+    ImGui::End();
+
+    if (ImGui::Begin("Environment"))
+    {
+        ImGui::InputText("Path", &m_EnvironmentPath);
+        if (m_Environment->IsLoading())
+            ImGui::Text("Loading...");
+        else if (ImGui::Button("Load") && !m_EnvironmentPath.empty())
+            m_Environment->Load(m_EnvironmentPath);
+        ImGui::SameLine();
+        if (ImGui::Button("Unload") && m_Environment->IsLoaded())
+        {
+            m_Environment->Unload();
+            m_ResetRequested = true;
+        }
+        if (ImGui::SliderFloat("Rotation", &m_EnvironmentRotation, -180.f, 180.f))
+            m_ResetRequested = true;
+    }
+    ImGui::End();
+
+    if (!m_Converged)
+        m_SampleCount++;
+
+    ImGui::Render();
+    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    if (ImGui::GetIO().ConfigFlags & ImGuiConfigFlags_ViewportsEnable)
+    {
+        ImGui::UpdatePlatformWindows();
+        ImGui::RenderPlatformWindowsDefault();
+        m_Window->MakeContextCurrent();
+    }
+}
+
+void pathtracer::App::Resize(const int width, const int height)
+{
+    m_PreviousWidth = width;
+    m_PreviousHeight = height;
+
+    glViewport(0, 0, width, height);
+
+    // images trade places with the history on camera moves, so all of them have to be complete for texelFetch
+    for (const auto texture: {
+             m_AccumulationTexture,
+             m_MomentsTexture,
+             m_AlbedoTexture,
+             m_NormalDepthTexture,
+             m_HistoryTextures[0],
+             m_HistoryTextures[1],
+             m_HistoryTextures[2],
+             m_HistoryTextures[3],
+             m_DenoiseTextures[0],
+             m_DenoiseTextures[1],
+         })
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_TileErrorTexture);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0,
+        GL_R32F,
+        (width + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE,
+        (height + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE,
+        0,
+        GL_RED,
+        GL_FLOAT,
+        nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    BindImages();
+
+    ResetAccumulation();
+    m_UniformsDirty = true;
+}
+
+// one sample per pixel (or per tile in need of them) into the images, the caller handles resets and the camera
+void pathtracer::App::Trace(const int width, const int height)
+{
+    m_Shader->Bind();
+
+    m_Environment->Bind(1);
+    const auto environment_rotation = glm::mat3(
+        rotate(glm::mat4(1.0f), glm::radians(m_EnvironmentRotation), glm::vec3(0.0f, 1.0f, 0.0f)));
+    m_Shader->SetUniform(
+        "EnvironmentEnabled",
+        [this](const GLint loc)
+        {
+            glUniform1i(loc, m_Environment->IsLoaded());
+        });
+    m_Shader->SetUniform(
+        "EnvironmentRotation",
+        [&environment_rotation](const GLint loc)
+        {
+            glUniformMatrix3fv(loc, 1, GL_FALSE, &environment_rotation[0][0]);
+        });
+    m_Shader->SetUniform(
+        "EnvironmentIntegral",
+        [this](const GLint loc)
+        {
+            glUniform1f(loc, m_Environment->GetIntegral());
+        });
+
+    const auto &textures = m_Scene->GetTextures();
+    m_Shader->SetUniform(
+        "TextureCount",
+        [&textures](const GLint loc)
+        {
+            glUniform1i(loc, textures.Count());
+        });
+    m_Shader->SetUniform(
+        "TextureFrame",
+        [&textures](const GLint loc)
+        {
+            glUniform1ui(loc, textures.GetFrame());
+        });
+    m_Shader->SetUniform(
+        "FeedbackUsageOffset",
+        [&textures](const GLint loc)
+        {
+            glUniform1ui(loc, textures.GetUsageOffset());
+        });
+
+    if (m_UniformsDirty)
+    {
+        m_UniformsDirty = false;
 
         auto screen_to_camera = inverse(
             glm::perspectiveFov(
-                glm::radians(40.0f),
+                glm::radians(m_Fov),
                 static_cast<float>(width),
                 static_cast<float>(height),
                 .3f,
                 100.f));
+        auto pixel_spread = 2.f * std::tan(glm::radians(m_Fov) * .5f) / static_cast<float>(height);
+        const auto world_to_camera = lookAt(
+            m_CameraPosition,
+            m_CameraPosition + camera_forward(m_CameraYaw, m_CameraPitch),
+            UP);
+        auto camera_to_world = inverse(world_to_camera);
+
+        m_WorldToScreen = inverse(screen_to_camera) * world_to_camera;
+        m_ViewOrigin = m_CameraPosition;
 
         m_Shader->SetUniform(
             "Origin",
-            [](const GLint loc)
+            [this](const GLint loc)
             {
-                glUniform3fv(loc, 1, &ORIGIN[0]);
+                glUniform3fv(loc, 1, &m_ViewOrigin[0]);
             });
         m_Shader->SetUniform(
             "CameraToWorld",
-            [](const GLint loc)
+            [&camera_to_world](const GLint loc)
             {
-                glUniformMatrix4fv(loc, 1, GL_FALSE, &CAMERA_TO_WORLD[0][0]);
+                glUniformMatrix4fv(loc, 1, GL_FALSE, &camera_to_world[0][0]);
             });
         m_Shader->SetUniform(
             "ScreenToCamera",
@@ -171,6 +664,12 @@ void pathtracer::App::OnFrame()
             {
                 glUniformMatrix4fv(loc, 1, GL_FALSE, &screen_to_camera[0][0]);
             });
+        m_Shader->SetUniform(
+            "PixelSpread",
+            [pixel_spread](const GLint loc)
+            {
+                glUniform1f(loc, pixel_spread);
+            });
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -181,30 +680,1193 @@ void pathtracer::App::OnFrame()
         {
             glUniform1ui(loc, m_SampleCount);
         });
+    m_Shader->SetUniform(
+        "ErrorThreshold",
+        [this](const GLint loc)
+        {
+            glUniform1f(loc, m_ErrorThreshold);
+        });
+    m_Shader->SetUniform(
+        "Frame",
+        [this](const GLint loc)
+        {
+            glUniform1ui(loc, m_Frame++);
+        });
+    m_Shader->SetUniform(
+        "Reproject",
+        [this](const GLint loc)
+        {
+            glUniform1i(loc, m_Reproject);
+        });
+    if (m_Reproject)
+    {
+        for (GLuint i = 0; i < 4; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + 4 + i);
+            glBindTexture(GL_TEXTURE_2D, m_HistoryTextures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        m_Shader->SetUniform(
+            "PreviousWorldToScreen",
+            [this](const GLint loc)
+            {
+                glUniformMatrix4fv(loc, 1, GL_FALSE, &m_PreviousWorldToScreen[0][0]);
+            });
+        m_Shader->SetUniform(
+            "PreviousOrigin",
+            [this](const GLint loc)
+            {
+                glUniform3fv(loc, 1, &m_PreviousOrigin[0]);
+            });
+        m_Shader->SetUniform(
+            "HistoryLimit",
+            [this](const GLint loc)
+            {
+                glUniform1f(loc, static_cast<float>(m_HistoryLimit));
+            });
+    }
+
+    // the pixel writes of the previous estimate pass have to be visible before tiles are skipped
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
+    // the query issued TIMER_QUERIES frames ago is read back before its object is reused
+    const auto query = m_TimerQueries[m_TimerIndex];
+    if (!m_TimerLinks[m_TimerIndex].empty())
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+
+            const auto milliseconds = static_cast<double>(elapsed) * 1e-6;
+            auto &average = m_DrawTimes[m_TimerLinks[m_TimerIndex]];
+            average = average > 0.0 ? average * 0.95 + milliseconds * 0.05 : milliseconds;
+        }
+    }
+
+    const auto link_it = m_Shader->GetDefines().find("LINK");
+    const auto link = link_it == m_Shader->GetDefines().end() ? std::string("separate") : link_it->second;
+
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
     m_VertexArray->Bind();
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, INDICES);
     m_VertexArray->Unbind();
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glEndQuery(GL_TIME_ELAPSED);
     m_Shader->Unbind();
 
-    ImGui_ImplGlfw_NewFrame();
-    ImGui_ImplOpenGL3_NewFrame();
-    ImGui::NewFrame();
+    m_Reproject = false;
 
-    ImGui::DockSpaceOverViewport(0, nullptr, ImGuiDockNodeFlags_PassthruCentralNode);
+    m_TimerLinks[m_TimerIndex] = link;
+    m_TimerIndex = (m_TimerIndex + 1) % TIMER_QUERIES;
+}
 
-    if (ImGui::Begin("Stats"))
-        ImGui::Text("Frame: %d", m_SampleCount);
-    ImGui::End();
+bool pathtracer::App::StatsEnabled() const
+{
+    const auto it = m_Shader->GetDefines().find("STATS");
+    return it != m_Shader->GetDefines().end() && it->second == "true";
+}
 
-    m_SampleCount++;
+void pathtracer::App::ResetAccumulation()
+{
+    m_SampleCount = 1u;
+    m_Converged = false;
+    m_ActiveTiles = 0;
 
-    ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-    if (ImGui::GetIO().ConfigFlags & ImGuiConfigFlags_ViewportsEnable)
+    m_DenoiseResult = -1;
+    m_DenoiseDirty = true;
+    m_Reproject = false;
+    m_CheckpointSamples = 0;
+    m_ExportSamples = 0;
+    ++m_AccumulationGeneration;
+
+    // a pending estimate describes the old image
+    if (m_AdaptiveFence)
     {
-        ImGui::UpdatePlatformWindows();
-        ImGui::RenderPlatformWindowsDefault();
-        m_Window->MakeContextCurrent();
+        glDeleteSync(m_AdaptiveFence);
+        m_AdaptiveFence = nullptr;
+    }
+
+    if (!m_PreviousWidth || !m_PreviousHeight)
+        return;
+
+    constexpr GLfloat zero[4]{};
+    glClearTexImage(m_AccumulationTexture, 0, GL_RGBA, GL_FLOAT, zero);
+    glClearTexImage(m_MomentsTexture, 0, GL_RGBA, GL_FLOAT, zero);
+    glClearTexImage(m_AlbedoTexture, 0, GL_RGBA, GL_FLOAT, zero);
+    glClearTexImage(m_NormalDepthTexture, 0, GL_RGBA, GL_FLOAT, zero);
+
+    constexpr GLfloat unevaluated = -1.f;
+    glClearTexImage(m_TileErrorTexture, 0, GL_RED, GL_FLOAT, &unevaluated);
+}
+
+void pathtracer::App::BindImages() const
+{
+    glBindImageTexture(0, m_AccumulationTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(1, m_MomentsTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(2, m_TileErrorTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    glBindImageTexture(3, m_AlbedoTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(4, m_NormalDepthTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+}
+
+void pathtracer::App::UpdateCamera()
+{
+    const auto time = glfwGetTime();
+    // a long stall, like the first frame, must not throw the camera across the scene
+    const auto delta = std::min(static_cast<float>(time - m_LastTime), .1f);
+    m_LastTime = time;
+
+    const auto window = m_Window->Handle();
+    glm::dvec2 cursor;
+    glfwGetCursorPos(window, &cursor.x, &cursor.y);
+    const auto cursor_delta = glm::vec2(cursor - m_LastCursor);
+    m_LastCursor = cursor;
+
+    const auto &io = ImGui::GetIO();
+    if (!io.WantCaptureMouse
+        && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS
+        && cursor_delta != glm::vec2(0.f))
+    {
+        m_CameraYaw += cursor_delta.x * LOOK_SPEED;
+        m_CameraPitch = std::clamp(m_CameraPitch - cursor_delta.y * LOOK_SPEED, -89.f, 89.f);
+        m_CameraMoved = true;
+    }
+
+    if (io.WantCaptureKeyboard)
+        return;
+
+    const auto forward = camera_forward(m_CameraYaw, m_CameraPitch);
+    const auto right = normalize(cross(forward, UP));
+
+    glm::vec3 move{};
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+        move += forward;
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+        move -= forward;
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        move += right;
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+        move -= right;
+    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
+        move += UP;
+    if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
+        move -= UP;
+
+    if (move != glm::vec3(0.f))
+    {
+        m_CameraPosition += normalize(move) * m_CameraSpeed * delta;
+        m_CameraMoved = true;
+    }
+}
+
+void pathtracer::App::LoadScene(const std::filesystem::path &scene_path)
+{
+    const auto path = std::filesystem::weakly_canonical(scene_path);
+
+    std::unique_ptr<Scene> scene;
+    SceneFile file;
+    try
+    {
+        file = SceneFile::Load(path);
+        scene = std::make_unique<Scene>(
+            *m_ThreadPool,
+            m_Assets.parent_path() / ".cache" / "textures",
+            TEXTURE_BUDGET);
+        scene->Load(file);
+
+        // a rejected file changes no setting, and the buffers of the old scene stay bound until the new one is accepted
+        if (path != m_LoadedScenePath)
+            ApplySceneSettings(file);
+        scene->Upload();
+    }
+    catch (const std::exception &error)
+    {
+        if (!m_Scene)
+            throw;
+
+        m_SceneError = error.what();
+        return;
+    }
+
+    // draw times of another tree or layout would blend into the averages of this one, queries still in flight included
+    m_SceneError.clear();
+    m_Scene = std::move(scene);
+    m_DrawTimes.clear();
+    for (auto &link: m_TimerLinks)
+        link.clear();
+    m_LoadedScenePath = path;
+    m_ResetRequested = true;
+}
+
+void pathtracer::App::ApplySceneSettings(const SceneFile &file)
+{
+    const auto &render = file.Render;
+
+    // validated up front so a bad file leaves every setting as it was
+    auto tonemap = m_Tonemap;
+    if (render.Tonemap)
+    {
+        constexpr std::pair<const char *, Tonemap> tonemaps[]{
+            {"none", Tonemap::None},
+            {"reinhard", Tonemap::Reinhard},
+            {"aces", Tonemap::Aces},
+            {"filmic", Tonemap::Filmic},
+        };
+        const auto it = std::ranges::find_if(
+            tonemaps,
+            [&render](const auto &entry) { return *render.Tonemap == entry.first; });
+        if (it == std::end(tonemaps))
+            throw std::runtime_error("unknown tonemap " + *render.Tonemap);
+        tonemap = it->second;
+    }
+
+    for (const auto &[name, value]: render.Permutations)
+    {
+        const auto permutation = std::ranges::find_if(
+            m_Permutations,
+            [&name](const ShaderPermutation &entry) { return entry.Name == name; });
+        if (permutation == m_Permutations.end()
+            || std::ranges::find(permutation->Values, value) == permutation->Values.end())
+            throw std::runtime_error("unknown permutation " + name + " = " + value);
+    }
+
+    // checking the environment is the last step that may throw, so nothing has changed yet if it does
+    if (render.Environment)
+    {
+        EnvironmentMap::Check(*render.Environment);
+        m_Environment->Load(*render.Environment);
+        m_EnvironmentPath = render.Environment->string();
+    }
+
+    if (file.Camera)
+    {
+        m_CameraPosition = file.Camera->Position;
+        m_CameraYaw = file.Camera->Yaw;
+        m_CameraPitch = file.Camera->Pitch;
+        m_Fov = file.Camera->Fov;
+        m_UniformsDirty = true;
+    }
+
+    m_Tonemap = tonemap;
+    if (render.Exposure)
+        m_Exposure = *render.Exposure;
+    if (render.ErrorThreshold)
+        m_ErrorThreshold = *render.ErrorThreshold;
+    if (render.EnvironmentRotation)
+        m_EnvironmentRotation = *render.EnvironmentRotation;
+
+    if (!render.Permutations.empty())
+    {
+        for (const auto &[name, value]: render.Permutations)
+            m_Defines[name] = value;
+        SelectShader();
+    }
+}
+
+void pathtracer::App::WatchSources()
+{
+    std::vector<std::filesystem::path> directories;
+    const auto add = [&directories](const std::filesystem::path &file)
+    {
+        if (auto directory = file.parent_path();
+            std::find(directories.begin(), directories.end(), directory) == directories.end())
+            directories.push_back(std::move(directory));
+    };
+
+    for (const auto &file: m_Shader->GetDependencies())
+        add(file);
+    for (const auto &file: m_ErrorShader->GetDependencies())
+        add(file);
+    for (const auto &file: m_DenoiseShader->GetDependencies())
+        add(file);
+    for (const auto &file: m_DisplayShader->GetDependencies())
+        add(file);
+    for (const auto &file: m_Scene->GetSources())
+        add(file);
+    add(m_LoadedScenePath);
+
+    m_FileWatcher->Clear();
+    for (const auto &directory: directories)
+        m_FileWatcher->Watch(directory);
+}
+
+void pathtracer::App::ReloadChanged()
+{
+    auto shader_changed = false;
+    auto error_shader_changed = false;
+    auto denoise_shader_changed = false;
+    auto display_shader_changed = false;
+    auto scene_changed = false;
+
+    for (const auto &path: m_FileWatcher->Poll())
+    {
+        // other programs share the shader directory, only files of this one or new stage files below it count
+        const auto &dependencies = m_Shader->GetDependencies();
+        if (std::find(dependencies.begin(), dependencies.end(), path) != dependencies.end())
+            shader_changed = true;
+        else if (path.extension() == ".glsl")
+            for (const auto &directory: m_Shader->GetStageDirectories())
+                if (const auto relative = path.lexically_normal().lexically_relative(directory);
+                    !relative.empty() && *relative.begin() != "..")
+                    shader_changed = true;
+
+        const auto &error_dependencies = m_ErrorShader->GetDependencies();
+        if (std::find(error_dependencies.begin(), error_dependencies.end(), path) != error_dependencies.end())
+            error_shader_changed = true;
+
+        const auto &denoise_dependencies = m_DenoiseShader->GetDependencies();
+        if (std::find(denoise_dependencies.begin(), denoise_dependencies.end(), path) != denoise_dependencies.end())
+            denoise_shader_changed = true;
+
+        const auto &display_dependencies = m_DisplayShader->GetDependencies();
+        if (std::find(display_dependencies.begin(), display_dependencies.end(), path) != display_dependencies.end())
+            display_shader_changed = true;
+
+        // materials are not tracked by name, any mtl next to a loaded model may belong to it
+        for (const auto &source: m_Scene->GetSources())
+            if (path == source || (path.extension() == ".mtl" && path.parent_path() == source.parent_path()))
+                scene_changed = true;
+        if (path == m_LoadedScenePath)
+            scene_changed = true;
+    }
+
+    if (shader_changed)
+    {
+        // every other variant was built from the old sources, they get recompiled when selected again
+        std::erase_if(m_Shaders, [this](const auto &entry) { return entry.second.get() != m_Shader; });
+
+        try
+        {
+            m_Permutations = Shader::LoadPermutations(m_Assets / "main.yaml");
+            std::erase_if(
+                m_Defines,
+                [this](const auto &entry)
+                {
+                    return std::ranges::none_of(
+                        m_Permutations,
+                        [&entry](const ShaderPermutation &permutation) { return permutation.Name == entry.first; });
+                });
+        }
+        catch (const std::exception &error)
+        {
+            m_ShaderError = error.what();
+        }
+
+        m_ShaderCompiler->Submit(
+            {
+                m_Assets / "main.yaml",
+                m_Assets.parent_path() / ".cache" / "shaders",
+                m_Defines,
+                m_Shader->GetUnits(),
+            });
+    }
+
+    // the estimate pass runs every few frames, so it is rebuilt in the background and the running one stays in use
+    // until a build succeeds; the denoise and display passes are single units only compiled when they are edited
+    if (error_shader_changed)
+        m_ShaderCompiler->Submit({m_Assets / "adaptive.yaml", m_Assets.parent_path() / ".cache" / "shaders"});
+
+    const auto rebuild = [this](std::unique_ptr<Shader> &shader, const char *name)
+    {
+        try
+        {
+            shader = std::make_unique<Shader>(m_Assets / name, m_Assets.parent_path() / ".cache" / "shaders");
+        }
+        catch (const std::exception &error)
+        {
+            m_ShaderError = error.what();
+        }
+    };
+
+    if (denoise_shader_changed)
+    {
+        rebuild(m_DenoiseShader, "denoise.yaml");
+        m_DenoiseDirty = true;
+    }
+
+    if (display_shader_changed)
+        rebuild(m_DisplayShader, "display.yaml");
+
+    if (scene_changed)
+        LoadScene(m_LoadedScenePath);
+
+    for (ShaderResult result; m_ShaderCompiler->Poll(result);)
+    {
+        if (result.Path == m_Assets / "adaptive.yaml")
+        {
+            if (result.Program)
+                m_ErrorShader = std::move(result.Program);
+            else
+            {
+                m_ShaderError = result.Error;
+            }
+        }
+        else if (result.Program)
+        {
+            auto &slot = m_Shaders[result.Defines];
+            const auto current = slot && slot.get() == m_Shader;
+            slot = std::move(result.Program);
+            m_ShaderError.clear();
+
+            if (current || result.Defines == m_Defines)
+            {
+                m_Shader = slot.get();
+                m_UniformsDirty = true;
+                m_ResetRequested = true;
+            }
+        }
+        else
+        {
+            m_ShaderError = result.Error;
+        }
+    }
+
+    if (shader_changed || error_shader_changed || denoise_shader_changed || display_shader_changed || scene_changed)
+        WatchSources();
+}
+
+void pathtracer::App::SelectShader()
+{
+    if (const auto it = m_Shaders.find(m_Defines); it != m_Shaders.end())
+    {
+        m_Shader = it->second.get();
+        m_UniformsDirty = true;
+        m_ResetRequested = true;
+        return;
+    }
+
+    m_ShaderCompiler->Submit(
+        {
+            m_Assets / "main.yaml",
+            m_Assets.parent_path() / ".cache" / "shaders",
+            m_Defines,
+            m_Shader->GetUnits(),
+        });
+}
+
+void pathtracer::App::EstimateError(const int width, const int height)
+{
+    if (m_AdaptiveFence)
+    {
+        if (glClientWaitSync(m_AdaptiveFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+
+        glDeleteSync(m_AdaptiveFence);
+        m_AdaptiveFence = nullptr;
+
+        m_AdaptiveBuffer->Bind();
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(m_ActiveTiles), &m_ActiveTiles);
+        m_AdaptiveBuffer->Unbind();
+
+        if (m_ErrorThreshold > 0.f && !m_ActiveTiles)
+            m_Converged = true;
+    }
+
+    if (m_Converged || m_ErrorThreshold <= 0.f || m_SampleCount % ADAPTIVE_INTERVAL)
+        return;
+
+    constexpr GLuint zero = 0;
+    m_AdaptiveBuffer->Bind();
+    m_AdaptiveBuffer->SubData(0, sizeof(zero), &zero);
+    m_AdaptiveBuffer->Unbind();
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    m_ErrorShader->Bind();
+    m_ErrorShader->SetUniform(
+        "ErrorThreshold",
+        [this](const GLint loc)
+        {
+            glUniform1f(loc, m_ErrorThreshold);
+        });
+    m_ErrorShader->SetUniform(
+        "MinSamples",
+        [](const GLint loc)
+        {
+            glUniform1ui(loc, ADAPTIVE_MIN_SAMPLES);
+        });
+    glDispatchCompute(
+        (width + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE,
+        (height + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE,
+        1);
+    m_ErrorShader->Unbind();
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    m_AdaptiveFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void pathtracer::App::Denoise(const int width, const int height)
+{
+    // a result that finishes after a reset belongs to the old image
+    if (std::shared_ptr<DenoiseImage> image; m_Denoiser->Poll(image)
+                                             && m_DenoiseMode == DenoiseMode::Cpu
+                                             && m_DenoiseGeneration == m_AccumulationGeneration)
+    {
+        glBindTexture(GL_TEXTURE_2D, m_DenoiseTextures[0]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image->Width, image->Height, GL_RGBA, GL_FLOAT, image->Result.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_DenoiseResult = 0;
+    }
+
+    if (m_DenoiseMode == DenoiseMode::Off)
+        return;
+
+    // a converged image does not change any more, its last result is shown as is
+    if (!m_Converged)
+        m_DenoiseDirty = true;
+
+    if (m_DenoiseDirty && m_DenoiseMode == DenoiseMode::Gpu)
+    {
+        m_DenoiseDirty = false;
+
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        m_DenoiseShader->Bind();
+        m_DenoiseShader->SetUniform(
+            "NormalPhi",
+            [this](const GLint loc)
+            {
+                glUniform1f(loc, m_DenoiseSettings.NormalPhi);
+            });
+        m_DenoiseShader->SetUniform(
+            "DepthPhi",
+            [this](const GLint loc)
+            {
+                glUniform1f(loc, m_DenoiseSettings.DepthPhi);
+            });
+
+        // every level doubles the tap spacing and halves the color tolerance
+        auto color_phi = m_DenoiseSettings.ColorPhi;
+        for (int level = 0; level < m_DenoiseSettings.Passes; ++level)
+        {
+            glBindImageTexture(5, m_DenoiseTextures[(level + 1) % 2], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+            glBindImageTexture(6, m_DenoiseTextures[level % 2], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+
+            m_DenoiseShader->SetUniform(
+                "StepWidth",
+                [level](const GLint loc)
+                {
+                    glUniform1i(loc, 1 << level);
+                });
+            m_DenoiseShader->SetUniform(
+                "FirstPass",
+                [level](const GLint loc)
+                {
+                    glUniform1i(loc, level == 0);
+                });
+            m_DenoiseShader->SetUniform(
+                "LastPass",
+                [this, level](const GLint loc)
+                {
+                    glUniform1i(loc, level == m_DenoiseSettings.Passes - 1);
+                });
+            m_DenoiseShader->SetUniform(
+                "ColorPhi",
+                [color_phi](const GLint loc)
+                {
+                    glUniform1f(loc, color_phi);
+                });
+
+            glDispatchCompute(
+                (width + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE,
+                (height + ADAPTIVE_TILE - 1) / ADAPTIVE_TILE,
+                1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+            color_phi *= .5f;
+        }
+        m_DenoiseShader->Unbind();
+
+        m_DenoiseResult = (m_DenoiseSettings.Passes - 1) % 2;
+    }
+
+    if (m_DenoiseDirty && m_DenoiseMode == DenoiseMode::Cpu && !m_Denoiser->IsBusy())
+    {
+        m_DenoiseDirty = false;
+
+        // reading back waits for the frame, which is short next to the filter running on the pool
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+        auto image = std::make_shared<DenoiseImage>();
+        image->Width = width;
+        image->Height = height;
+
+        const auto read = [width, height](const GLuint texture, std::vector<float> &pixels)
+        {
+            pixels.resize(static_cast<size_t>(width) * height * 4);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, pixels.data());
+        };
+        read(m_AccumulationTexture, image->Accumulation);
+        read(m_AlbedoTexture, image->Albedo);
+        read(m_NormalDepthTexture, image->NormalDepth);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        m_DenoiseGeneration = m_AccumulationGeneration;
+        m_Denoiser->Start(std::move(image), m_DenoiseSettings);
+    }
+}
+
+void pathtracer::App::Export(const int width, const int height)
+{
+    if (std::string message; m_Exporter->Poll(message))
+        m_ExportStatus = message;
+
+    if (m_ExportInterval > 0 && m_SampleCount % m_ExportInterval == 0 && m_SampleCount != m_ExportSamples)
+    {
+        m_ExportRequested = true;
+        m_ExportSamples = m_SampleCount;
+    }
+    if (!m_ExportRequested || m_ExportPath.empty())
+        return;
+
+    const auto image = m_DenoiseMode != DenoiseMode::Off && m_DenoiseResult >= 0
+                           ? m_DenoiseTextures[m_DenoiseResult]
+                           : m_AccumulationTexture;
+
+    // numbered by sample count so a time lapse sorts by convergence
+    auto samples = std::to_string(m_SampleCount);
+    samples.insert(0, samples.size() < 6 ? 6 - samples.size() : 0, '0');
+
+    // with both buffers in flight the request waits for the next frame
+    if (m_Exporter->Capture(
+        image,
+        width,
+        height,
+        {
+            .Path = m_ExportPath + '_' + samples,
+            .Format = m_ExportFormat,
+            .Exposure = std::exp2(m_Exposure),
+            .Tonemap = m_Tonemap,
+        }))
+        m_ExportRequested = false;
+}
+
+void pathtracer::App::WriteCheckpoint(const int width, const int height)
+{
+    if (std::string error; m_CheckpointWriter->Poll(error))
+        m_CheckpointStatus = error.empty() ? "Saved " + m_CheckpointPath.filename().string() : error;
+
+    // a pending resume must not be overwritten by the image that is about to replace it
+    const auto due = m_CheckpointInterval > 0 && m_SampleCount % m_CheckpointInterval == 0;
+    if (m_Resume || m_CheckpointWriter->IsBusy() || !(due || m_CheckpointRequested) || m_SampleCount == m_CheckpointSamples)
+        return;
+
+    Checkpoint state;
+    state.Header.Width = static_cast<std::uint32_t>(width);
+    state.Header.Height = static_cast<std::uint32_t>(height);
+    state.Header.SampleCount = m_SampleCount;
+    state.Header.Frame = m_Frame;
+    state.Header.SceneHash = SceneHash();
+    state.Header.Camera[0] = m_CameraPosition.x;
+    state.Header.Camera[1] = m_CameraPosition.y;
+    state.Header.Camera[2] = m_CameraPosition.z;
+    state.Header.Camera[3] = m_CameraYaw;
+    state.Header.Camera[4] = m_CameraPitch;
+    state.Header.Camera[5] = m_Fov;
+    state.Scene = m_LoadedScenePath.string();
+
+    const GLuint images[CHECKPOINT_IMAGES]{
+        m_AccumulationTexture,
+        m_MomentsTexture,
+        m_AlbedoTexture,
+        m_NormalDepthTexture,
+    };
+    m_CheckpointWriter->Start(m_CheckpointPath, images, std::move(state));
+    m_CheckpointRequested = false;
+    m_CheckpointSamples = m_SampleCount;
+}
+
+void pathtracer::App::ResumeCheckpoint(const int width, const int height)
+{
+    const auto checkpoint = std::move(m_Resume);
+    const auto &header = checkpoint->Header;
+
+    // the refused file is what the user wanted to continue, later checkpoints must not overwrite it
+    if (const auto mismatch = checkpoint->Mismatch(width, height, SceneHash()); !mismatch.empty())
+    {
+        m_CheckpointPath = Checkpoint::FreshPath(m_CheckpointPath);
+        m_CheckpointStatus = mismatch + ", new checkpoints go to " + m_CheckpointPath.filename().string();
+        return;
+    }
+
+    const GLuint images[CHECKPOINT_IMAGES]{
+        m_AccumulationTexture,
+        m_MomentsTexture,
+        m_AlbedoTexture,
+        m_NormalDepthTexture,
+    };
+    for (unsigned i = 0; i < CHECKPOINT_IMAGES; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, images[i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, checkpoint->Images[i].data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // the checkpoint was taken after its frame was drawn, this frame is the next one
+    m_SampleCount = header.SampleCount + 1;
+    m_Frame = header.Frame;
+    m_CheckpointSamples = header.SampleCount;
+    m_CheckpointStatus = "Resumed at " + std::to_string(header.SampleCount) + " samples";
+}
+
+std::uint64_t pathtracer::App::SceneHash() const
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    const auto add = [&hash](const std::string &text)
+    {
+        hash_bytes(hash, text.data(), text.size() + 1);
+    };
+
+    // the scene file by content, meshes by size and modification time like the texture cache does
+    std::ifstream stream(m_LoadedScenePath, std::ios::binary);
+    add({std::istreambuf_iterator(stream), std::istreambuf_iterator<char>()});
+    for (const auto &source: m_Scene->GetSources())
+    {
+        std::error_code ec;
+        const auto time = std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+        const auto size = ec ? 0 : std::filesystem::file_size(source, ec);
+        hash_bytes(hash, &time, sizeof(time));
+        hash_bytes(hash, &size, sizeof(size));
+    }
+
+    for (const auto &[name, value]: m_Defines)
+    {
+        add(name);
+        add(value);
+    }
+
+    if (m_Environment->IsLoaded() || m_Environment->IsLoading())
+    {
+        add(m_EnvironmentPath);
+        hash_bytes(hash, &m_EnvironmentRotation, sizeof(m_EnvironmentRotation));
+    }
+
+    const float camera[]{m_CameraPosition.x, m_CameraPosition.y, m_CameraPosition.z, m_CameraYaw, m_CameraPitch, m_Fov};
+    hash_bytes(hash, camera, sizeof(camera));
+    return hash;
+}
+
+void pathtracer::App::Display()
+{
+    const auto image = m_DenoiseMode != DenoiseMode::Off && m_DenoiseResult >= 0
+                           ? m_DenoiseTextures[m_DenoiseResult]
+                           : m_AccumulationTexture;
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glActiveTexture(GL_TEXTURE0 + 8);
+    glBindTexture(GL_TEXTURE_2D, image);
+    glActiveTexture(GL_TEXTURE0);
+
+    m_DisplayShader->Bind();
+    m_DisplayShader->SetUniform(
+        "Exposure",
+        [this](const GLint loc)
+        {
+            glUniform1f(loc, std::exp2(m_Exposure));
+        });
+    m_DisplayShader->SetUniform(
+        "Tonemap",
+        [this](const GLint loc)
+        {
+            glUniform1i(loc, static_cast<GLint>(m_Tonemap));
+        });
+    m_DisplayShader->SetUniform(
+        "EncodeSrgb",
+        [this](const GLint loc)
+        {
+            glUniform1i(loc, m_EncodeSrgb);
+        });
+
+    // the ui is authored in srgb already, so the conversion is only on for this draw
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    m_VertexArray->Bind();
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, INDICES);
+    m_VertexArray->Unbind();
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    m_DisplayShader->Unbind();
+}
+
+// the environment and permutation of a scene arrive asynchronously, none of the samples may miss them
+void pathtracer::App::WaitForScene()
+{
+    do
+    {
+        ReloadChanged();
+        m_Environment->Poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    while (m_ShaderCompiler->IsBusy() || m_Environment->IsLoading());
+    ReloadChanged();
+    if (!m_ShaderError.empty())
+        throw std::runtime_error(m_ShaderError);
+}
+
+// renders whatever the coordinator hands out into an attachment-less framebuffer until it says the image is done
+void pathtracer::App::RunWorker(const std::string &address)
+{
+    const auto connection = Connection::Connect(address);
+    std::cout << "connected to " << address << std::endl;
+
+    // every range has to take all of its samples, skipped tiles or merged history would bias the sum
+    m_ErrorThreshold = 0.f;
+    m_Reprojection = false;
+
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    Message message;
+    while (connection.Receive(message, Connection::MAX_JOB_SIZE))
+    {
+        const auto job = std::get_if<RenderJob>(&message);
+        if (!job)
+            break;
+
+        RenderResult result;
+        RenderTile(*job, result);
+        connection.Send(result);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+void pathtracer::App::RenderTile(const RenderJob &job, RenderResult &result)
+{
+    if (std::filesystem::weakly_canonical(job.Scene) != m_LoadedScenePath)
+    {
+        LoadScene(job.Scene);
+        if (!m_SceneError.empty())
+            throw std::runtime_error(m_SceneError);
+    }
+
+    WaitForScene();
+
+    const auto width = static_cast<int>(job.ImageWidth);
+    const auto height = static_cast<int>(job.ImageHeight);
+    if (width != m_PreviousWidth || height != m_PreviousHeight)
+    {
+        glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_WIDTH, width);
+        glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_HEIGHT, height);
+        Resize(width, height);
+    }
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(job.X, job.Y, job.Width, job.Height);
+
+    // textures streamed in halfway would leave the first samples blurrier than the rest, the range starts over
+    for (unsigned attempt = 0;; ++attempt)
+    {
+        m_Scene->Poll();
+        ResetAccumulation();
+        m_Frame = 0;
+
+        // the alpha is the sample index, starting it at the range continues the strata and seeds from there
+        const GLfloat first[4]{0.f, 0.f, 0.f, static_cast<GLfloat>(job.FirstSample)};
+        glClearTexSubImage(
+            m_AccumulationTexture,
+            0,
+            job.X,
+            job.Y,
+            0,
+            job.Width,
+            job.Height,
+            1,
+            GL_RGBA,
+            GL_FLOAT,
+            first);
+
+        auto restarted = false;
+        for (unsigned i = 0; i < job.Samples && !restarted; ++i)
+        {
+            m_SampleCount = job.FirstSample + i + 1;
+            Trace(width, height);
+            restarted = m_Scene->Poll() && attempt < WORKER_RESTARTS;
+        }
+
+        if (!restarted)
+            break;
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+
+    result.Id = job.Id;
+    result.Pixels.resize(static_cast<size_t>(job.Width) * job.Height * 4);
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glGetTextureSubImage(
+        m_AccumulationTexture,
+        0,
+        job.X,
+        job.Y,
+        0,
+        job.Width,
+        job.Height,
+        1,
+        GL_RGBA,
+        GL_FLOAT,
+        static_cast<GLsizei>(result.Pixels.size() * sizeof(float)),
+        result.Pixels.data());
+
+    // the color sums started at zero, only the sample count carries the offset of the range
+    for (size_t i = 3; i < result.Pixels.size(); i += 4)
+        result.Pixels[i] -= static_cast<float>(job.FirstSample);
+
+    std::cout << "job " << job.Id << ": " << job.Width << "x" << job.Height << " at " << job.X << "," << job.Y
+              << ", samples " << job.FirstSample << "-" << job.FirstSample + job.Samples << std::endl;
+}
+
+// every frame of the animation of a scene file: geometry, trees and textures stay resident, only the camera and the
+// model transforms change in between, and each export encodes on the pool while the next frame traces
+void pathtracer::App::RunSequence(const std::filesystem::path &output)
+{
+    const auto file = SceneFile::Load(m_LoadedScenePath);
+    if (!file.Animation)
+        throw std::runtime_error(m_LoadedScenePath.string() + " has no animation");
+    const auto &animation = *file.Animation;
+    WaitForScene();
+
+    // every frame starts over, there is no history worth merging and the threshold is the one of the animation
+    m_Reprojection = false;
+    m_ErrorThreshold = animation.ErrorThreshold.value_or(0.f);
+
+    ExportRequest request{
+        .Format = ImageExporter::FormatOf(output),
+        .Exposure = std::exp2(m_Exposure),
+        .Tonemap = m_Tonemap,
+    };
+    auto prefix = output;
+    prefix.replace_extension();
+
+    const auto report = [this]
+    {
+        if (std::string message; m_Exporter->Poll(message))
+            std::cout << message << std::endl;
+    };
+
+    auto presented = std::chrono::steady_clock::now();
+    for (unsigned frame = 0; frame < animation.Frames; ++frame)
+    {
+        if (!animation.Camera.empty())
+        {
+            const auto camera = animation.CameraAt(static_cast<float>(frame));
+            m_CameraPosition = camera.Position;
+            m_CameraYaw = camera.Yaw;
+            m_CameraPitch = camera.Pitch;
+            m_Fov = camera.Fov;
+            m_UniformsDirty = true;
+        }
+
+        for (const auto &track: animation.Instances)
+            m_Scene->SetTransform(track.Instance, SceneAnimation::TransformAt(track, static_cast<float>(frame)));
+        if (!animation.Instances.empty())
+            m_Scene->UploadModels();
+
+        int width, height;
+        m_Window->GetFramebufferSize(width, height);
+        if (width != m_PreviousWidth || height != m_PreviousHeight)
+            Resize(width, height);
+        ResetAccumulation();
+
+        while (m_SampleCount <= animation.Samples && !m_Converged)
+        {
+            if (m_Scene->Poll())
+                ResetAccumulation();
+
+            Trace(width, height);
+            EstimateError(width, height);
+            report();
+
+            if (!m_Converged)
+                m_SampleCount++;
+
+            // presenting waits for the swap interval, a few times a second is enough to follow along
+            if (const auto now = std::chrono::steady_clock::now(); now - presented > SEQUENCE_PRESENT_INTERVAL)
+            {
+                presented = now;
+                Display();
+                if (!m_Window->Spin())
+                    return;
+            }
+        }
+
+        auto number = std::to_string(frame);
+        number.insert(0, number.size() < 4 ? 4 - number.size() : 0, '0');
+        request.Path = prefix.string() + '_' + number;
+
+        // only waits when the two frames before are both still encoding
+        while (!m_Exporter->Capture(m_AccumulationTexture, width, height, request))
+        {
+            report();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::cout << "frame " << frame + 1 << " / " << animation.Frames << ": " << m_SampleCount - 1 << " samples"
+                  << std::endl;
+    }
+
+    while (m_Exporter->IsBusy())
+    {
+        report();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// primary rays of the scene camera in 4x4 tiles for the packets, and one random bounce from every primary hit for
+// incoherent rays; single threaded, so the numbers compare per core
+void pathtracer::App::RunBenchmark(const int width, const int height)
+{
+    const auto &build = m_Scene->GetBuildStats();
+    std::cout << "built " << build.Nodes << " nodes over " << build.References << " references to "
+              << build.Triangles << " triangles in "
+              << build.BuildMilliseconds << " ms, " << build.AllocationMilliseconds << " ms allocating, "
+              << build.LayoutMilliseconds << " ms layout, "
+              << static_cast<double>(build.ScratchBytes) / (1 << 20) << " MiB scratch, peak rss "
+              << build.PeakResidentBytes / (1 << 20) << " MiB" << std::endl;
+
+    const auto build_start = std::chrono::steady_clock::now();
+    const CpuBvh bvh(*m_Scene);
+    std::cout << "collapsed " << m_Scene->GetNodes().size() << " nodes into " << bvh.GetNodes().size()
+              << " four-wide nodes and " << bvh.GetBlocks().size() << " triangle blocks in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count()
+              << " ms" << std::endl;
+
+    const auto forward = camera_forward(m_CameraYaw, m_CameraPitch);
+    const auto right = normalize(cross(forward, UP));
+    const auto up = cross(right, forward);
+    const auto spread = std::tan(glm::radians(m_Fov) * .5f);
+    const auto aspect = static_cast<float>(width) / static_cast<float>(height);
+
+    std::vector<CpuRay> primary;
+    for (auto ty = 0; ty < height; ty += 4)
+        for (auto tx = 0; tx < width; tx += 4)
+            for (auto y = ty; y < std::min(ty + 4, height); ++y)
+                for (auto x = tx; x < std::min(tx + 4, width); ++x)
+                {
+                    const auto sx = (2.f * (static_cast<float>(x) + .5f) / static_cast<float>(width) - 1.f) * spread * aspect;
+                    const auto sy = (2.f * (static_cast<float>(y) + .5f) / static_cast<float>(height) - 1.f) * spread;
+                    primary.push_back({.Origin = m_CameraPosition, .Direction = forward + right * sx + up * sy});
+                }
+
+    std::vector<CpuHit> reference(primary.size());
+    for (size_t i = 0; i < primary.size(); ++i)
+        bvh.Intersect(primary[i], reference[i], SimdLevel::Scalar);
+
+    std::mt19937 random(1);
+    std::normal_distribution<float> normal;
+    std::vector<CpuRay> bounce;
+    for (size_t i = 0; i < primary.size(); ++i)
+        if (reference[i].IsHit())
+            bounce.push_back(
+                {
+                    .Origin = primary[i].Origin + primary[i].Direction * reference[i].T,
+                    .TMin = 1e-3f,
+                    .Direction = glm::vec3(normal(random), normal(random), normal(random)),
+                });
+
+    // packets or single rays, on this thread or spread over the pool in chunks of packets
+    const auto measure = [this, &bvh](const std::vector<CpuRay> &rays, const SimdLevel level, const bool packets,
+                                      const bool threaded, std::vector<CpuHit> &hits)
+    {
+        const auto trace = [&](const size_t chunk)
+        {
+            const auto first = chunk * CpuBvh::MAX_PACKET;
+            const auto count = static_cast<unsigned>(std::min<size_t>(CpuBvh::MAX_PACKET, rays.size() - first));
+            if (packets)
+                bvh.IntersectPacket(rays.data() + first, hits.data() + first, count, level);
+            else
+                for (auto i = first; i < first + count; ++i)
+                    bvh.Intersect(rays[i], hits[i], level);
+        };
+        const auto chunks = (rays.size() + CpuBvh::MAX_PACKET - 1) / CpuBvh::MAX_PACKET;
+
+        // the best of three, the first run also warms the caches
+        auto best = std::numeric_limits<double>::infinity();
+        for (auto run = 0; run < 3; ++run)
+        {
+            hits.assign(rays.size(), {});
+            const auto start = std::chrono::steady_clock::now();
+            if (threaded)
+                m_ThreadPool->ParallelFor(0, chunks, BENCHMARK_PACKETS_PER_TASK, trace);
+            else
+                for (size_t chunk = 0; chunk < chunks; ++chunk)
+                    trace(chunk);
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        return static_cast<double>(rays.size()) / best;
+    };
+
+    // a different triangle at the same distance is a tie broken by rounding, not a miss
+    const auto count_mismatches = [this](const std::vector<CpuHit> &hits, const std::vector<CpuHit> &expected)
+    {
+        return m_ThreadPool->ParallelReduce(
+            0,
+            hits.size(),
+            4096,
+            size_t{0},
+            [&](const size_t first, const size_t last)
+            {
+                size_t mismatches = 0;
+                for (auto i = first; i < last; ++i)
+                {
+                    const auto &hit = hits[i];
+                    const auto &reference_hit = expected[i];
+                    if (hit.IsHit() != reference_hit.IsHit()
+                        || (hit.Triangle != reference_hit.Triangle
+                            && std::abs(hit.T - reference_hit.T) > 1e-4f * hit.T))
+                        ++mismatches;
+                }
+                return mismatches;
+            },
+            std::plus<>());
+    };
+
+    const auto detected = CpuBvh::Detect();
+    std::cout << "detected " << CpuBvh::Name(detected) << ", " << primary.size() << " primary and " << bounce.size()
+              << " bounce rays" << std::endl;
+
+    for (const auto &[name, rays, packets]: {
+             std::tuple("primary", &primary, false),
+             std::tuple("primary packets", &primary, true),
+             std::tuple("bounce", &bounce, false),
+         })
+    {
+        std::vector<CpuHit> expected, hits;
+        const auto scalar = measure(*rays, SimdLevel::Scalar, false, false, expected);
+        std::cout << name << ": scalar " << scalar * 1e-6 << " Mrays/s" << std::endl;
+
+        // per ray, through the binary nodes like the shader reads them
+        if (!packets && !rays->empty())
+        {
+            const auto cache = bvh.MeasureCache(*rays);
+            const auto per_ray = [&cache](const size_t count)
+            {
+                return static_cast<double>(count) / static_cast<double>(cache.Rays);
+            };
+            std::cout << "  cache " << per_ray(cache.Lines) << " lines, " << per_ray(cache.L1Misses) << " L1 and "
+                    << per_ray(cache.L2Misses) << " L2 misses per ray" << std::endl;
+        }
+
+        for (auto level = SimdLevel::Sse42; level <= detected; level = static_cast<SimdLevel>(static_cast<int>(level) + 1))
+        {
+            const auto rate = measure(*rays, level, packets, false, hits);
+            const auto mismatches = count_mismatches(hits, expected);
+
+            std::cout << "  " << CpuBvh::Name(level) << " " << rate * 1e-6 << " Mrays/s, " << rate / scalar << "x";
+            if (mismatches)
+                std::cout << ", " << mismatches << " mismatches";
+            std::cout << std::endl;
+        }
+
+        const auto rate = measure(*rays, detected, packets, true, hits);
+        const auto mismatches = count_mismatches(hits, expected);
+        std::cout << "  " << CpuBvh::Name(detected) << " on " << m_ThreadPool->Size() << " threads " << rate * 1e-6
+                << " Mrays/s, " << rate / scalar << "x";
+        if (mismatches)
+            std::cout << ", " << mismatches << " mismatches";
+        std::cout << std::endl;
     }
 }
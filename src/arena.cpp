@@ -0,0 +1,41 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <pathtracer/arena.hpp>
+
+void pathtracer::Arena::Reserve(const size_t bytes)
+{
+    if (bytes > m_Capacity)
+    {
+        m_Memory = std::make_unique_for_overwrite<std::byte[]>(bytes);
+        m_Capacity = bytes;
+    }
+    Reset();
+}
+
+void pathtracer::Arena::Reset()
+{
+    m_Used = 0;
+}
+
+void *pathtracer::Arena::Allocate(const size_t bytes, const size_t alignment)
+{
+    const auto base = reinterpret_cast<std::uintptr_t>(m_Memory.get());
+    const auto offset = (base + m_Used + alignment - 1) / alignment * alignment - base;
+    if (offset + bytes > m_Capacity)
+        throw std::runtime_error(
+            "arena of " + std::to_string(m_Capacity) + " bytes cannot fit " + std::to_string(bytes) + " more");
+
+    m_Used = offset + bytes;
+    return m_Memory.get() + offset;
+}
+
+size_t pathtracer::Arena::GetUsed() const
+{
+    return m_Used;
+}
+
+size_t pathtracer::Arena::GetCapacity() const
+{
+    return m_Capacity;
+}
@@ -27,7 +27,17 @@ void pathtracer::Buffer::Data(const GLsizeiptr size, const void *data) const
     glBufferData(m_Target, size, data, m_Usage);
 }
 
+void pathtracer::Buffer::SubData(const GLintptr offset, const GLsizeiptr size, const void *data) const
+{
+    glBufferSubData(m_Target, offset, size, data);
+}
+
 void pathtracer::Buffer::BindBase(const GLuint i) const
 {
     glBindBufferBase(m_Target, i, m_Handle);
 }
+
+GLuint pathtracer::Buffer::Handle() const
+{
+    return m_Handle;
+}
@@ -0,0 +1,830 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <limits>
+#include <sys/resource.h>
+#include <pathtracer/bvh_builder.hpp>
+
+static constexpr size_t TRIANGLES_PER_TASK = 4096;
+static constexpr float TRAVERSAL_COST = 1.f;
+static constexpr float INTERSECTION_COST = 1.f;
+static constexpr std::uint32_t UNPLACED = ~0u;
+
+// spatial splits are only tried where the children of the best object split overlap by this much of the root
+static constexpr float SPATIAL_OVERLAP = 1e-5f;
+
+static thread_local pathtracer::Arena thread_arena;
+static thread_local bool thread_arena_busy = false;
+
+struct Bounds
+{
+    glm::vec3 Min{std::numeric_limits<float>::infinity()};
+    glm::vec3 Max{-std::numeric_limits<float>::infinity()};
+
+    void Grow(const glm::vec3 &point)
+    {
+        Min = glm::min(Min, point);
+        Max = glm::max(Max, point);
+    }
+
+    void Grow(const Bounds &other)
+    {
+        Min = glm::min(Min, other.Min);
+        Max = glm::max(Max, other.Max);
+    }
+
+    [[nodiscard]] bool IsEmpty() const
+    {
+        return Min.x > Max.x || Min.y > Max.y || Min.z > Max.z;
+    }
+
+    [[nodiscard]] float Area() const
+    {
+        if (IsEmpty())
+            return 0.f;
+
+        const auto x = Max.x - Min.x;
+        const auto y = Max.y - Min.y;
+        const auto z = Max.z - Min.z;
+        return x * y + y * z + z * x;
+    }
+
+    [[nodiscard]] float Center(const int axis) const
+    {
+        return .5f * (Min[axis] + Max[axis]);
+    }
+};
+
+static Bounds overlap(const Bounds &a, const Bounds &b)
+{
+    return {glm::max(a.Min, b.Min), glm::min(a.Max, b.Max)};
+}
+
+static Bounds merge(Bounds a, const Bounds &b)
+{
+    a.Grow(b);
+    return a;
+}
+
+// the boxes the shader tests are never flat, a wall would otherwise be missed by rays parallel to it
+static pathtracer::BVHNode make_node(
+    glm::vec3 min,
+    glm::vec3 max,
+    const unsigned left,
+    const unsigned right,
+    const unsigned start,
+    const unsigned end)
+{
+    for (int a = 0; a < 3; ++a)
+        if (max[a] - min[a] < 0.01f)
+        {
+            min[a] -= 0.01f;
+            max[a] += 0.01f;
+        }
+    return {min, max, left, right, start, end};
+}
+
+// the part of a triangle between two planes across one axis
+static Bounds clip(const pathtracer::Triangle &triangle, const int axis, const float low, const float high)
+{
+    const glm::vec3 points[3]{triangle.P0, triangle.P1, triangle.P2};
+
+    Bounds bounds;
+    for (int i = 0; i < 3; ++i)
+    {
+        const auto &a = points[i];
+        const auto &b = points[(i + 1) % 3];
+        if (a[axis] >= low && a[axis] <= high)
+            bounds.Grow(a);
+
+        for (const auto plane: {low, high})
+            if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
+            {
+                const auto t = (plane - a[axis]) / (b[axis] - a[axis]);
+                auto point = a + (b - a) * t;
+                point[axis] = plane;
+                bounds.Grow(point);
+            }
+    }
+    return bounds;
+}
+
+// builder scratch, indexed by triangle; order is permuted in place by the splits and ends up in leaf order
+struct MedianScratch
+{
+    const glm::vec3 *Centers;
+    const glm::vec3 *Mins;
+    const glm::vec3 *Maxs;
+    std::uint32_t *Order;
+};
+
+// a subtree still to be split by one of the parallel passes
+struct MedianTask
+{
+    unsigned Index;
+    unsigned Start;
+    unsigned End;
+    unsigned Depth;
+};
+
+// writes the node over [start, end) at idx, returns false for a leaf and otherwise where the halves meet; a subtree
+// over count triangles takes exactly 2 count - 1 nodes, so the right child's place is known before the left subtree
+// is built and both halves write into the reserved nodes
+static bool split_median(
+    const MedianScratch &scratch,
+    pathtracer::BVHNode *nodes,
+    const unsigned idx,
+    const unsigned start,
+    const unsigned end,
+    const unsigned depth,
+    unsigned &mid)
+{
+    glm::vec3 min{std::numeric_limits<float>::infinity()}, max{-std::numeric_limits<float>::infinity()};
+
+    for (auto i = start; i < end; ++i)
+    {
+        min = glm::min(min, scratch.Mins[scratch.Order[i]]);
+        max = glm::max(max, scratch.Maxs[scratch.Order[i]]);
+    }
+
+    const auto count = end - start;
+
+    if (depth == 0 || count < 2)
+    {
+        nodes[idx] = make_node(min, max, 0, 0, start, end);
+        return false;
+    }
+
+    const auto node = make_node(min, max, 0, 0, 0, 0);
+    const auto dx = node.Max.x - node.Min.x;
+    const auto dy = node.Max.y - node.Min.y;
+    const auto dz = node.Max.z - node.Min.z;
+    const auto longest_axis = dx > dy ? (dx >= dz ? 0 : 2) : dy >= dz ? 1 : 2;
+
+    // only the halves matter, each child orders its own half again
+    mid = start + count / 2;
+    std::nth_element(
+        scratch.Order + start,
+        scratch.Order + mid,
+        scratch.Order + end,
+        [&scratch, longest_axis](const std::uint32_t a, const std::uint32_t b)-> bool
+        {
+            return scratch.Centers[a][longest_axis] < scratch.Centers[b][longest_axis];
+        });
+
+    nodes[idx] = make_node(min, max, idx + 1, idx + 2 * (mid - start), 0, 0);
+    return true;
+}
+
+static void build_median(
+    const MedianScratch &scratch,
+    pathtracer::BVHNode *nodes,
+    const unsigned idx,
+    const unsigned start,
+    const unsigned end,
+    const unsigned depth)
+{
+    if (unsigned mid; split_median(scratch, nodes, idx, start, end, depth, mid))
+    {
+        build_median(scratch, nodes, idx + 1, start, mid, depth - 1);
+        build_median(scratch, nodes, idx + 2 * (mid - start), mid, end, depth - 1);
+    }
+}
+
+// a triangle, or the part of one that a spatial split left on one side
+struct Reference
+{
+    Bounds Box;
+    std::uint32_t Triangle;
+};
+
+struct Split
+{
+    float Cost = std::numeric_limits<float>::infinity();
+    int Axis = -1;
+    bool Spatial = false;
+
+    // the last bin on the left; object splits bin the centers from origin on, spatial ones split at the position
+    unsigned Bin = 0;
+    float Position = 0.f;
+    float Origin = 0.f;
+    float Scale = 0.f;
+
+    Bounds Left;
+    Bounds Right;
+    unsigned LeftCount = 0;
+    unsigned RightCount = 0;
+};
+
+// the references of a node are the top count entries of the stack; a split writes the children to the scratch,
+// left ones from the front and right ones from the back, then back onto the stack with the left on top. the stack
+// never holds more than the references that exist, which the budget bounds, so neither array grows
+struct SpatialBuild
+{
+    const std::vector<pathtracer::Triangle> &Triangles;
+    Reference *Stack;
+    Reference *Scratch;
+    size_t Limit;
+    size_t Count;
+    float RootArea;
+    std::vector<pathtracer::BVHNode> &Nodes;
+    std::vector<std::uint32_t> &Indices;
+
+    unsigned Build(size_t begin, unsigned count, unsigned depth);
+    static unsigned ObjectBin(const Split &split, const Reference &reference);
+    [[nodiscard]] Split FindObjectSplit(const Reference *references, unsigned count, const Bounds &centers) const;
+    [[nodiscard]] Split FindSpatialSplit(const Reference *references, unsigned count, const Bounds &bounds) const;
+    unsigned Partition(const Reference *references, unsigned count, Split &split, unsigned &left_count);
+};
+
+Split SpatialBuild::FindObjectSplit(const Reference *references, const unsigned count, const Bounds &centers) const
+{
+    constexpr auto bins = pathtracer::BvhBuilder::OBJECT_BINS;
+
+    Split best;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto extent = centers.Max[axis] - centers.Min[axis];
+        if (extent <= 0.f)
+            continue;
+
+        std::array<Bounds, bins> boxes{};
+        std::array<unsigned, bins> counts{};
+        const auto scale = static_cast<float>(bins) / extent;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const auto bin = std::min(
+                static_cast<unsigned>((references[i].Box.Center(axis) - centers.Min[axis]) * scale),
+                bins - 1);
+            boxes[bin].Grow(references[i].Box);
+            ++counts[bin];
+        }
+
+        std::array<float, bins> right_areas{};
+        Bounds right;
+        for (auto bin = bins - 1; bin > 0; --bin)
+        {
+            right.Grow(boxes[bin]);
+            right_areas[bin] = right.Area();
+        }
+
+        Bounds left;
+        unsigned left_count = 0;
+        for (unsigned bin = 0; bin + 1 < bins; ++bin)
+        {
+            left.Grow(boxes[bin]);
+            left_count += counts[bin];
+            const auto right_count = count - left_count;
+            if (!left_count || !right_count)
+                continue;
+
+            const auto cost = left.Area() * static_cast<float>(left_count)
+                              + right_areas[bin + 1] * static_cast<float>(right_count);
+            if (cost < best.Cost)
+                best = {
+                    .Cost = cost,
+                    .Axis = axis,
+                    .Bin = bin,
+                    .Origin = centers.Min[axis],
+                    .Scale = scale,
+                    .LeftCount = left_count,
+                    .RightCount = right_count,
+                };
+        }
+    }
+
+    if (best.Axis < 0)
+        return best;
+
+    // the boxes of the winner are gathered again rather than kept for every candidate
+    for (unsigned i = 0; i < count; ++i)
+        (ObjectBin(best, references[i]) <= best.Bin ? best.Left : best.Right).Grow(references[i].Box);
+    return best;
+}
+
+unsigned SpatialBuild::ObjectBin(const Split &split, const Reference &reference)
+{
+    return std::min(
+        static_cast<unsigned>((reference.Box.Center(split.Axis) - split.Origin) * split.Scale),
+        pathtracer::BvhBuilder::OBJECT_BINS - 1);
+}
+
+Split SpatialBuild::FindSpatialSplit(const Reference *references, const unsigned count, const Bounds &bounds) const
+{
+    constexpr auto bins = pathtracer::BvhBuilder::SPATIAL_BINS;
+
+    Split best;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const auto extent = bounds.Max[axis] - bounds.Min[axis];
+        if (extent <= 0.f)
+            continue;
+
+        const auto width = extent / static_cast<float>(bins);
+        const auto bin_of = [&](const float position)
+        {
+            const auto bin = static_cast<int>((position - bounds.Min[axis]) / width);
+            return static_cast<unsigned>(std::clamp(bin, 0, static_cast<int>(bins) - 1));
+        };
+
+        // a reference enters the bin of its minimum and leaves the one of its maximum, in between it adds only
+        // the part of its triangle inside each bin
+        std::array<Bounds, bins> boxes{};
+        std::array<unsigned, bins> entries{};
+        std::array<unsigned, bins> exits{};
+        for (unsigned i = 0; i < count; ++i)
+        {
+            const auto &reference = references[i];
+            const auto first = bin_of(reference.Box.Min[axis]);
+            const auto last = bin_of(reference.Box.Max[axis]);
+            ++entries[first];
+            ++exits[last];
+
+            if (first == last)
+            {
+                boxes[first].Grow(reference.Box);
+                continue;
+            }
+
+            const auto &triangle = Triangles[reference.Triangle];
+            for (auto bin = first; bin <= last; ++bin)
+            {
+                const auto low = bounds.Min[axis] + width * static_cast<float>(bin);
+                const auto high = bin + 1 == bins ? bounds.Max[axis] : low + width;
+                const auto part = overlap(clip(triangle, axis, low, high), reference.Box);
+                if (!part.IsEmpty())
+                    boxes[bin].Grow(part);
+            }
+        }
+
+        std::array<float, bins> right_areas{};
+        std::array<unsigned, bins> right_counts{};
+        Bounds right;
+        unsigned right_count = 0;
+        for (auto bin = bins - 1; bin > 0; --bin)
+        {
+            right.Grow(boxes[bin]);
+            right_count += exits[bin];
+            right_areas[bin] = right.Area();
+            right_counts[bin] = right_count;
+        }
+
+        Bounds left;
+        unsigned left_count = 0;
+        for (unsigned bin = 0; bin + 1 < bins; ++bin)
+        {
+            left.Grow(boxes[bin]);
+            left_count += entries[bin];
+            if (!left_count || !right_counts[bin + 1])
+                continue;
+
+            const auto cost = left.Area() * static_cast<float>(left_count)
+                              + right_areas[bin + 1] * static_cast<float>(right_counts[bin + 1]);
+            if (cost < best.Cost)
+            {
+                Bounds right_bounds;
+                for (auto b = bin + 1; b < bins; ++b)
+                    right_bounds.Grow(boxes[b]);
+
+                best = {
+                    .Cost = cost,
+                    .Axis = axis,
+                    .Spatial = true,
+                    .Bin = bin,
+                    .Position = bounds.Min[axis] + width * static_cast<float>(bin + 1),
+                    .Left = left,
+                    .Right = right_bounds,
+                    .LeftCount = left_count,
+                    .RightCount = right_counts[bin + 1],
+                };
+            }
+        }
+    }
+    return best;
+}
+
+// writes the children to the scratch and returns how many went right; straddling references of a spatial split
+// are split in two unless moving them whole to one side is cheaper, or the budget is spent
+unsigned SpatialBuild::Partition(
+    const Reference *references,
+    const unsigned count,
+    Split &split,
+    unsigned &left_count)
+{
+    const auto axis = split.Axis;
+    left_count = 0;
+    unsigned right_count = 0;
+    const auto push_left = [&](const Reference &reference) { Scratch[left_count++] = reference; };
+    const auto push_right = [&](const Reference &reference) { Scratch[Limit - ++right_count] = reference; };
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const auto &reference = references[i];
+        if (!split.Spatial)
+        {
+            if (ObjectBin(split, reference) <= split.Bin)
+                push_left(reference);
+            else
+                push_right(reference);
+            continue;
+        }
+
+        if (reference.Box.Max[axis] <= split.Position)
+        {
+            push_left(reference);
+            continue;
+        }
+        if (reference.Box.Min[axis] >= split.Position)
+        {
+            push_right(reference);
+            continue;
+        }
+
+        const auto left_area = split.Left.Area();
+        const auto right_area = split.Right.Area();
+        const auto left_n = static_cast<float>(split.LeftCount);
+        const auto right_n = static_cast<float>(split.RightCount);
+        const auto split_cost = left_area * left_n + right_area * right_n;
+        const auto left_cost = merge(split.Left, reference.Box).Area() * left_n + right_area * (right_n - 1.f);
+        const auto right_cost = left_area * (left_n - 1.f) + merge(split.Right, reference.Box).Area() * right_n;
+
+        if (Count >= Limit || std::min(left_cost, right_cost) < split_cost)
+        {
+            if (left_cost <= right_cost)
+            {
+                split.Left.Grow(reference.Box);
+                --split.RightCount;
+                push_left(reference);
+            }
+            else
+            {
+                split.Right.Grow(reference.Box);
+                --split.LeftCount;
+                push_right(reference);
+            }
+            continue;
+        }
+
+        const auto &triangle = Triangles[reference.Triangle];
+        const auto low = overlap(clip(triangle, axis, reference.Box.Min[axis], split.Position), reference.Box);
+        const auto high = overlap(clip(triangle, axis, split.Position, reference.Box.Max[axis]), reference.Box);
+        if (low.IsEmpty() || high.IsEmpty())
+        {
+            if (low.IsEmpty())
+                push_right(reference);
+            else
+                push_left(reference);
+            continue;
+        }
+
+        push_left({low, reference.Triangle});
+        push_right({high, reference.Triangle});
+        ++Count;
+    }
+    return right_count;
+}
+
+unsigned SpatialBuild::Build(const size_t begin, const unsigned count, const unsigned depth)
+{
+    const auto references = Stack + begin;
+
+    Bounds bounds, centers;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        bounds.Grow(references[i].Box);
+        for (int a = 0; a < 3; ++a)
+        {
+            centers.Min[a] = std::min(centers.Min[a], references[i].Box.Center(a));
+            centers.Max[a] = std::max(centers.Max[a], references[i].Box.Center(a));
+        }
+    }
+
+    const auto idx = static_cast<unsigned>(Nodes.size());
+    Nodes.emplace_back();
+
+    const auto make_leaf = [&]
+    {
+        const auto start = static_cast<unsigned>(Indices.size());
+        for (unsigned i = 0; i < count; ++i)
+            Indices.push_back(references[i].Triangle);
+        Nodes[idx] = make_node(bounds.Min, bounds.Max, 0, 0, start, static_cast<unsigned>(Indices.size()));
+        return idx;
+    };
+
+    if (count < 2 || depth >= pathtracer::BvhBuilder::MAX_DEPTH)
+        return make_leaf();
+
+    auto split = FindObjectSplit(references, count, centers);
+    if (split.Axis >= 0)
+    {
+        if (Count < Limit && overlap(split.Left, split.Right).Area() > SPATIAL_OVERLAP * RootArea)
+            if (auto spatial = FindSpatialSplit(references, count, bounds); spatial.Cost < split.Cost)
+                split = spatial;
+    }
+    else
+    {
+        split = FindSpatialSplit(references, count, bounds);
+    }
+
+    const auto area = bounds.Area();
+    const auto split_cost = TRAVERSAL_COST + INTERSECTION_COST * (area > 0.f ? split.Cost / area : 0.f);
+    if (count <= pathtracer::BvhBuilder::MAX_LEAF_TRIANGLES
+        && (split.Axis < 0 || INTERSECTION_COST * static_cast<float>(count) <= split_cost))
+        return make_leaf();
+
+    const auto previous_count = Count;
+    unsigned left_count = 0, right_count = 0;
+    if (split.Axis >= 0)
+        right_count = Partition(references, count, split, left_count);
+
+    // centers that all fall into one bin, or a split the unsplitting emptied: halve along the widest axis
+    if (!left_count || !right_count)
+    {
+        Count = previous_count;
+        const auto extent = centers.Max - centers.Min;
+        const auto axis = extent.x > extent.y ? (extent.x >= extent.z ? 0 : 2) : extent.y >= extent.z ? 1 : 2;
+        std::copy_n(references, count, Scratch);
+        std::nth_element(
+            Scratch,
+            Scratch + count / 2,
+            Scratch + count,
+            [axis](const Reference &a, const Reference &b) { return a.Box.Center(axis) < b.Box.Center(axis); });
+        left_count = count / 2;
+        right_count = count - left_count;
+        std::copy_n(Scratch + left_count, right_count, Scratch + Limit - right_count);
+    }
+
+    // the right children go to the bottom, the left ones on top of them so they are built first
+    std::copy_n(Scratch + Limit - right_count, right_count, Stack + begin);
+    std::copy_n(Scratch, left_count, Stack + begin + right_count);
+
+    const auto left = Build(begin + right_count, left_count, depth + 1);
+    const auto right = Build(begin, right_count, depth + 1);
+    Nodes[idx] = make_node(bounds.Min, bounds.Max, left, right, 0, 0);
+    return idx;
+}
+
+// old and new place of a node the layout still has to store, popped in the order they are stored
+struct PendingNode
+{
+    std::uint32_t From;
+    std::uint32_t To;
+};
+
+static double milliseconds(const std::chrono::steady_clock::time_point start, const std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static double peak_rss()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_maxrss) * 1024.;
+}
+
+// builds reuse the arena of their thread; one started while this thread helps out inside another gets its own
+pathtracer::BvhBuilder::BvhBuilder(ThreadPool &pool, BuildStats &stats)
+    : m_Pool(pool),
+      m_Stats(stats),
+      m_Arena(thread_arena_busy ? &m_OwnArena.emplace() : &thread_arena),
+      m_Lease(!m_OwnArena)
+{
+    thread_arena_busy = true;
+}
+
+pathtracer::BvhBuilder::~BvhBuilder()
+{
+    if (m_Lease)
+        thread_arena_busy = false;
+}
+
+pathtracer::BvhTree pathtracer::BvhBuilder::Build(std::vector<Triangle> &triangles, const SceneBvh &settings)
+{
+    auto tree = settings.Split == BvhSplit::Spatial
+                    ? BuildSpatial(triangles, std::max(settings.Duplication, 0.f))
+                    : BuildMedian(triangles);
+
+    // every pass reserves the arena again, which drops the scratch of the pass before
+    auto scratch = m_Arena->GetUsed();
+    const auto layout_start = std::chrono::steady_clock::now();
+    if (settings.Layout == BvhLayout::DepthFirst)
+    {
+        LayOut(tree);
+        scratch = std::max(scratch, m_Arena->GetUsed());
+    }
+    SortTriangles(tree, triangles);
+    scratch = std::max(scratch, m_Arena->GetUsed());
+    m_Stats.LayoutMilliseconds += milliseconds(layout_start, std::chrono::steady_clock::now());
+
+    m_Stats.Triangles += triangles.size();
+    m_Stats.References += tree.Indices.size();
+    m_Stats.Nodes += tree.Nodes.size();
+    m_Stats.ScratchBytes = std::max(m_Stats.ScratchBytes, scratch);
+    m_Stats.PeakResidentBytes = std::max(m_Stats.PeakResidentBytes, peak_rss());
+    return tree;
+}
+
+pathtracer::BvhTree pathtracer::BvhBuilder::BuildMedian(const std::vector<Triangle> &triangles)
+{
+    const auto count = static_cast<unsigned>(triangles.size());
+    const auto allocation_start = std::chrono::steady_clock::now();
+
+    // subtrees of PARALLEL_BUILD_TRIANGLES or more are split level by level, a level never holds more of them than
+    // fit into the triangles and each one leaves at most two for the next
+    const auto max_tasks = count / PARALLEL_BUILD_TRIANGLES + 1;
+    m_Arena->Reserve(Arena::Footprint<glm::vec3>(count) * 3 + Arena::Footprint<MedianTask>(2 * max_tasks) * 2);
+    const auto centers = m_Arena->Allocate<glm::vec3>(count);
+    const auto mins = m_Arena->Allocate<glm::vec3>(count);
+    const auto maxs = m_Arena->Allocate<glm::vec3>(count);
+    auto level = m_Arena->Allocate<MedianTask>(2 * max_tasks);
+    auto next = m_Arena->Allocate<MedianTask>(2 * max_tasks);
+
+    // a binary tree over count single triangle leaves, an empty mesh still gets its root; the splits order the
+    // indices in place, so the leaves end up ranging over them
+    BvhTree tree;
+    tree.Nodes.resize(std::max(2 * count, 2u) - 1);
+    tree.Indices.resize(count);
+    const MedianScratch scratch{centers, mins, maxs, tree.Indices.data()};
+
+    const auto build_start = std::chrono::steady_clock::now();
+
+    m_Pool.ParallelFor(
+        0,
+        count,
+        TRIANGLES_PER_TASK,
+        [&](const size_t i)
+        {
+            centers[i] = triangles[i].Center();
+            mins[i] = glm::vec3(std::numeric_limits<float>::infinity());
+            maxs[i] = glm::vec3(-std::numeric_limits<float>::infinity());
+            triangles[i].AddBounds(mins[i], maxs[i]);
+            scratch.Order[i] = static_cast<std::uint32_t>(i);
+        });
+
+    // smaller subtrees are built whole by the task that split them off, so the pool only schedules one pass per
+    // level and every task record lives in the arena
+    const auto nodes = tree.Nodes.data();
+    size_t level_size = 0;
+    level[level_size++] = {0, 0, count, MAX_DEPTH};
+    while (level_size)
+    {
+        m_Pool.ParallelFor(
+            0,
+            level_size,
+            1,
+            [&](const size_t i)
+            {
+                const auto [Index, Start, End, Depth] = level[i];
+                next[2 * i].End = next[2 * i + 1].End = 0;
+
+                unsigned mid;
+                if (End - Start < PARALLEL_BUILD_TRIANGLES)
+                    build_median(scratch, nodes, Index, Start, End, Depth);
+                else if (split_median(scratch, nodes, Index, Start, End, Depth, mid))
+                {
+                    next[2 * i] = {Index + 1, Start, mid, Depth - 1};
+                    next[2 * i + 1] = {Index + 2 * (mid - Start), mid, End, Depth - 1};
+                }
+            });
+
+        size_t next_size = 0;
+        for (size_t i = 0; i < 2 * level_size; ++i)
+            if (next[i].End)
+                next[next_size++] = next[i];
+        std::swap(level, next);
+        level_size = next_size;
+    }
+
+    m_Stats.AllocationMilliseconds += milliseconds(allocation_start, build_start);
+    m_Stats.BuildMilliseconds += milliseconds(build_start, std::chrono::steady_clock::now());
+    return tree;
+}
+
+pathtracer::BvhTree pathtracer::BvhBuilder::BuildSpatial(const std::vector<Triangle> &triangles, const float duplication)
+{
+    const auto count = triangles.size();
+    const auto limit = std::max<size_t>(count + static_cast<size_t>(static_cast<double>(count) * duplication), 1);
+    const auto allocation_start = std::chrono::steady_clock::now();
+
+    m_Arena->Reserve(Arena::Footprint<Reference>(limit) * 2);
+    const auto stack = m_Arena->Allocate<Reference>(limit);
+    const auto scratch = m_Arena->Allocate<Reference>(limit);
+
+    // every leaf holds at least one reference, so there are at most 2 limit - 1 nodes
+    BvhTree tree;
+    tree.Nodes.reserve(2 * limit - 1);
+    tree.Indices.reserve(limit);
+
+    const auto build_start = std::chrono::steady_clock::now();
+
+    Bounds root;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Bounds box;
+        box.Grow(triangles[i].P0);
+        box.Grow(triangles[i].P1);
+        box.Grow(triangles[i].P2);
+        stack[i] = {box, static_cast<std::uint32_t>(i)};
+        root.Grow(box);
+    }
+
+    SpatialBuild build{
+        .Triangles = triangles,
+        .Stack = stack,
+        .Scratch = scratch,
+        .Limit = limit,
+        .Count = count,
+        .RootArea = root.Area(),
+        .Nodes = tree.Nodes,
+        .Indices = tree.Indices,
+    };
+    build.Build(0, static_cast<unsigned>(count), 0);
+
+    m_Stats.AllocationMilliseconds += milliseconds(allocation_start, build_start);
+    m_Stats.BuildMilliseconds += milliseconds(build_start, std::chrono::steady_clock::now());
+    return tree;
+}
+
+// the traversal pops the right child first, so the child with the larger surface, the one a ray is more likely to
+// enter, becomes the right one and follows its parent directly; every subtree stays one run of nodes and indices
+void pathtracer::BvhBuilder::LayOut(BvhTree &tree)
+{
+    const auto count = tree.Nodes.size();
+    m_Arena->Reserve(Arena::Footprint<std::uint32_t>(count) + Arena::Footprint<PendingNode>(count));
+
+    // children come after their parent in both builds, so one backwards pass sees every child first
+    const auto sizes = m_Arena->Allocate<std::uint32_t>(count);
+    for (auto i = count; i-- > 0;)
+    {
+        const auto &node = tree.Nodes[i];
+        sizes[i] = node.Left ? 1 + sizes[node.Left] + sizes[node.Right] : 1;
+    }
+
+    const auto stack = m_Arena->Allocate<PendingNode>(count);
+    std::vector<BVHNode> nodes(sizes[0]);
+    std::vector<std::uint32_t> indices;
+    indices.reserve(tree.Indices.size());
+
+    size_t size = 0;
+    stack[size++] = {0, 0};
+    while (size)
+    {
+        const auto [from, to] = stack[--size];
+        auto node = tree.Nodes[from];
+
+        if (!node.Left)
+        {
+            const auto start = static_cast<unsigned>(indices.size());
+            indices.insert(indices.end(), tree.Indices.begin() + node.Start, tree.Indices.begin() + node.End);
+            node.Start = start;
+            node.End = static_cast<unsigned>(indices.size());
+            nodes[to] = node;
+            continue;
+        }
+
+        auto near = node.Left, far = node.Right;
+        if (Bounds{tree.Nodes[far].Min, tree.Nodes[far].Max}.Area()
+            > Bounds{tree.Nodes[near].Min, tree.Nodes[near].Max}.Area())
+            std::swap(near, far);
+
+        node.Right = to + 1;
+        node.Left = to + 1 + sizes[near];
+        nodes[to] = node;
+
+        stack[size++] = {far, node.Left};
+        stack[size++] = {near, node.Right};
+    }
+
+    tree.Nodes.swap(nodes);
+    tree.Indices.swap(indices);
+}
+
+// triangles move to where a leaf first references them, so a leaf reads one run of them and its neighbours in the
+// tree read the runs next to it; unreferenced triangles keep their relative order at the end
+void pathtracer::BvhBuilder::SortTriangles(BvhTree &tree, std::vector<Triangle> &triangles)
+{
+    const auto count = triangles.size();
+    m_Arena->Reserve(Arena::Footprint<std::uint32_t>(count) * 2);
+    const auto places = m_Arena->Allocate<std::uint32_t>(count);
+    const auto order = m_Arena->Allocate<std::uint32_t>(count);
+    std::fill_n(places, count, UNPLACED);
+
+    std::uint32_t placed = 0;
+    for (auto &index: tree.Indices)
+    {
+        if (places[index] == UNPLACED)
+        {
+            order[placed] = index;
+            places[index] = placed++;
+        }
+        index = places[index];
+    }
+    for (std::uint32_t i = 0; i < count; ++i)
+        if (places[i] == UNPLACED)
+            order[placed++] = i;
+
+    std::vector<Triangle> sorted(count);
+    m_Pool.ParallelFor(0, count, TRIANGLES_PER_TASK, [&](const size_t i) { sorted[i] = triangles[order[i]]; });
+    triangles.swap(sorted);
+}
@@ -0,0 +1,217 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pathtracer/checkpoint.hpp>
+
+static constexpr char MAGIC[4]{'P', 'T', 'C', 'K'};
+static constexpr std::uint32_t VERSION = 2;
+
+// the header as stored, every field in turn without the padding of the struct
+static constexpr size_t HEADER_SIZE = sizeof(pathtracer::CheckpointHeader::Magic) + 5 * sizeof(std::uint32_t)
+                                      + sizeof(std::uint64_t) + sizeof(pathtracer::CheckpointHeader::Camera)
+                                      + sizeof(std::uint32_t);
+
+static size_t image_floats(const pathtracer::CheckpointHeader &header)
+{
+    return static_cast<size_t>(header.Width) * header.Height * 4;
+}
+
+template<typename T>
+static void put(std::string &out, const T &value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+static void get(const char *&in, T &value)
+{
+    std::memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+}
+
+static std::string encode_header(const pathtracer::CheckpointHeader &header)
+{
+    std::string out;
+    put(out, header.Magic);
+    for (const auto value: {header.Version, header.Width, header.Height, header.SampleCount, header.Frame})
+        put(out, value);
+    put(out, header.SceneHash);
+    put(out, header.Camera);
+    put(out, header.SceneLength);
+    return out;
+}
+
+static pathtracer::CheckpointHeader decode_header(const char (&bytes)[HEADER_SIZE])
+{
+    pathtracer::CheckpointHeader header{};
+    const char *in = bytes;
+    get(in, header.Magic);
+    for (const auto value: {&header.Version, &header.Width, &header.Height, &header.SampleCount, &header.Frame})
+        get(in, *value);
+    get(in, header.SceneHash);
+    get(in, header.Camera);
+    get(in, header.SceneLength);
+    return header;
+}
+
+static bool write_all(const int file, const void *data, size_t size)
+{
+    auto bytes = static_cast<const char *>(data);
+    while (size)
+    {
+        const auto written = write(file, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+pathtracer::Checkpoint pathtracer::Checkpoint::Read(const std::filesystem::path &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        throw std::runtime_error("failed to open checkpoint " + path.string());
+
+    char bytes[HEADER_SIZE];
+    Checkpoint checkpoint;
+    auto &header = checkpoint.Header;
+    if (!stream.read(bytes, sizeof(bytes)))
+        throw std::runtime_error(path.string() + " is not a checkpoint");
+
+    header = decode_header(bytes);
+    if (std::memcmp(header.Magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw std::runtime_error(path.string() + " is not a checkpoint");
+    if (header.Version != VERSION)
+        throw std::runtime_error(
+            path.string() + " has version " + std::to_string(header.Version) + ", expected " + std::to_string(VERSION));
+
+    // sizes come from the file, they have to account for exactly the rest of it before anything is allocated
+    std::error_code ec;
+    const auto file_size = std::filesystem::file_size(path, ec);
+    const auto pixels = static_cast<std::uint64_t>(header.Width) * header.Height;
+    const auto pixel_bytes = CHECKPOINT_IMAGES * 4 * sizeof(float);
+    if (ec || file_size < HEADER_SIZE + header.SceneLength
+        || pixels != (file_size - HEADER_SIZE - header.SceneLength) / pixel_bytes
+        || (file_size - HEADER_SIZE - header.SceneLength) % pixel_bytes)
+        throw std::runtime_error("checkpoint " + path.string() + " is truncated or corrupt");
+
+    checkpoint.Scene.resize(header.SceneLength);
+    stream.read(checkpoint.Scene.data(), static_cast<std::streamsize>(checkpoint.Scene.size()));
+
+    for (auto &image: checkpoint.Images)
+    {
+        image.resize(image_floats(header));
+        stream.read(reinterpret_cast<char *>(image.data()), static_cast<std::streamsize>(image.size() * sizeof(float)));
+    }
+
+    if (!stream)
+        throw std::runtime_error("checkpoint " + path.string() + " is truncated");
+    return checkpoint;
+}
+
+void pathtracer::Checkpoint::Write(const std::filesystem::path &path, const float *images) const
+{
+    auto header = Header;
+    std::memcpy(header.Magic, MAGIC, sizeof(MAGIC));
+    header.Version = VERSION;
+    header.SceneLength = static_cast<std::uint32_t>(Scene.size());
+    const auto bytes = encode_header(header);
+
+    auto temporary = path;
+    temporary += ".tmp";
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    const auto file = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0)
+        throw std::runtime_error("failed to create checkpoint " + temporary.string() + ": " + std::strerror(errno));
+
+    const auto written = write_all(file, bytes.data(), bytes.size())
+                         && write_all(file, Scene.data(), Scene.size())
+                         && write_all(file, images, image_floats(header) * CHECKPOINT_IMAGES * sizeof(float))
+                         && fsync(file) == 0;
+    close(file);
+    if (!written)
+        throw std::runtime_error("failed to write checkpoint " + temporary.string());
+
+    // a crash while writing leaves the previous checkpoint intact
+    std::filesystem::rename(temporary, path, ec);
+    if (ec)
+        throw std::runtime_error("failed to replace checkpoint " + path.string() + ": " + ec.message());
+
+    // the rename itself only survives a power loss once the directory is synced
+    if (const auto directory = open(path.parent_path().empty() ? "." : path.parent_path().c_str(), O_RDONLY);
+        directory >= 0)
+    {
+        fsync(directory);
+        close(directory);
+    }
+}
+
+std::filesystem::path pathtracer::Checkpoint::FreshPath(const std::filesystem::path &path)
+{
+    for (unsigned i = 1;; ++i)
+    {
+        auto candidate = path;
+        candidate.replace_filename(path.stem().string() + '-' + std::to_string(i) + path.extension().string());
+
+        std::error_code ec;
+        if (!std::filesystem::exists(candidate, ec) && !ec)
+            return candidate;
+    }
+}
+
+std::string pathtracer::Checkpoint::Mismatch(const int width, const int height, const std::uint64_t scene_hash) const
+{
+    if (static_cast<int>(Header.Width) != width || static_cast<int>(Header.Height) != height)
+        return "Checkpoint is " + std::to_string(Header.Width) + "x" + std::to_string(Header.Height)
+               + ", the framebuffer " + std::to_string(width) + "x" + std::to_string(height);
+    if (Header.SceneHash != scene_hash)
+        return "Checkpoint belongs to a different scene, camera or permutation";
+    return {};
+}
+
+pathtracer::CheckpointWriter::CheckpointWriter(ThreadPool &pool)
+    : m_Readback(pool)
+{
+}
+
+bool pathtracer::CheckpointWriter::Start(
+    const std::filesystem::path &path,
+    const GLuint (&images)[CHECKPOINT_IMAGES],
+    Checkpoint state)
+{
+    return m_Readback.Start(
+        images,
+        image_floats(state.Header) * sizeof(float),
+        [path, state = std::move(state)](const float *pixels) -> std::string
+        {
+            try
+            {
+                state.Write(path, pixels);
+                return {};
+            }
+            catch (const std::exception &error)
+            {
+                return error.what();
+            }
+        });
+}
+
+bool pathtracer::CheckpointWriter::Poll(std::string &error)
+{
+    return m_Readback.Poll(error);
+}
+
+bool pathtracer::CheckpointWriter::IsBusy() const
+{
+    return m_Readback.IsBusy();
+}
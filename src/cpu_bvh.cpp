@@ -0,0 +1,440 @@
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <pathtracer/cpu_bvh.hpp>
+
+#ifdef PATHTRACER_SIMD
+namespace pathtracer::sse42
+{
+    void Intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit);
+    void IntersectPacket(const CpuBvh::View &bvh, const CpuRay *rays, CpuHit *hits, unsigned count);
+}
+
+namespace pathtracer::avx2
+{
+    void Intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit);
+    void IntersectPacket(const CpuBvh::View &bvh, const CpuRay *rays, CpuHit *hits, unsigned count);
+}
+
+namespace pathtracer::avx512
+{
+    void Intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit);
+    void IntersectPacket(const CpuBvh::View &bvh, const CpuRay *rays, CpuHit *hits, unsigned count);
+}
+#endif
+
+// the same threshold as EPSILON in the shaders
+static constexpr float DETERMINANT_EPSILON = 1e-7f;
+static constexpr unsigned SCALAR_STACK_SIZE = 128;
+
+// a common desktop core: 32 KiB of first level and 1 MiB of second level cache in 64 byte lines
+static constexpr size_t CACHE_LINE = 64;
+static constexpr size_t L1_BYTES = 32 << 10;
+static constexpr size_t L1_WAYS = 8;
+static constexpr size_t L2_BYTES = 1 << 20;
+static constexpr size_t L2_WAYS = 16;
+static constexpr std::uintptr_t NO_LINE = ~std::uintptr_t{0};
+
+// set associative with least recently used eviction, every set keeps its lines most recent first
+struct CacheLevel
+{
+    size_t Sets;
+    size_t Ways;
+    std::vector<std::uintptr_t> Lines;
+
+    CacheLevel(const size_t bytes, const size_t ways)
+        : Sets(bytes / CACHE_LINE / ways),
+          Ways(ways),
+          Lines(Sets * Ways, NO_LINE)
+    {
+    }
+
+    bool Access(const std::uintptr_t line)
+    {
+        const auto set = Lines.begin() + static_cast<std::ptrdiff_t>(line % Sets * Ways);
+        auto it = std::find(set, set + static_cast<std::ptrdiff_t>(Ways), line);
+        const auto hit = it != set + static_cast<std::ptrdiff_t>(Ways);
+        if (!hit)
+            it = set + static_cast<std::ptrdiff_t>(Ways - 1);
+
+        std::rotate(set, it, it + 1);
+        *set = line;
+        return hit;
+    }
+};
+
+static float surface_area(const pathtracer::BVHNode &node)
+{
+    const auto x = node.Max.x - node.Min.x;
+    const auto y = node.Max.y - node.Min.y;
+    const auto z = node.Max.z - node.Min.z;
+    return x * y + y * z + z * x;
+}
+
+pathtracer::CpuBvh::CpuBvh(const Scene &scene)
+    : CpuBvh(scene.GetTriangles(), scene.GetTriangleIndices(), scene.GetNodes(), scene.GetModels())
+{
+}
+
+pathtracer::CpuBvh::CpuBvh(
+    const std::vector<Triangle> &triangles,
+    const std::vector<std::uint32_t> &indices,
+    const std::vector<BVHNode> &nodes,
+    const std::vector<Model> &models)
+    : m_Triangles(triangles),
+      m_Indices(indices),
+      m_BinaryNodes(nodes)
+{
+    // children always come after their parent, so one backwards pass sees every child first; either child may
+    // hold the lower run, the layout stores the larger one first
+    m_Ranges.resize(m_BinaryNodes.size());
+    for (auto i = m_BinaryNodes.size(); i-- > 0;)
+    {
+        const auto &node = m_BinaryNodes[i];
+        m_Ranges[i] = node.Left
+                          ? std::pair(
+                              std::min(m_Ranges[node.Left].first, m_Ranges[node.Right].first),
+                              std::max(m_Ranges[node.Left].second, m_Ranges[node.Right].second))
+                          : std::pair(node.Start, node.End);
+    }
+
+    // instances of one mesh share its tree, here as well as on the gpu
+    std::unordered_map<std::uint32_t, std::uint32_t> roots;
+    for (const auto &model: models)
+    {
+        auto [it, inserted] = roots.try_emplace(model.Root, 0);
+        if (inserted)
+            it->second = Collapse(model.Root);
+
+        Instance instance{.BinaryRoot = model.Root, .Root = it->second};
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                instance.ToObject[r][c] = model.InverseTransform[c][r];
+        m_Instances.push_back(instance);
+    }
+}
+
+// the binary node is opened into up to four children by repeatedly splitting the child with the largest surface,
+// subtrees with no more triangles than a block holds become a single leaf
+std::uint32_t pathtracer::CpuBvh::Collapse(const std::uint32_t binary)
+{
+    const auto index = static_cast<std::uint32_t>(m_Nodes.size());
+    m_Nodes.emplace_back();
+
+    const auto is_leaf = [this](const std::uint32_t i)
+    {
+        return !m_BinaryNodes[i].Left || m_Ranges[i].second - m_Ranges[i].first <= TRIANGLE_WIDTH;
+    };
+
+    std::uint32_t children[NODE_WIDTH]{binary};
+    unsigned count = 1;
+    while (count < NODE_WIDTH)
+    {
+        auto best = -1;
+        for (unsigned i = 0; i < count; ++i)
+            if (!is_leaf(children[i])
+                && (best < 0 || surface_area(m_BinaryNodes[children[i]]) > surface_area(m_BinaryNodes[children[best]])))
+                best = static_cast<int>(i);
+        if (best < 0)
+            break;
+
+        const auto &node = m_BinaryNodes[children[best]];
+        children[best] = node.Left;
+        children[count++] = node.Right;
+    }
+
+    Node node{};
+    for (unsigned i = 0; i < NODE_WIDTH; ++i)
+    {
+        if (i >= count)
+        {
+            node.MinX[i] = node.MinY[i] = node.MinZ[i] = std::numeric_limits<float>::infinity();
+            node.MaxX[i] = node.MaxY[i] = node.MaxZ[i] = -std::numeric_limits<float>::infinity();
+            node.Child[i] = EMPTY;
+            continue;
+        }
+
+        const auto &child = m_BinaryNodes[children[i]];
+        node.MinX[i] = child.Min.x;
+        node.MinY[i] = child.Min.y;
+        node.MinZ[i] = child.Min.z;
+        node.MaxX[i] = child.Max.x;
+        node.MaxY[i] = child.Max.y;
+        node.MaxZ[i] = child.Max.z;
+
+        if (is_leaf(children[i]))
+        {
+            const auto [start, end] = m_Ranges[children[i]];
+            node.Child[i] = AddBlocks(start, end);
+            node.Count[i] = (end - start + TRIANGLE_WIDTH - 1) / TRIANGLE_WIDTH;
+        }
+        else
+        {
+            node.Child[i] = Collapse(children[i]);
+        }
+    }
+
+    m_Nodes[index] = node;
+    return index;
+}
+
+std::uint32_t pathtracer::CpuBvh::AddBlocks(const std::uint32_t start, const std::uint32_t end)
+{
+    const auto first = static_cast<std::uint32_t>(m_Blocks.size());
+    for (auto i = start; i < end; i += TRIANGLE_WIDTH)
+    {
+        auto &block = m_Blocks.emplace_back();
+        std::fill_n(block.Index, TRIANGLE_WIDTH, EMPTY);
+
+        for (unsigned lane = 0; lane < TRIANGLE_WIDTH && i + lane < end; ++lane)
+        {
+            const auto index = m_Indices[i + lane];
+            const auto &triangle = m_Triangles[index];
+            block.P0X[lane] = triangle.P0.x;
+            block.P0Y[lane] = triangle.P0.y;
+            block.P0Z[lane] = triangle.P0.z;
+            block.E1X[lane] = triangle.P1.x - triangle.P0.x;
+            block.E1Y[lane] = triangle.P1.y - triangle.P0.y;
+            block.E1Z[lane] = triangle.P1.z - triangle.P0.z;
+            block.E2X[lane] = triangle.P2.x - triangle.P0.x;
+            block.E2Y[lane] = triangle.P2.y - triangle.P0.y;
+            block.E2Z[lane] = triangle.P2.z - triangle.P0.z;
+            block.Index[lane] = index;
+        }
+    }
+    return first;
+}
+
+pathtracer::SimdLevel pathtracer::CpuBvh::Detect()
+{
+#ifdef PATHTRACER_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl"))
+        return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdLevel::Avx2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SimdLevel::Sse42;
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char *pathtracer::CpuBvh::Name(const SimdLevel level)
+{
+    switch (level)
+    {
+        case SimdLevel::Sse42:
+            return "SSE4.2";
+        case SimdLevel::Avx2:
+            return "AVX2";
+        case SimdLevel::Avx512:
+            return "AVX-512";
+        default:
+            return "scalar";
+    }
+}
+
+unsigned pathtracer::CpuBvh::PacketSize(const SimdLevel level)
+{
+    switch (level)
+    {
+        case SimdLevel::Sse42:
+            return 4;
+        case SimdLevel::Avx2:
+            return 8;
+        case SimdLevel::Avx512:
+            return 16;
+        default:
+            return 1;
+    }
+}
+
+void pathtracer::CpuBvh::Intersect(const CpuRay &ray, CpuHit &hit, const SimdLevel level) const
+{
+#ifdef PATHTRACER_SIMD
+    switch (level)
+    {
+        case SimdLevel::Sse42:
+            return sse42::Intersect(GetView(), ray, hit);
+        case SimdLevel::Avx2:
+            return avx2::Intersect(GetView(), ray, hit);
+        case SimdLevel::Avx512:
+            return avx512::Intersect(GetView(), ray, hit);
+        default:
+            break;
+    }
+#endif
+    IntersectScalar(ray, hit, [](const void *, size_t) {});
+}
+
+void pathtracer::CpuBvh::IntersectPacket(
+    const CpuRay *rays,
+    CpuHit *hits,
+    const unsigned count,
+    const SimdLevel level) const
+{
+    const auto size = PacketSize(level);
+    [[maybe_unused]] const auto view = GetView();
+    for (unsigned first = 0; first < count; first += size)
+    {
+        [[maybe_unused]] const auto n = std::min(size, count - first);
+#ifdef PATHTRACER_SIMD
+        switch (level)
+        {
+            case SimdLevel::Sse42:
+                sse42::IntersectPacket(view, rays + first, hits + first, n);
+                continue;
+            case SimdLevel::Avx2:
+                avx2::IntersectPacket(view, rays + first, hits + first, n);
+                continue;
+            case SimdLevel::Avx512:
+                avx512::IntersectPacket(view, rays + first, hits + first, n);
+                continue;
+            default:
+                break;
+        }
+#endif
+        IntersectScalar(rays[first], hits[first], [](const void *, size_t) {});
+    }
+}
+
+pathtracer::CpuBvh::CacheStats pathtracer::CpuBvh::MeasureCache(const std::vector<CpuRay> &rays) const
+{
+    CacheLevel l1(L1_BYTES, L1_WAYS), l2(L2_BYTES, L2_WAYS);
+    CacheStats stats{.Rays = rays.size()};
+
+    // the second level is only asked for what the first one missed
+    const auto touch = [&](const void *address, const size_t bytes)
+    {
+        const auto first = reinterpret_cast<std::uintptr_t>(address) / CACHE_LINE;
+        const auto last = (reinterpret_cast<std::uintptr_t>(address) + bytes - 1) / CACHE_LINE;
+        for (auto line = first; line <= last; ++line)
+        {
+            ++stats.Lines;
+            if (l1.Access(line))
+                continue;
+            ++stats.L1Misses;
+            if (!l2.Access(line))
+                ++stats.L2Misses;
+        }
+    };
+
+    for (const auto &ray: rays)
+    {
+        CpuHit hit;
+        IntersectScalar(ray, hit, touch);
+    }
+    return stats;
+}
+
+// models_hit and Triangle_Hit one box and one triangle at a time, the baseline the wide kernels are measured against
+template<typename F>
+void pathtracer::CpuBvh::IntersectScalar(const CpuRay &ray, CpuHit &hit, const F &touch) const
+{
+    auto t_max = ray.TMax;
+    for (std::uint32_t model = 0; model < m_Instances.size(); ++model)
+    {
+        const auto &instance = m_Instances[model];
+        const auto &m = instance.ToObject;
+
+        float o[3], d[3];
+        for (int r = 0; r < 3; ++r)
+        {
+            o[r] = m[r][0] * ray.Origin.x + m[r][1] * ray.Origin.y + m[r][2] * ray.Origin.z + m[r][3];
+            d[r] = m[r][0] * ray.Direction.x + m[r][1] * ray.Direction.y + m[r][2] * ray.Direction.z;
+        }
+
+        std::uint32_t stack[SCALAR_STACK_SIZE];
+        unsigned size = 0;
+        stack[size++] = instance.BinaryRoot;
+
+        while (size)
+        {
+            const auto &node = m_BinaryNodes[stack[--size]];
+            touch(&node, sizeof(node));
+
+            auto near = ray.TMin, far = t_max;
+            for (int a = 0; a < 3 && near < far; ++a)
+            {
+                const auto inverse = 1.f / d[a];
+                auto t0 = (node.Min[a] - o[a]) * inverse;
+                auto t1 = (node.Max[a] - o[a]) * inverse;
+                if (t0 >= t1)
+                    std::swap(t0, t1);
+                near = std::max(near, t0);
+                far = std::min(far, t1);
+            }
+            if (far <= near)
+                continue;
+
+            if (node.Left)
+            {
+                if (size + 2 <= SCALAR_STACK_SIZE)
+                {
+                    stack[size++] = node.Left;
+                    stack[size++] = node.Right;
+                }
+                continue;
+            }
+
+            for (auto i = node.Start; i < node.End; ++i)
+            {
+                const auto index = m_Indices[i];
+                const auto &triangle = m_Triangles[index];
+                touch(&m_Indices[i], sizeof(index));
+                touch(&triangle, offsetof(Triangle, N0));
+                const float p0[3]{triangle.P0.x, triangle.P0.y, triangle.P0.z};
+                const float e1[3]{triangle.P1.x - p0[0], triangle.P1.y - p0[1], triangle.P1.z - p0[2]};
+                const float e2[3]{triangle.P2.x - p0[0], triangle.P2.y - p0[1], triangle.P2.z - p0[2]};
+
+                const float p[3]{d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+                const auto det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+                if (std::abs(det) < DETERMINANT_EPSILON)
+                    continue;
+
+                const auto inv_det = 1.f / det;
+                const float s[3]{o[0] - p0[0], o[1] - p0[1], o[2] - p0[2]};
+                const auto u = inv_det * (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]);
+                if (u < 0.f || u > 1.f)
+                    continue;
+
+                const float q[3]{s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0]};
+                const auto v = inv_det * (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]);
+                if (v < 0.f || u + v > 1.f)
+                    continue;
+
+                const auto t = inv_det * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+                if (t <= ray.TMin || t >= t_max)
+                    continue;
+
+                t_max = t;
+                hit = {t, index, model, u, v};
+            }
+        }
+    }
+}
+
+const std::vector<pathtracer::CpuBvh::Node> &pathtracer::CpuBvh::GetNodes() const
+{
+    return m_Nodes;
+}
+
+const std::vector<pathtracer::CpuBvh::TriangleBlock> &pathtracer::CpuBvh::GetBlocks() const
+{
+    return m_Blocks;
+}
+
+const std::vector<pathtracer::CpuBvh::Instance> &pathtracer::CpuBvh::GetInstances() const
+{
+    return m_Instances;
+}
+
+pathtracer::CpuBvh::View pathtracer::CpuBvh::GetView() const
+{
+    return {
+        .Nodes = m_Nodes.data(),
+        .Blocks = m_Blocks.data(),
+        .Instances = m_Instances.data(),
+        .InstanceCount = static_cast<std::uint32_t>(m_Instances.size()),
+    };
+}
@@ -0,0 +1,20 @@
+#ifdef PATHTRACER_SIMD
+
+#define PATHTRACER_ISA avx2
+#include <pathtracer/cpu_bvh_kernel.hpp>
+
+void pathtracer::avx2::Intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit)
+{
+    intersect<Float8>(bvh, ray, hit);
+}
+
+void pathtracer::avx2::IntersectPacket(
+    const CpuBvh::View &bvh,
+    const CpuRay *rays,
+    CpuHit *hits,
+    const unsigned count)
+{
+    intersect_packet<Float8>(bvh, rays, hits, count);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifdef PATHTRACER_SIMD
+
+#define PATHTRACER_ISA avx512
+#include <pathtracer/cpu_bvh_kernel.hpp>
+
+// a block holds eight triangles, the full width only pays off with sixteen rays per packet
+void pathtracer::avx512::Intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit)
+{
+    intersect<Float8>(bvh, ray, hit);
+}
+
+void pathtracer::avx512::IntersectPacket(
+    const CpuBvh::View &bvh,
+    const CpuRay *rays,
+    CpuHit *hits,
+    const unsigned count)
+{
+    intersect_packet<Float16>(bvh, rays, hits, count);
+}
+
+#endif
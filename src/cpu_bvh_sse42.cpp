@@ -0,0 +1,20 @@
+#ifdef PATHTRACER_SIMD
+
+#define PATHTRACER_ISA sse42
+#include <pathtracer/cpu_bvh_kernel.hpp>
+
+void pathtracer::sse42::Intersect(const CpuBvh::View &bvh, const CpuRay &ray, CpuHit &hit)
+{
+    intersect<Float4>(bvh, ray, hit);
+}
+
+void pathtracer::sse42::IntersectPacket(
+    const CpuBvh::View &bvh,
+    const CpuRay *rays,
+    CpuHit *hits,
+    const unsigned count)
+{
+    intersect_packet<Float4>(bvh, rays, hits, count);
+}
+
+#endif
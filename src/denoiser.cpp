@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cmath>
+#include <pathtracer/denoiser.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define PATHTRACER_SSE
+#include <emmintrin.h>
+#endif
+
+static constexpr int ROWS_PER_TASK = 16;
+static constexpr float KERNEL[5]{1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f};
+static constexpr float ALBEDO_EPSILON = 1e-3f;
+static constexpr float DEPTH_EPSILON = 1e-3f;
+
+// plane offsets in the scratch image, color is filtered back and forth between the first two
+static constexpr int COLOR = 0;
+static constexpr int SWAP = 3;
+static constexpr int ALBEDO = 6;
+static constexpr int NORMAL = 9;
+static constexpr int DEPTH = 12;
+static constexpr int PLANE_COUNT = 13;
+
+struct FilterPass
+{
+    int Width;
+    int Height;
+    int Step;
+    float InvColor;
+    float InvNormal;
+    float InvDepth;
+    const float *Source[3];
+    float *Target[3];
+    const float *Normal[3];
+    const float *Depth;
+};
+
+static void filter_pixel(const FilterPass &pass, const int x, const int y)
+{
+    const auto p = static_cast<size_t>(y) * pass.Width + x;
+    const float color[3]{pass.Source[0][p], pass.Source[1][p], pass.Source[2][p]};
+    const float normal[3]{pass.Normal[0][p], pass.Normal[1][p], pass.Normal[2][p]};
+    const auto depth = pass.Depth[p];
+    const auto inv_depth = pass.InvDepth / std::max(depth, DEPTH_EPSILON);
+
+    float sum[3]{};
+    auto weight_sum = 0.f;
+    for (int j = 0; j < 5; ++j)
+    {
+        const auto row = static_cast<size_t>(std::clamp(y + (j - 2) * pass.Step, 0, pass.Height - 1)) * pass.Width;
+        for (int i = 0; i < 5; ++i)
+        {
+            const auto q = row + std::clamp(x + (i - 2) * pass.Step, 0, pass.Width - 1);
+
+            auto dc = 0.f;
+            auto dn = 0.f;
+            for (int c = 0; c < 3; ++c)
+            {
+                const auto color_delta = pass.Source[c][q] - color[c];
+                const auto normal_delta = pass.Normal[c][q] - normal[c];
+                dc += color_delta * color_delta;
+                dn += normal_delta * normal_delta;
+            }
+            const auto dz = std::abs(pass.Depth[q] - depth);
+
+            const auto weight = KERNEL[i] * KERNEL[j]
+                                * std::exp(-(dc * pass.InvColor + dn * pass.InvNormal + dz * inv_depth));
+            for (int c = 0; c < 3; ++c)
+                sum[c] += pass.Source[c][q] * weight;
+            weight_sum += weight;
+        }
+    }
+
+    for (int c = 0; c < 3; ++c)
+        pass.Target[c][p] = sum[c] / weight_sum;
+}
+
+#ifdef PATHTRACER_SSE
+
+// e^x as 2^(x log2 e), the fraction from a degree 5 polynomial; about 2e-4 relative error on [-87, 0]
+static __m128 exp_ps(__m128 x)
+{
+    x = _mm_max_ps(x, _mm_set1_ps(-87.f));
+    const auto t = _mm_mul_ps(x, _mm_set1_ps(1.44269504f));
+
+    auto whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+    whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, t), _mm_set1_ps(1.f)));
+    const auto f = _mm_sub_ps(t, whole);
+
+    auto p = _mm_set1_ps(1.3333558e-3f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.6181291e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5504109e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4022651e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9314718e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.f));
+
+    const auto exponent = _mm_add_epi32(_mm_cvtps_epi32(whole), _mm_set1_epi32(127));
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(exponent, 23)));
+}
+
+// four neighbouring pixels whose taps all lie inside the row, so no tap needs clamping horizontally
+static void filter_block(const FilterPass &pass, const int x, const int y)
+{
+    const auto p = static_cast<size_t>(y) * pass.Width + x;
+
+    __m128 color[3], normal[3], sum[3];
+    for (int c = 0; c < 3; ++c)
+    {
+        color[c] = _mm_loadu_ps(pass.Source[c] + p);
+        normal[c] = _mm_loadu_ps(pass.Normal[c] + p);
+        sum[c] = _mm_setzero_ps();
+    }
+    const auto depth = _mm_loadu_ps(pass.Depth + p);
+
+    const auto inv_color = _mm_set1_ps(pass.InvColor);
+    const auto inv_normal = _mm_set1_ps(pass.InvNormal);
+    const auto inv_depth = _mm_div_ps(_mm_set1_ps(pass.InvDepth), _mm_max_ps(depth, _mm_set1_ps(DEPTH_EPSILON)));
+    const auto abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    auto weight_sum = _mm_setzero_ps();
+    for (int j = 0; j < 5; ++j)
+    {
+        const auto row = static_cast<size_t>(std::clamp(y + (j - 2) * pass.Step, 0, pass.Height - 1)) * pass.Width;
+        for (int i = 0; i < 5; ++i)
+        {
+            const auto q = row + static_cast<size_t>(x + (i - 2) * pass.Step);
+
+            __m128 tap[3];
+            auto dc = _mm_setzero_ps();
+            auto dn = _mm_setzero_ps();
+            for (int c = 0; c < 3; ++c)
+            {
+                tap[c] = _mm_loadu_ps(pass.Source[c] + q);
+                const auto color_delta = _mm_sub_ps(tap[c], color[c]);
+                const auto normal_delta = _mm_sub_ps(_mm_loadu_ps(pass.Normal[c] + q), normal[c]);
+                dc = _mm_add_ps(dc, _mm_mul_ps(color_delta, color_delta));
+                dn = _mm_add_ps(dn, _mm_mul_ps(normal_delta, normal_delta));
+            }
+            const auto dz = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(pass.Depth + q), depth), abs_mask);
+
+            const auto exponent = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(dc, inv_color), _mm_mul_ps(dn, inv_normal)),
+                _mm_mul_ps(dz, inv_depth));
+            const auto weight = _mm_mul_ps(
+                _mm_set1_ps(KERNEL[i] * KERNEL[j]),
+                exp_ps(_mm_sub_ps(_mm_setzero_ps(), exponent)));
+
+            for (int c = 0; c < 3; ++c)
+                sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(tap[c], weight));
+            weight_sum = _mm_add_ps(weight_sum, weight);
+        }
+    }
+
+    for (int c = 0; c < 3; ++c)
+        _mm_storeu_ps(pass.Target[c] + p, _mm_div_ps(sum[c], weight_sum));
+}
+
+#endif
+
+static void filter_row(const FilterPass &pass, const int y)
+{
+    auto x = 0;
+#ifdef PATHTRACER_SSE
+    const auto margin = 2 * pass.Step;
+    for (; x < std::min(margin, pass.Width); ++x)
+        filter_pixel(pass, x, y);
+    for (; x + 4 + margin <= pass.Width; x += 4)
+        filter_block(pass, x, y);
+#endif
+    for (; x < pass.Width; ++x)
+        filter_pixel(pass, x, y);
+}
+
+pathtracer::Denoiser::Denoiser(ThreadPool &pool)
+    : m_Pool(pool)
+{
+}
+
+pathtracer::Denoiser::~Denoiser()
+{
+    if (m_Job.valid())
+        m_Job.wait();
+}
+
+void pathtracer::Denoiser::Start(std::shared_ptr<DenoiseImage> image, const DenoiseSettings &settings)
+{
+    if (m_Job.valid())
+        return;
+
+    m_Job = m_Pool.Submit(
+        [&pool = m_Pool, image = std::move(image), settings]
+        {
+            Run(pool, *image, settings);
+            return image;
+        });
+}
+
+bool pathtracer::Denoiser::Poll(std::shared_ptr<DenoiseImage> &image)
+{
+    if (!m_Job.valid() || m_Job.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    image = m_Job.get();
+    return true;
+}
+
+bool pathtracer::Denoiser::IsBusy() const
+{
+    return m_Job.valid();
+}
+
+void pathtracer::Denoiser::Run(ThreadPool &pool, DenoiseImage &image, const DenoiseSettings &settings)
+{
+    const auto width = image.Width;
+    const auto height = image.Height;
+    const auto size = static_cast<size_t>(width) * height;
+
+    std::vector<float> planes(size * PLANE_COUNT);
+    const auto plane = [&planes, size](const int index) { return planes.data() + index * size; };
+
+    // sums become means, and the albedo is divided out so texture detail never gets blurred
+    pool.ParallelFor(
+        0,
+        height,
+        ROWS_PER_TASK,
+        [&](const int y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const auto p = static_cast<size_t>(y) * width + x;
+                const auto n = std::max(image.Accumulation[p * 4 + 3], 1.f);
+
+                auto length = 0.f;
+                for (int c = 0; c < 3; ++c)
+                    length += image.NormalDepth[p * 4 + c] * image.NormalDepth[p * 4 + c];
+                length = std::sqrt(length);
+
+                for (int c = 0; c < 3; ++c)
+                {
+                    const auto albedo = image.Albedo[p * 4 + c] / n + ALBEDO_EPSILON;
+                    plane(ALBEDO + c)[p] = albedo;
+                    plane(COLOR + c)[p] = image.Accumulation[p * 4 + c] / n / albedo;
+                    plane(NORMAL + c)[p] = length > 0.f ? image.NormalDepth[p * 4 + c] / length : 0.f;
+                }
+                plane(DEPTH)[p] = image.NormalDepth[p * 4 + 3] / n;
+            }
+        });
+
+    auto source = COLOR;
+    auto target = SWAP;
+    auto color_phi = std::max(settings.ColorPhi, 1e-6f);
+    for (int level = 0; level < settings.Passes; ++level)
+    {
+        const auto step = 1 << level;
+        const FilterPass pass{
+            width,
+            height,
+            step,
+            1.f / color_phi,
+            1.f / (std::max(settings.NormalPhi, 1e-6f) * static_cast<float>(step * step)),
+            1.f / (std::max(settings.DepthPhi, 1e-6f) * static_cast<float>(step)),
+            {plane(source), plane(source + 1), plane(source + 2)},
+            {plane(target), plane(target + 1), plane(target + 2)},
+            {plane(NORMAL), plane(NORMAL + 1), plane(NORMAL + 2)},
+            plane(DEPTH),
+        };
+        pool.ParallelFor(0, height, ROWS_PER_TASK, [&pass](const int y) { filter_row(pass, y); });
+
+        std::swap(source, target);
+        color_phi *= .5f;
+    }
+
+    image.Result.resize(size * 4);
+    pool.ParallelFor(
+        0,
+        height,
+        ROWS_PER_TASK,
+        [&](const int y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const auto p = static_cast<size_t>(y) * width + x;
+                for (int c = 0; c < 3; ++c)
+                    image.Result[p * 4 + c] = plane(source + c)[p] * plane(ALBEDO + c)[p];
+                image.Result[p * 4 + 3] = 1.f;
+            }
+        });
+}
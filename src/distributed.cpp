@@ -0,0 +1,455 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <pathtracer/distributed.hpp>
+
+// workers and coordinator share the byte order of the machines this is meant for
+static_assert(std::endian::native == std::endian::little);
+
+static std::runtime_error socket_error(const std::string &what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+template<typename T>
+static void put(std::vector<unsigned char> &out, const T &value)
+{
+    const auto bytes = reinterpret_cast<const unsigned char *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+static T get(const std::vector<unsigned char> &in, size_t &offset)
+{
+    if (offset + sizeof(T) > in.size())
+        throw std::runtime_error("truncated message");
+
+    T value;
+    std::memcpy(&value, in.data() + offset, sizeof(T));
+    offset += sizeof(T);
+    return value;
+}
+
+static bool send_all(const int socket, const void *data, size_t size)
+{
+    auto bytes = static_cast<const char *>(data);
+    while (size)
+    {
+        const auto sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+static bool receive_all(const int socket, void *data, size_t size)
+{
+    auto bytes = static_cast<char *>(data);
+    while (size)
+    {
+        const auto received = recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+pathtracer::Connection::Connection(const int socket)
+    : m_Socket(socket)
+{
+}
+
+pathtracer::Connection::~Connection()
+{
+    if (m_Socket >= 0)
+        close(m_Socket);
+}
+
+pathtracer::Connection::Connection(Connection &&other) noexcept
+    : m_Socket(other.m_Socket)
+{
+    other.m_Socket = -1;
+}
+
+pathtracer::Connection &pathtracer::Connection::operator=(Connection &&other) noexcept
+{
+    std::swap(m_Socket, other.m_Socket);
+    return *this;
+}
+
+pathtracer::Connection pathtracer::Connection::Connect(const std::string &address)
+{
+    const auto colon = address.rfind(':');
+    if (colon == std::string::npos)
+        throw std::runtime_error("expected <host>:<port>, got " + address);
+
+    const auto host = address.substr(0, colon);
+    const auto port = address.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *addresses = nullptr;
+    if (const auto error = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses))
+        throw std::runtime_error("failed to resolve " + address + ": " + gai_strerror(error));
+
+    auto socket = -1;
+    for (auto it = addresses; it && socket < 0; it = it->ai_next)
+    {
+        socket = ::socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (socket >= 0 && connect(socket, it->ai_addr, it->ai_addrlen) != 0)
+        {
+            close(socket);
+            socket = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (socket < 0)
+        throw socket_error("failed to connect to " + address);
+
+    // messages are written in one piece, there is nothing to coalesce
+    constexpr int no_delay = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    return Connection(socket);
+}
+
+// type and payload size, then the payload
+void pathtracer::Connection::Send(const Message &message) const
+{
+    std::vector<unsigned char> payload;
+    if (const auto job = std::get_if<RenderJob>(&message))
+    {
+        for (const auto value: {job->Id, static_cast<std::uint32_t>(job->X), static_cast<std::uint32_t>(job->Y)})
+            put(payload, value);
+        for (const auto value: {static_cast<std::uint32_t>(job->Width), static_cast<std::uint32_t>(job->Height)})
+            put(payload, value);
+        for (const auto value: {job->FirstSample, job->Samples, job->ImageWidth, job->ImageHeight})
+            put(payload, value);
+        put(payload, static_cast<std::uint32_t>(job->Scene.size()));
+        payload.insert(payload.end(), job->Scene.begin(), job->Scene.end());
+    }
+    else if (const auto result = std::get_if<RenderResult>(&message))
+    {
+        put(payload, result->Id);
+        const auto bytes = reinterpret_cast<const unsigned char *>(result->Pixels.data());
+        payload.insert(payload.end(), bytes, bytes + result->Pixels.size() * sizeof(float));
+    }
+
+    std::vector<unsigned char> header;
+    put(header, static_cast<std::uint32_t>(message.index()));
+    put(header, static_cast<std::uint64_t>(payload.size()));
+
+    if (!send_all(m_Socket, header.data(), header.size()) || !send_all(m_Socket, payload.data(), payload.size()))
+        throw socket_error("failed to send message");
+}
+
+bool pathtracer::Connection::Receive(Message &message, const std::uint64_t limit) const
+{
+    std::vector<unsigned char> header(sizeof(std::uint32_t) + sizeof(std::uint64_t));
+    if (!receive_all(m_Socket, header.data(), header.size()))
+        return false;
+
+    size_t offset = 0;
+    const auto type = get<std::uint32_t>(header, offset);
+    const auto size = get<std::uint64_t>(header, offset);
+    if (size > limit)
+        throw std::runtime_error(
+            "message of " + std::to_string(size) + " bytes, expected at most " + std::to_string(limit));
+
+    std::vector<unsigned char> payload(size);
+    if (!receive_all(m_Socket, payload.data(), payload.size()))
+        return false;
+
+    offset = 0;
+    switch (type)
+    {
+        case 0:
+            message = RenderDone{};
+            return true;
+        case 1:
+        {
+            RenderJob job;
+            job.Id = get<std::uint32_t>(payload, offset);
+            job.X = static_cast<std::int32_t>(get<std::uint32_t>(payload, offset));
+            job.Y = static_cast<std::int32_t>(get<std::uint32_t>(payload, offset));
+            job.Width = static_cast<std::int32_t>(get<std::uint32_t>(payload, offset));
+            job.Height = static_cast<std::int32_t>(get<std::uint32_t>(payload, offset));
+            job.FirstSample = get<std::uint32_t>(payload, offset);
+            job.Samples = get<std::uint32_t>(payload, offset);
+            job.ImageWidth = get<std::uint32_t>(payload, offset);
+            job.ImageHeight = get<std::uint32_t>(payload, offset);
+            const auto length = get<std::uint32_t>(payload, offset);
+            if (offset + length > payload.size())
+                throw std::runtime_error("truncated message");
+            job.Scene.assign(reinterpret_cast<const char *>(payload.data() + offset), length);
+            message = std::move(job);
+            return true;
+        }
+        case 2:
+        {
+            RenderResult result;
+            result.Id = get<std::uint32_t>(payload, offset);
+            result.Pixels.resize((payload.size() - offset) / sizeof(float));
+            std::memcpy(result.Pixels.data(), payload.data() + offset, result.Pixels.size() * sizeof(float));
+            message = std::move(result);
+            return true;
+        }
+        default:
+            throw std::runtime_error("unknown message type " + std::to_string(type));
+    }
+}
+
+int pathtracer::Connection::Handle() const
+{
+    return m_Socket;
+}
+
+pathtracer::Coordinator::Coordinator(const Options &options)
+    : m_Options(options)
+{
+    m_Output.Format = ImageExporter::FormatOf(m_Options.Output);
+    m_Output.Path = m_Options.Output;
+    m_Output.Path.replace_extension();
+
+    // workers may start elsewhere, the scene path has to be valid for every one of them
+    const auto scene = weakly_canonical(m_Options.Scene).string();
+    for (int y = 0; y < m_Options.Height; y += m_Options.Tile)
+        for (int x = 0; x < m_Options.Width; x += m_Options.Tile)
+            for (unsigned first = 0; first < m_Options.Samples; first += m_Options.Chunk)
+            {
+                Work work;
+                work.Job = {
+                    .Id = static_cast<std::uint32_t>(m_Work.size()),
+                    .X = x,
+                    .Y = y,
+                    .Width = std::min(m_Options.Tile, m_Options.Width - x),
+                    .Height = std::min(m_Options.Tile, m_Options.Height - y),
+                    .FirstSample = first,
+                    .Samples = std::min(m_Options.Chunk, m_Options.Samples - first),
+                    .ImageWidth = static_cast<std::uint32_t>(m_Options.Width),
+                    .ImageHeight = static_cast<std::uint32_t>(m_Options.Height),
+                    .Scene = scene,
+                };
+                m_Work.push_back(std::move(work));
+            }
+
+    m_Image.assign(static_cast<size_t>(m_Options.Width) * m_Options.Height * 4, 0.f);
+
+    m_Listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_Listener < 0)
+        throw socket_error("failed to create socket");
+
+    constexpr int reuse = 1;
+    setsockopt(m_Listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(m_Options.Port);
+    if (bind(m_Listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0
+        || listen(m_Listener, SOMAXCONN) != 0)
+    {
+        close(m_Listener);
+        throw socket_error("failed to listen on port " + std::to_string(m_Options.Port));
+    }
+}
+
+pathtracer::Coordinator::~Coordinator()
+{
+    if (m_Listener >= 0)
+        close(m_Listener);
+}
+
+void pathtracer::Coordinator::Run()
+{
+    std::cout << "listening on port " << m_Options.Port << ", " << m_Work.size() << " jobs" << std::endl;
+
+    // a result is the id and the rgba floats of at most one full tile
+    const auto tile = static_cast<std::uint64_t>(m_Options.Tile);
+    const auto limit = sizeof(std::uint32_t) + tile * tile * 4 * sizeof(float);
+
+    const auto start = std::chrono::steady_clock::now();
+    while (m_Finished < m_Work.size())
+    {
+        std::vector<pollfd> descriptors{{m_Listener, POLLIN, 0}};
+        for (const auto &worker: m_Workers)
+            descriptors.push_back({worker.Link.Handle(), POLLIN, 0});
+
+        if (poll(descriptors.data(), descriptors.size(), 100) < 0 && errno != EINTR)
+            throw socket_error("failed to poll");
+
+        if (descriptors[0].revents & POLLIN)
+            if (const auto socket = accept(m_Listener, nullptr, nullptr); socket >= 0)
+            {
+                // poll only says the first bytes are there, the rest of the message may never follow
+                timeval timeout{.tv_sec = RECEIVE_TIMEOUT.count(), .tv_usec = 0};
+                setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+                m_Workers.push_back({.Link = Connection(socket), .Current = -1, .Sent = {}});
+                std::cout << "worker connected, " << m_Workers.size() << " in total" << std::endl;
+            }
+
+        // whatever a lost worker had is handed out again, unless another copy already came back
+        const auto drop = [this](const size_t i, const std::string &reason)
+        {
+            if (const auto current = m_Workers[i].Current; current >= 0 && !m_Work[current].Done)
+                --m_Work[current].Issued;
+            m_Workers.erase(m_Workers.begin() + static_cast<std::ptrdiff_t>(i));
+            std::cout << "worker lost (" << reason << "), " << m_Workers.size() << " left" << std::endl;
+        };
+
+        for (auto i = descriptors.size() - 1; i > 0; --i)
+        {
+            if (!descriptors[i].revents)
+                continue;
+
+            // one misbehaving worker must not take the others down with it
+            auto &worker = m_Workers[i - 1];
+            Message message;
+            try
+            {
+                if (!worker.Link.Receive(message, limit))
+                {
+                    drop(i - 1, "disconnected or stalled");
+                    continue;
+                }
+            }
+            catch (const std::exception &e)
+            {
+                drop(i - 1, e.what());
+                continue;
+            }
+
+            const auto result = std::get_if<RenderResult>(&message);
+            if (!result || result->Id != static_cast<std::uint32_t>(worker.Current))
+            {
+                drop(i - 1, "unexpected message");
+                continue;
+            }
+
+            Merge(*result, worker.Sent);
+            worker.Current = -1;
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::duration deadline = MIN_DEADLINE;
+        if (const auto finished = static_cast<std::chrono::steady_clock::rep>(m_Finished))
+            deadline = std::max(deadline, DEADLINE_JOBS * m_WorkTime / finished);
+        for (auto i = m_Workers.size(); i-- > 0;)
+            if (m_Workers[i].Current >= 0 && now - m_Workers[i].Sent > deadline)
+                drop(i, "job timed out");
+
+        for (size_t i = 0; i < m_Workers.size();)
+        {
+            auto &worker = m_Workers[i];
+            const auto next = worker.Current < 0 ? NextWork() : -1;
+            if (next < 0)
+            {
+                ++i;
+                continue;
+            }
+
+            try
+            {
+                worker.Link.Send(m_Work[next].Job);
+            }
+            catch (const std::exception &e)
+            {
+                drop(i, e.what());
+                continue;
+            }
+
+            ++m_Work[next].Issued;
+            m_Work[next].Sent = worker.Sent = std::chrono::steady_clock::now();
+            worker.Current = next;
+            ++i;
+        }
+    }
+
+    for (const auto &worker: m_Workers)
+        try
+        {
+            worker.Link.Send(RenderDone{});
+        }
+        catch (const std::exception &)
+        {
+        }
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "rendered in " << seconds << " s, " << ImageExporter::Write(
+        m_Image.data(),
+        m_Options.Width,
+        m_Options.Height,
+        m_Output) << std::endl;
+}
+
+// jobs nobody has started come first, then the one out the longest once it took twice as long as jobs usually do
+int pathtracer::Coordinator::NextWork() const
+{
+    for (size_t i = 0; i < m_Work.size(); ++i)
+        if (!m_Work[i].Done && !m_Work[i].Issued)
+            return static_cast<int>(i);
+
+    if (!m_Finished)
+        return -1;
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto patience = 2 * m_WorkTime / m_Finished;
+
+    auto best = -1;
+    for (size_t i = 0; i < m_Work.size(); ++i)
+    {
+        const auto &work = m_Work[i];
+        if (work.Done || work.Issued >= MAX_ISSUES || now - work.Sent < patience)
+            continue;
+        if (best < 0 || work.Sent < m_Work[best].Sent)
+            best = static_cast<int>(i);
+    }
+    return best;
+}
+
+// the images hold sums with the sample count in alpha, so adding them weighs every range by its samples
+void pathtracer::Coordinator::Merge(const RenderResult &result, const std::chrono::steady_clock::time_point sent)
+{
+    if (result.Id >= m_Work.size())
+        return;
+
+    auto &work = m_Work[result.Id];
+    const auto &job = work.Job;
+    if (work.Done || result.Pixels.size() != static_cast<size_t>(job.Width) * job.Height * 4)
+        return;
+
+    for (int y = 0; y < job.Height; ++y)
+    {
+        const auto source = result.Pixels.data() + static_cast<size_t>(y) * job.Width * 4;
+        const auto target = m_Image.data() + (static_cast<size_t>(job.Y + y) * m_Options.Width + job.X) * 4;
+        for (int i = 0; i < job.Width * 4; ++i)
+            target[i] += source[i];
+    }
+
+    work.Done = true;
+    ++m_Finished;
+    m_WorkTime += std::chrono::steady_clock::now() - sent;
+
+    std::cout << m_Finished << " / " << m_Work.size() << " jobs" << std::endl;
+}
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <stdexcept>
+#include <stb_image.h>
+#include <pathtracer/environment.hpp>
+
+static constexpr int ROWS_PER_TASK = 32;
+
+// portable float map, little or big endian by the sign of the scale, rows stored bottom to top
+static float *load_pfm(const std::filesystem::path &path, int &width, int &height)
+{
+    std::ifstream stream(path, std::ios::binary);
+
+    std::string magic;
+    float scale;
+    stream >> magic >> width >> height >> scale;
+    stream.get();
+    if (!stream || (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0)
+        return nullptr;
+
+    const auto channels = magic == "PF" ? 3 : 1;
+    std::vector<float> raw(static_cast<size_t>(width) * height * channels);
+    if (!stream.read(reinterpret_cast<char *>(raw.data()), static_cast<std::streamsize>(raw.size() * sizeof(float))))
+        return nullptr;
+
+    if ((scale < 0.f) != (std::endian::native == std::endian::little))
+        for (auto &value: raw)
+        {
+            auto bytes = reinterpret_cast<unsigned char *>(&value);
+            std::reverse(bytes, bytes + sizeof(float));
+        }
+
+    const auto pixels = static_cast<float *>(std::malloc(static_cast<size_t>(width) * height * 3 * sizeof(float)));
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            for (int c = 0; c < 3; ++c)
+                pixels[(static_cast<size_t>(y) * width + x) * 3 + c] =
+                        raw[(static_cast<size_t>(height - 1 - y) * width + x) * channels + c % channels];
+    return pixels;
+}
+
+static float luminance(const float *rgb)
+{
+    return 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+}
+
+pathtracer::EnvironmentMap::EnvironmentMap(ThreadPool &pool)
+    : m_Pool(pool)
+{
+    glGenTextures(3, m_Textures);
+}
+
+pathtracer::EnvironmentMap::~EnvironmentMap()
+{
+    m_Pool.Wait(m_Distribution);
+
+    glDeleteTextures(3, m_Textures);
+}
+
+void pathtracer::EnvironmentMap::Check(const std::filesystem::path &path)
+{
+    if (path.extension() == ".pfm")
+    {
+        std::ifstream stream(path, std::ios::binary);
+        std::string magic;
+        int width = 0, height = 0;
+        stream >> magic >> width >> height;
+        if (!stream || (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0)
+            throw std::runtime_error("failed to load environment map " + path.string() + ": invalid portable float map");
+        return;
+    }
+
+    if (int width, height, channels; !stbi_info(path.string().c_str(), &width, &height, &channels))
+        throw std::runtime_error("failed to load environment map " + path.string() + ": " + stbi_failure_reason());
+}
+
+void pathtracer::EnvironmentMap::Load(const std::filesystem::path &path)
+{
+    if (m_Distribution.IsValid())
+        return;
+
+    m_Data = std::make_shared<EnvironmentData>();
+
+    const auto decode = m_Pool.Schedule(
+        [path, data = m_Data]
+        {
+            float *pixels;
+            if (path.extension() == ".pfm")
+                pixels = load_pfm(path, data->Width, data->Height);
+            else
+                pixels = stbi_loadf(path.string().c_str(), &data->Width, &data->Height, nullptr, 3);
+
+            if (!pixels)
+            {
+                std::cerr << "failed to load environment map " << path << ": "
+                        << (path.extension() == ".pfm" ? "invalid portable float map" : stbi_failure_reason())
+                        << std::endl;
+                return;
+            }
+
+            data->Pixels.assign(pixels, pixels + static_cast<size_t>(data->Width) * data->Height * 3);
+            std::free(pixels);
+
+            data->Conditional.resize(static_cast<size_t>(data->Width) * data->Height);
+            data->RowSums.resize(data->Height);
+            data->Marginal.resize(data->Height);
+        });
+
+    // conditional cdf per row once the decode is done, rows are independent so they are built in parallel
+    m_Distribution = m_Pool.Schedule(
+        [&pool = m_Pool, data = m_Data]
+        {
+            if (data->Pixels.empty())
+                return;
+
+            const auto width = data->Width;
+            const auto height = data->Height;
+            pool.ParallelFor(
+                0,
+                height,
+                ROWS_PER_TASK,
+                [&data, width, height](const int y)
+                {
+                    const auto theta = std::numbers::pi_v<float> * (static_cast<float>(y) + 0.5f) / height;
+                    const auto sin_theta = std::sin(theta);
+                    const auto row = static_cast<size_t>(y) * width;
+
+                    auto sum = 0.f;
+                    for (int x = 0; x < width; ++x)
+                    {
+                        sum += luminance(&data->Pixels[(row + x) * 3]) * sin_theta;
+                        data->Conditional[row + x] = sum;
+                    }
+
+                    for (int x = 0; x < width; ++x)
+                        data->Conditional[row + x] = sum > 0.f
+                                                         ? data->Conditional[row + x] / sum
+                                                         : static_cast<float>(x + 1) / static_cast<float>(width);
+                    data->RowSums[y] = sum;
+                });
+
+            auto total = 0.f;
+            for (int y = 0; y < height; ++y)
+            {
+                total += data->RowSums[y];
+                data->Marginal[y] = total;
+            }
+            for (int y = 0; y < height; ++y)
+                data->Marginal[y] = total > 0.f
+                                        ? data->Marginal[y] / total
+                                        : static_cast<float>(y + 1) / static_cast<float>(height);
+            data->Integral = total / static_cast<float>(width * height);
+        },
+        {decode});
+}
+
+void pathtracer::EnvironmentMap::Unload()
+{
+    m_Loaded = false;
+}
+
+bool pathtracer::EnvironmentMap::Poll()
+{
+    if (!m_Distribution.IsValid() || !m_Distribution.IsDone())
+        return false;
+
+    m_Distribution = {};
+    const auto data = std::move(m_Data);
+    if (data->Pixels.empty())
+        return false;
+
+    Upload(*data);
+    return true;
+}
+
+void pathtracer::EnvironmentMap::Bind(const GLuint unit) const
+{
+    for (GLuint i = 0; i < 3; ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit + i);
+        glBindTexture(GL_TEXTURE_2D, m_Textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+bool pathtracer::EnvironmentMap::IsLoaded() const
+{
+    return m_Loaded;
+}
+
+bool pathtracer::EnvironmentMap::IsLoading() const
+{
+    return m_Distribution.IsValid();
+}
+
+float pathtracer::EnvironmentMap::GetIntegral() const
+{
+    return m_Integral;
+}
+
+void pathtracer::EnvironmentMap::Upload(const EnvironmentData &data)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glBindTexture(GL_TEXTURE_2D, m_Textures[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, data.Width, data.Height, 0, GL_RGB, GL_FLOAT, data.Pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glBindTexture(GL_TEXTURE_2D, m_Textures[1]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, data.Width, data.Height, 0, GL_RED, GL_FLOAT, data.Conditional.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, m_Textures[2]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, data.Height, 1, 0, GL_RED, GL_FLOAT, data.Marginal.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    m_Integral = data.Integral;
+    m_Loaded = true;
+}
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <iostream>
+#include <pathtracer/file_watcher.hpp>
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+static constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM;
+
+pathtracer::FileWatcher::FileWatcher()
+{
+    m_Descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_Descriptor < 0)
+        std::cerr << "failed to initialize inotify: " << std::strerror(errno) << std::endl;
+}
+
+pathtracer::FileWatcher::~FileWatcher()
+{
+    if (m_Descriptor >= 0)
+        close(m_Descriptor);
+}
+
+void pathtracer::FileWatcher::Watch(const std::filesystem::path &directory)
+{
+    if (m_Descriptor < 0)
+        return;
+
+    const auto watch = inotify_add_watch(m_Descriptor, directory.c_str(), WATCH_MASK);
+    if (watch < 0)
+    {
+        std::cerr << "failed to watch " << directory << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+    m_Watches[watch] = directory;
+}
+
+void pathtracer::FileWatcher::Clear()
+{
+    for (const auto &[watch, directory]: m_Watches)
+        inotify_rm_watch(m_Descriptor, watch);
+    m_Watches.clear();
+}
+
+std::vector<std::filesystem::path> pathtracer::FileWatcher::Poll()
+{
+    std::vector<std::filesystem::path> changed;
+    if (m_Descriptor < 0)
+        return changed;
+
+    alignas(inotify_event) char buffer[4096];
+    for (;;)
+    {
+        const auto length = read(m_Descriptor, buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+            const auto it = m_Watches.find(event->wd);
+            if (it == m_Watches.end() || !event->len)
+                continue;
+
+            auto path = it->second / event->name;
+            if (std::find(changed.begin(), changed.end(), path) == changed.end())
+                changed.push_back(std::move(path));
+        }
+    }
+
+    return changed;
+}
+
+#else
+
+pathtracer::FileWatcher::FileWatcher() = default;
+
+pathtracer::FileWatcher::~FileWatcher() = default;
+
+void pathtracer::FileWatcher::Watch(const std::filesystem::path &directory)
+{
+    if (std::find(m_Directories.begin(), m_Directories.end(), directory) != m_Directories.end())
+        return;
+
+    m_Directories.push_back(directory);
+
+    std::error_code ec;
+    for (const auto &entry: std::filesystem::directory_iterator(directory, ec))
+        m_Times[entry.path().string()] = entry.last_write_time(ec);
+}
+
+void pathtracer::FileWatcher::Clear()
+{
+    m_Directories.clear();
+    m_Times.clear();
+}
+
+// without inotify the directories are rescanned for modification times at most twice a second
+std::vector<std::filesystem::path> pathtracer::FileWatcher::Poll()
+{
+    std::vector<std::filesystem::path> changed;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now - m_LastPoll < std::chrono::milliseconds(500))
+        return changed;
+    m_LastPoll = now;
+
+    for (const auto &directory: m_Directories)
+    {
+        std::error_code ec;
+        for (const auto &entry: std::filesystem::directory_iterator(directory, ec))
+        {
+            const auto time = entry.last_write_time(ec);
+            auto &previous = m_Times[entry.path().string()];
+            if (previous != time)
+            {
+                previous = time;
+                changed.push_back(entry.path());
+            }
+        }
+    }
+
+    return changed;
+}
+
+#endif
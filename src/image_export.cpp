@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <pathtracer/image_export.hpp>
+
+// every format below is written in its little-endian flavor straight from memory, png sizes are swapped by hand
+static_assert(std::endian::native == std::endian::little);
+
+namespace
+{
+    class ByteWriter
+    {
+    public:
+        template<typename T>
+        void Put(const T &value)
+        {
+            const auto bytes = reinterpret_cast<const unsigned char *>(&value);
+            Bytes.insert(Bytes.end(), bytes, bytes + sizeof(T));
+        }
+
+        void Put(const std::string_view text)
+        {
+            Bytes.insert(Bytes.end(), text.begin(), text.end());
+            Bytes.push_back(0);
+        }
+
+        void PutBig(const std::uint32_t value)
+        {
+            const unsigned char bytes[]{
+                static_cast<unsigned char>(value >> 24),
+                static_cast<unsigned char>(value >> 16),
+                static_cast<unsigned char>(value >> 8),
+                static_cast<unsigned char>(value),
+            };
+            Bytes.insert(Bytes.end(), bytes, bytes + sizeof(bytes));
+        }
+
+        std::vector<unsigned char> Bytes;
+    };
+}
+
+static std::uint16_t to_half(const float value)
+{
+    const auto bits = std::bit_cast<std::uint32_t>(value);
+    const auto sign = static_cast<std::uint16_t>(bits >> 16 & 0x8000u);
+    const auto biased = static_cast<int>(bits >> 23 & 0xffu);
+    auto mantissa = bits & 0x7fffffu;
+
+    if (biased == 0xff)
+        return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+
+    const auto exponent = biased - 127 + 15;
+    if (exponent >= 31)
+        return static_cast<std::uint16_t>(sign | 0x7c00u);
+
+    // subnormal halves keep the implicit one in the shifted mantissa, everything rounds to nearest even
+    auto shift = 13;
+    std::uint32_t half;
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000u;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+    }
+    else
+    {
+        half = static_cast<std::uint32_t>(exponent) << 10 | mantissa >> shift;
+    }
+
+    const auto remainder = mantissa & ((1u << shift) - 1u);
+    const auto halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1u)))
+        ++half;
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+static float tonemap(float x, const pathtracer::Tonemap curve)
+{
+    const auto hable = [](const float v)
+    {
+        constexpr auto A = .15f, B = .5f, C = .1f, D = .2f, E = .02f, F = .3f;
+        return (v * (A * v + C * B) + D * E) / (v * (A * v + B) + D * F) - E / F;
+    };
+
+    switch (curve)
+    {
+        case pathtracer::Tonemap::Reinhard:
+            return x / (1.f + x);
+        case pathtracer::Tonemap::Aces:
+            x *= .6f;
+            return std::clamp(x * (2.51f * x + .03f) / (x * (2.43f * x + .59f) + .14f), 0.f, 1.f);
+        case pathtracer::Tonemap::Filmic:
+            return hable(2.f * x) / hable(11.2f);
+        default:
+            return x;
+    }
+}
+
+static float srgb_encode(const float x)
+{
+    return x > .0031308f ? 1.055f * std::pow(x, 1.f / 2.4f) - .055f : 12.92f * x;
+}
+
+static float mean(const float *pixel, const int c)
+{
+    return pixel[c] / std::max(pixel[3], 1.f);
+}
+
+// uncompressed scanlines, channels in the alphabetical order the format requires
+static void encode_exr(ByteWriter &out, const float *pixels, const int width, const int height, const bool half)
+{
+    constexpr std::array channels{'B', 'G', 'R'};
+    constexpr int components[]{2, 1, 0};
+    const auto pixel_size = half ? sizeof(std::uint16_t) : sizeof(float);
+
+    out.Put(std::uint32_t{20000630});
+    out.Put(std::uint32_t{2});
+
+    const auto attribute = [&out](const std::string_view name, const std::string_view type, const std::uint32_t size)
+    {
+        out.Put(name);
+        out.Put(type);
+        out.Put(size);
+    };
+
+    attribute("channels", "chlist", static_cast<std::uint32_t>(channels.size() * 18 + 1));
+    for (const auto channel: channels)
+    {
+        out.Put(std::string_view(&channel, 1));
+        out.Put(std::int32_t{half ? 1 : 2});
+        out.Put(std::uint32_t{0});
+        out.Put(std::int32_t{1});
+        out.Put(std::int32_t{1});
+    }
+    out.Bytes.push_back(0);
+
+    attribute("compression", "compression", 1);
+    out.Bytes.push_back(0);
+
+    for (const auto window: {"dataWindow", "displayWindow"})
+    {
+        attribute(window, "box2i", 16);
+        out.Put(std::int32_t{0});
+        out.Put(std::int32_t{0});
+        out.Put(std::int32_t{width - 1});
+        out.Put(std::int32_t{height - 1});
+    }
+
+    attribute("lineOrder", "lineOrder", 1);
+    out.Bytes.push_back(0);
+
+    attribute("pixelAspectRatio", "float", 4);
+    out.Put(1.f);
+
+    attribute("screenWindowCenter", "v2f", 8);
+    out.Put(0.f);
+    out.Put(0.f);
+
+    attribute("screenWindowWidth", "float", 4);
+    out.Put(1.f);
+
+    out.Bytes.push_back(0);
+
+    const auto line_size = static_cast<std::uint32_t>(width * channels.size() * pixel_size);
+    const auto first_line = out.Bytes.size() + static_cast<size_t>(height) * sizeof(std::uint64_t);
+    for (int y = 0; y < height; ++y)
+        out.Put(static_cast<std::uint64_t>(first_line + static_cast<size_t>(y) * (8 + line_size)));
+
+    // the readback is bottom-up, exr counts from the top
+    for (int y = 0; y < height; ++y)
+    {
+        out.Put(std::int32_t{y});
+        out.Put(line_size);
+
+        const auto row = pixels + static_cast<size_t>(height - 1 - y) * width * 4;
+        for (const auto c: components)
+            for (int x = 0; x < width; ++x)
+            {
+                const auto value = mean(row + static_cast<size_t>(x) * 4, c);
+                if (half)
+                    out.Put(to_half(value));
+                else
+                    out.Put(value);
+            }
+    }
+}
+
+// a negative scale marks little-endian data, rows go bottom-up like the readback
+static void encode_pfm(ByteWriter &out, const float *pixels, const int width, const int height)
+{
+    const auto header = "PF\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n-1.0\n";
+    out.Bytes.insert(out.Bytes.end(), header.begin(), header.end());
+
+    for (size_t i = 0; i < static_cast<size_t>(width) * height; ++i)
+        for (int c = 0; c < 3; ++c)
+            out.Put(mean(pixels + i * 4, c));
+}
+
+static std::uint32_t crc32(const unsigned char *data, const size_t size, std::uint32_t crc = 0)
+{
+    static const auto table = []
+    {
+        std::array<std::uint32_t, 256> result{};
+        for (std::uint32_t n = 0; n < 256; ++n)
+        {
+            auto c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1u ? 0xedb88320u ^ c >> 1 : c >> 1;
+            result[n] = c;
+        }
+        return result;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xffu] ^ crc >> 8;
+    return ~crc;
+}
+
+// 8-bit rgb after exposure, tonemap and srgb encoding; without a deflate implementation at hand the zlib stream
+// is made of stored blocks, which every decoder reads and which keeps the encoder a single pass over the rows
+static void encode_png(ByteWriter &out, const float *pixels, const int width, const int height, const pathtracer::ExportRequest &request)
+{
+    std::vector<unsigned char> raw;
+    raw.reserve(static_cast<size_t>(width * 3 + 1) * height);
+    for (int y = height - 1; y >= 0; --y)
+    {
+        raw.push_back(0);
+        const auto row = pixels + static_cast<size_t>(y) * width * 4;
+        for (int x = 0; x < width; ++x)
+            for (int c = 0; c < 3; ++c)
+            {
+                const auto value = tonemap(mean(row + static_cast<size_t>(x) * 4, c) * request.Exposure, request.Tonemap);
+                raw.push_back(static_cast<unsigned char>(std::lround(srgb_encode(std::clamp(value, 0.f, 1.f)) * 255.f)));
+            }
+    }
+
+    ByteWriter zlib;
+    zlib.Bytes = {0x78, 0x01};
+    constexpr size_t BLOCK = 65535;
+    size_t offset = 0;
+    do
+    {
+        const auto size = std::min(BLOCK, raw.size() - offset);
+        zlib.Bytes.push_back(offset + size == raw.size() ? 1 : 0);
+        zlib.Put(static_cast<std::uint16_t>(size));
+        zlib.Put(static_cast<std::uint16_t>(~size));
+        zlib.Bytes.insert(zlib.Bytes.end(), raw.data() + offset, raw.data() + offset + size);
+        offset += size;
+    }
+    while (offset < raw.size());
+
+    std::uint32_t a = 1, b = 0;
+    for (const auto byte: raw)
+    {
+        a = (a + byte) % 65521u;
+        b = (b + a) % 65521u;
+    }
+    zlib.PutBig(b << 16 | a);
+
+    const auto chunk = [&out](const char (&type)[5], const std::vector<unsigned char> &data)
+    {
+        out.PutBig(static_cast<std::uint32_t>(data.size()));
+        const auto start = out.Bytes.size();
+        out.Bytes.insert(out.Bytes.end(), type, type + 4);
+        out.Bytes.insert(out.Bytes.end(), data.begin(), data.end());
+        out.PutBig(crc32(out.Bytes.data() + start, out.Bytes.size() - start));
+    };
+
+    out.Bytes = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+    ByteWriter header;
+    header.PutBig(static_cast<std::uint32_t>(width));
+    header.PutBig(static_cast<std::uint32_t>(height));
+    header.Bytes.insert(header.Bytes.end(), {8, 2, 0, 0, 0});
+
+    chunk("IHDR", header.Bytes);
+    chunk("IDAT", zlib.Bytes);
+    chunk("IEND", {});
+}
+
+pathtracer::ImageExporter::ImageExporter(ThreadPool &pool)
+{
+    for (auto &readback: m_Readbacks)
+        readback = std::make_unique<TextureReadback>(pool);
+}
+
+pathtracer::ImageExporter::~ImageExporter() = default;
+
+bool pathtracer::ImageExporter::Capture(const GLuint texture, const int width, const int height, ExportRequest request)
+{
+    const auto it = std::ranges::find_if(
+        m_Readbacks,
+        [](const std::unique_ptr<TextureReadback> &readback) { return !readback->IsBusy(); });
+    if (it == std::end(m_Readbacks))
+        return false;
+
+    return (*it)->Start(
+        {&texture, 1},
+        static_cast<size_t>(width) * height * 4 * sizeof(float),
+        [width, height, request = std::move(request)](const float *pixels)
+        {
+            return Write(pixels, width, height, request);
+        });
+}
+
+bool pathtracer::ImageExporter::Poll(std::string &message)
+{
+    return std::ranges::any_of(
+        m_Readbacks,
+        [&message](const std::unique_ptr<TextureReadback> &readback) { return readback->Poll(message); });
+}
+
+bool pathtracer::ImageExporter::IsBusy() const
+{
+    return std::ranges::any_of(
+        m_Readbacks,
+        [](const std::unique_ptr<TextureReadback> &readback) { return readback->IsBusy(); });
+}
+
+std::string pathtracer::ImageExporter::Write(
+    const float *pixels,
+    const int width,
+    const int height,
+    const ExportRequest &request)
+{
+    auto path = request.Path;
+    path += Extension(request.Format);
+
+    ByteWriter out;
+    switch (request.Format)
+    {
+        case ExportFormat::ExrHalf:
+        case ExportFormat::ExrFloat:
+            encode_exr(out, pixels, width, height, request.Format == ExportFormat::ExrHalf);
+            break;
+        case ExportFormat::Pfm:
+            encode_pfm(out, pixels, width, height);
+            break;
+        case ExportFormat::Png:
+            encode_png(out, pixels, width, height, request);
+            break;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char *>(out.Bytes.data()), static_cast<std::streamsize>(out.Bytes.size()));
+    return stream ? path.string() : "failed to write " + path.string();
+}
+
+const char *pathtracer::ImageExporter::Extension(const ExportFormat format)
+{
+    switch (format)
+    {
+        case ExportFormat::ExrHalf:
+        case ExportFormat::ExrFloat:
+            return ".exr";
+        case ExportFormat::Pfm:
+            return ".pfm";
+        default:
+            return ".png";
+    }
+}
+
+pathtracer::ExportFormat pathtracer::ImageExporter::FormatOf(const std::filesystem::path &path)
+{
+    const auto extension = path.extension();
+    if (extension == ".exr")
+        return ExportFormat::ExrFloat;
+    if (extension == ".pfm")
+        return ExportFormat::Pfm;
+    if (extension == ".png")
+        return ExportFormat::Png;
+    throw std::runtime_error("unsupported output " + path.string() + ", expected .exr, .pfm or .png");
+}
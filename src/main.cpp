@@ -1,6 +1,26 @@
+#include <iostream>
 #include <pathtracer/app.hpp>
+#include <pathtracer/distributed.hpp>
 
-int main()
+int main(const int argc, char **argv)
 {
-    pathtracer::App app;
+    pathtracer::Options options;
+    try
+    {
+        options = pathtracer::Options::Parse({argv + 1, argv + argc});
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    // the coordinator never renders, it needs no window and no context
+    if (options.Coordinator)
+    {
+        pathtracer::Coordinator(options).Run();
+        return 0;
+    }
+
+    pathtracer::App app(options);
 }
@@ -0,0 +1,95 @@
+#include <stdexcept>
+#include <pathtracer/options.hpp>
+
+static constexpr auto USAGE =
+        "usage: path_tracer [--checkpoint <path>] [--resume [<path>]]\n"
+        "       path_tracer --coordinator --scene <file> [--port <n>] [--size <w>x<h>] [--samples <n>]\n"
+        "                   [--tile <pixels>] [--chunk <samples>] [--output <file.exr|.pfm|.png>]\n"
+        "       path_tracer --worker <host>:<port>\n"
+        "       path_tracer --sequence <file> [--size <w>x<h>] [--output <file.exr|.pfm|.png>]\n"
+        "       path_tracer --benchmark [--scene <file>] [--size <w>x<h>]";
+
+pathtracer::Options pathtracer::Options::Parse(const std::vector<std::string> &arguments)
+{
+    Options options;
+
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        const auto &argument = arguments[i];
+        const auto value = [&]() -> const std::string &
+        {
+            if (i + 1 >= arguments.size())
+                throw std::runtime_error(argument + " expects a value\n" + USAGE);
+            return arguments[++i];
+        };
+        const auto parse = [&](const std::string &text)
+        {
+            try
+            {
+                return std::stoi(text);
+            }
+            catch (const std::exception &)
+            {
+                throw std::runtime_error(argument + " expects a number, got " + text + "\n" + USAGE);
+            }
+        };
+        const auto number = [&] { return parse(value()); };
+
+        if (argument == "--checkpoint")
+            options.CheckpointPath = value();
+        else if (argument == "--resume")
+        {
+            options.Resume = true;
+            if (i + 1 < arguments.size() && !arguments[i + 1].starts_with("--"))
+                options.CheckpointPath = value();
+        }
+        else if (argument == "--coordinator")
+            options.Coordinator = true;
+        else if (argument == "--worker")
+            options.Worker = value();
+        else if (argument == "--port")
+        {
+            const auto port = number();
+            if (port <= 0 || port > 65535)
+                throw std::runtime_error("--port expects 1 to 65535, got " + std::to_string(port));
+            options.Port = static_cast<std::uint16_t>(port);
+        }
+        else if (argument == "--scene")
+            options.Scene = value();
+        else if (argument == "--size")
+        {
+            const auto &size = value();
+            const auto x = size.find('x');
+            if (x == std::string::npos)
+                throw std::runtime_error("--size expects <width>x<height>, got " + size);
+            options.Width = parse(size.substr(0, x));
+            options.Height = parse(size.substr(x + 1));
+        }
+        else if (argument == "--samples")
+            options.Samples = static_cast<unsigned>(number());
+        else if (argument == "--tile")
+            options.Tile = number();
+        else if (argument == "--chunk")
+            options.Chunk = static_cast<unsigned>(number());
+        else if (argument == "--output")
+            options.Output = value();
+        else if (argument == "--benchmark")
+            options.Benchmark = true;
+        else if (argument == "--sequence")
+            options.Sequence = value();
+        else
+            throw std::runtime_error("unknown argument " + argument + "\n" + USAGE);
+    }
+
+    if (options.Coordinator && options.Scene.empty())
+        throw std::runtime_error(std::string("--coordinator needs a --scene\n") + USAGE);
+    if (options.Width <= 0 || options.Height <= 0 || options.Tile <= 0 || !options.Samples || !options.Chunk)
+        throw std::runtime_error("size, tile, samples and chunk have to be positive");
+
+    if (options.Output.empty())
+        options.Output = options.Sequence.empty()
+                             ? std::filesystem::path("exports/distributed.exr")
+                             : "exports" / options.Sequence.stem() / "frame.exr";
+
+    return options;
+}
@@ -0,0 +1,98 @@
+#include <pathtracer/readback.hpp>
+
+pathtracer::TextureReadback::TextureReadback(ThreadPool &pool)
+    : m_Pool(pool)
+{
+}
+
+pathtracer::TextureReadback::~TextureReadback()
+{
+    // the job reads from the mapping, it has to finish before the buffer goes away
+    if (m_Result.valid())
+        m_Result.wait();
+
+    if (m_Fence)
+        glDeleteSync(m_Fence);
+    if (m_Buffer)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_Buffer);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteBuffers(1, &m_Buffer);
+    }
+}
+
+bool pathtracer::TextureReadback::Start(
+    const std::span<const GLuint> textures,
+    const size_t texture_size,
+    Job job)
+{
+    if (IsBusy())
+        return false;
+
+    const auto size = texture_size * textures.size();
+
+    // storage is immutable once mapped, a new size needs a new buffer
+    constexpr GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    if (size != m_Size)
+    {
+        if (m_Buffer)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, m_Buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glDeleteBuffers(1, &m_Buffer);
+        }
+
+        glGenBuffers(1, &m_Buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_Buffer);
+        glBufferStorage(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(size), nullptr, flags);
+        m_Mapped = static_cast<const float *>(glMapBufferRange(
+            GL_PIXEL_PACK_BUFFER,
+            0,
+            static_cast<GLsizeiptr>(size),
+            flags));
+        m_Size = size;
+    }
+
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_Buffer);
+    for (size_t i = 0; i < textures.size(); ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, reinterpret_cast<void *>(i * texture_size));
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    m_Job = std::move(job);
+    return true;
+}
+
+bool pathtracer::TextureReadback::Poll(std::string &result)
+{
+    if (m_Fence)
+    {
+        if (const auto status = glClientWaitSync(m_Fence, 0, 0);
+            status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+
+        glDeleteSync(m_Fence);
+        m_Fence = nullptr;
+
+        m_Result = m_Pool.Submit([job = std::move(m_Job), pixels = m_Mapped] { return job(pixels); });
+        m_Job = nullptr;
+        return false;
+    }
+
+    if (!m_Result.valid() || m_Result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+
+    result = m_Result.get();
+    return true;
+}
+
+bool pathtracer::TextureReadback::IsBusy() const
+{
+    return m_Fence || m_Result.valid();
+}
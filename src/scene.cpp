@@ -2,8 +2,11 @@
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <pathtracer/bvh_builder.hpp>
 #include <pathtracer/scene.hpp>
 
+static constexpr size_t FACES_PER_TASK = 4096;
+
 glm::vec3 pathtracer::Triangle::Center() const
 {
     return (P0 + P1 + P2) / 3.0f;
@@ -15,15 +18,95 @@ void pathtracer::Triangle::AddBounds(glm::vec3 &min, glm::vec3 &max) const
     max = glm::max(glm::max(glm::max(max, P0), P1), P2);
 }
 
-pathtracer::Scene::Scene()
-    : m_TriangleBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW),
+static std::filesystem::path texture_path(
+    const std::filesystem::path &directory,
+    const aiMaterial *material,
+    const aiTextureType type)
+{
+    aiString path;
+    if (material->GetTexture(type, 0, &path) != AI_SUCCESS)
+        return {};
+
+    if (path.C_Str()[0] == '*')
+    {
+        std::cerr << "embedded texture " << path.C_Str() << " is not supported" << std::endl;
+        return {};
+    }
+
+    return directory / path.C_Str();
+}
+
+pathtracer::Scene::Scene(
+    ThreadPool &pool,
+    const std::filesystem::path &texture_cache,
+    const size_t texture_budget)
+    : m_Pool(pool),
+      m_TriangleBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW),
       m_MaterialBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW),
       m_ModelBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW),
-      m_BVHNodeBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW)
+      m_BVHNodeBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW),
+      m_TriangleIndexBuffer(GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW),
+      m_Textures(pool, texture_cache, texture_budget)
 {
 }
 
 void pathtracer::Scene::LoadModel(const std::filesystem::path &path, const unsigned int flags)
+{
+    auto mesh = Import(m_Pool, path, flags, {});
+    const auto root = AddMesh(path, mesh);
+    m_Models.emplace_back(root, -1, glm::mat4(1.0f), glm::mat4(1.0f));
+}
+
+void pathtracer::Scene::Load(const SceneFile &file)
+{
+    // importers share nothing and build their trees alone, only merging into the scene has to happen in order
+    std::vector<std::future<ImportedMesh> > imports;
+    imports.reserve(file.Meshes.size());
+    for (const auto &mesh: file.Meshes)
+        imports.push_back(m_Pool.Submit([&pool = m_Pool, mesh] { return Import(pool, mesh.Path, mesh.Flags, mesh.Bvh); }));
+
+    std::vector<ImportedMesh> meshes;
+    meshes.reserve(file.Meshes.size());
+    auto triangle_count = m_Triangles.size();
+    auto index_count = m_TriangleIndices.size();
+    auto node_count = m_BVHNodes.size();
+    for (auto &import: imports)
+    {
+        meshes.push_back(m_Pool.Wait(import));
+        triangle_count += meshes.back().Triangles.size();
+        index_count += meshes.back().Indices.size();
+        node_count += meshes.back().Nodes.size();
+    }
+    m_Triangles.reserve(triangle_count);
+    m_TriangleIndices.reserve(index_count);
+    m_BVHNodes.reserve(node_count);
+
+    std::vector<unsigned> roots;
+    roots.reserve(file.Meshes.size());
+    for (size_t i = 0; i < file.Meshes.size(); ++i)
+        roots.push_back(AddMesh(file.Meshes[i].Path, meshes[i]));
+
+    const auto overrides = static_cast<int>(m_Materials.size());
+    for (const auto &material: file.Materials)
+        AddMaterial(material);
+
+    for (const auto &instance: file.Instances)
+    {
+        const auto inverse_transform = inverse(instance.Transform);
+        m_Models.emplace_back(
+            roots[instance.Mesh],
+            instance.Material < 0 ? -1 : overrides + instance.Material,
+            instance.Transform,
+            inverse_transform,
+            glm::mat3(transpose(inverse_transform)));
+    }
+}
+
+pathtracer::Scene::ImportedMesh pathtracer::Scene::Import(
+    ThreadPool &pool,
+    const std::filesystem::path &path,
+    const unsigned int flags,
+    const SceneBvh &bvh)
 {
     Assimp::Importer importer;
     const auto scene = importer.ReadFile(
@@ -32,52 +115,66 @@ void pathtracer::Scene::LoadModel(const std::filesystem::path &path, const unsig
     if (!scene)
         throw std::runtime_error("failed to load model from " + path.string() + ": " + importer.GetErrorString());
 
-    const unsigned first = m_Triangles.size();
+    ImportedMesh result;
 
+    size_t face_count = 0;
+    for (unsigned mi = 0; mi < scene->mNumMeshes; ++mi)
+        face_count += scene->mMeshes[mi]->mNumFaces;
+    result.Triangles.resize(face_count);
+
+    // faces convert independently, every mesh fills its own run of the triangles
+    size_t offset = 0;
     for (unsigned mi = 0; mi < scene->mNumMeshes; ++mi)
     {
         const auto mesh = scene->mMeshes[mi];
 
-        for (unsigned fi = 0; fi < mesh->mNumFaces; ++fi)
-        {
-            const auto face = mesh->mFaces[fi];
-
-            std::vector<glm::vec3> p;
-            std::vector<glm::vec3> n;
-            std::vector<glm::vec2> uv;
-            for (unsigned i = 0; i < face.mNumIndices; ++i)
+        pool.ParallelFor(
+            0,
+            mesh->mNumFaces,
+            FACES_PER_TASK,
+            [mesh, offset, &result](const size_t fi)
             {
-                const auto idx = face.mIndices[i];
-
-                auto pos = mesh->mVertices[idx];
-                p.emplace_back(pos.x, pos.y, pos.z);
-
-                auto normal = mesh->mNormals[idx];
-                n.emplace_back(normal.x, normal.y, normal.z);
+                const auto face = mesh->mFaces[fi];
 
-                if (mesh->HasTextureCoords(0))
+                glm::vec3 p[3];
+                glm::vec3 n[3];
+                glm::vec2 uv[3];
+                for (unsigned i = 0; i < 3; ++i)
                 {
-                    auto tex = mesh->mTextureCoords[0][idx];
-                    uv.emplace_back(tex.x, tex.y);
+                    const auto idx = face.mIndices[i];
+
+                    auto pos = mesh->mVertices[idx];
+                    p[i] = glm::vec3(pos.x, pos.y, pos.z);
+
+                    auto normal = mesh->mNormals[idx];
+                    n[i] = glm::vec3(normal.x, normal.y, normal.z);
+
+                    if (mesh->HasTextureCoords(0))
+                    {
+                        auto tex = mesh->mTextureCoords[0][idx];
+                        uv[i] = glm::vec2(tex.x, tex.y);
+                    }
+                    else
+                    {
+                        uv[i] = glm::vec2(0.0, 0.0);
+                    }
                 }
-                else
-                {
-                    uv.emplace_back(0.0, 0.0);
-                }
-            }
-
-            m_Triangles.emplace_back(
-                p[0],
-                p[1],
-                p[2],
-                n[0],
-                n[1],
-                n[2],
-                uv[0],
-                uv[1],
-                uv[2],
-                m_Materials.size() + mesh->mMaterialIndex);
-        }
+
+                // material indices are local to the mesh until it is added to a scene
+                result.Triangles[offset + fi] = {
+                    p[0],
+                    p[1],
+                    p[2],
+                    n[0],
+                    n[1],
+                    n[2],
+                    uv[0],
+                    uv[1],
+                    uv[2],
+                    mesh->mMaterialIndex,
+                };
+            });
+        offset += mesh->mNumFaces;
     }
 
     for (unsigned mi = 0; mi < scene->mNumMaterials; ++mi)
@@ -94,79 +191,96 @@ void pathtracer::Scene::LoadModel(const std::filesystem::path &path, const unsig
         material->Get(AI_MATKEY_OPACITY, opacity);
         material->Get(AI_MATKEY_REFRACTI, ir);
 
-        m_Materials.emplace_back(
-            glm::vec3(diffuse.r, diffuse.g, diffuse.b),
-            -1,
-            glm::vec3(emission.r, emission.g, emission.b),
-            -1,
-            roughness,
-            metalic,
-            1.0f - opacity,
-            ir);
+        result.Materials.push_back(
+            {
+                .Diffuse = glm::vec3(diffuse.r, diffuse.g, diffuse.b),
+                .DiffuseTexture = texture_path(path.parent_path(), material, aiTextureType_DIFFUSE),
+                .Emission = glm::vec3(emission.r, emission.g, emission.b),
+                .EmissionTexture = texture_path(path.parent_path(), material, aiTextureType_EMISSIVE),
+                .Roughness = roughness,
+                .Metalness = metalic,
+                .Transparency = 1.0f - opacity,
+                .IR = ir,
+            });
     }
 
     importer.FreeScene();
 
-    const auto root = GenerateBVHTree(first, m_Triangles.size(), 100);
-    m_Models.emplace_back(root, glm::mat4(1.0f), glm::mat4(1.0f));
+    auto tree = BvhBuilder(pool, result.Stats).Build(result.Triangles, bvh);
+    result.Nodes = std::move(tree.Nodes);
+    result.Indices = std::move(tree.Indices);
+    return result;
 }
 
-size_t pathtracer::Scene::GenerateBVHTree(const unsigned start, const unsigned end, const unsigned depth)
+unsigned pathtracer::Scene::AddMesh(const std::filesystem::path &path, ImportedMesh &mesh)
 {
-    glm::vec3 min{std::numeric_limits<float>::infinity()}, max{-std::numeric_limits<float>::infinity()};
+    m_Sources.push_back(path);
 
-    for (auto i = start; i < end; ++i)
-        m_Triangles[i].AddBounds(min, max);
+    m_BuildStats.Triangles += mesh.Stats.Triangles;
+    m_BuildStats.References += mesh.Stats.References;
+    m_BuildStats.Nodes += mesh.Stats.Nodes;
+    m_BuildStats.ScratchBytes = std::max(m_BuildStats.ScratchBytes, mesh.Stats.ScratchBytes);
+    m_BuildStats.AllocationMilliseconds += mesh.Stats.AllocationMilliseconds;
+    m_BuildStats.BuildMilliseconds += mesh.Stats.BuildMilliseconds;
+    m_BuildStats.LayoutMilliseconds += mesh.Stats.LayoutMilliseconds;
+    m_BuildStats.PeakResidentBytes = std::max(m_BuildStats.PeakResidentBytes, mesh.Stats.PeakResidentBytes);
 
-    const auto dx = max.x - min.x;
-    const auto dy = max.y - min.y;
-    const auto dz = max.z - min.z;
-
-    if (dx < 0.01f)
-    {
-        min.x -= 0.01f;
-        max.x += 0.01f;
-    }
-    if (dy < 0.01f)
-    {
-        min.y -= 0.01f;
-        max.y += 0.01f;
-    }
-    if (dz < 0.01f)
-    {
-        min.z -= 0.01f;
-        max.z += 0.01f;
-    }
-
-    const auto idx = m_BVHNodes.size();
-    const auto count = end - start;
+    const unsigned first = m_Triangles.size();
+    const unsigned material_offset = m_Materials.size();
 
-    if (depth == 0 || count < 2)
+    for (auto &triangle: mesh.Triangles)
     {
-        m_BVHNodes.emplace_back(min, max, 0, 0, start, end);
-        return idx;
+        triangle.Material += material_offset;
+        m_Triangles.push_back(triangle);
     }
 
-    m_BVHNodes.emplace_back(min, max, 0, 0, 0, 0);
+    for (const auto &material: mesh.Materials)
+        AddMaterial(material);
 
-    const auto longest_axis = dx > dy ? (dx >= dz ? 0 : 2) : dy >= dz ? 1 : 2;
+    // the tree was built on the mesh alone: indices move by the triangles, leaves by the indices and inner nodes by
+    // the nodes before it
+    const unsigned first_index = m_TriangleIndices.size();
+    for (const auto index: mesh.Indices)
+        m_TriangleIndices.push_back(first + index);
 
-    std::sort(
-        m_Triangles.begin() + start,
-        m_Triangles.begin() + end,
-        [longest_axis](const Triangle &a, const Triangle &b)-> bool
+    const unsigned root = m_BVHNodes.size();
+    for (auto node: mesh.Nodes)
+    {
+        if (node.Left != 0)
         {
-            return a.Center()[longest_axis] < b.Center()[longest_axis];
-        });
-
-    const auto mid = start + count / 2;
-    m_BVHNodes[idx].Left = GenerateBVHTree(start, mid, depth - 1);
-    m_BVHNodes[idx].Right = GenerateBVHTree(mid, end, depth - 1);
+            node.Left += root;
+            node.Right += root;
+        }
+        else
+        {
+            node.Start += first_index;
+            node.End += first_index;
+        }
+        m_BVHNodes.push_back(node);
+    }
+    return root;
+}
 
-    return idx;
+int pathtracer::Scene::AddMaterial(const SceneMaterial &material)
+{
+    const auto request = [this](const std::filesystem::path &path)
+    {
+        return path.empty() ? -1 : m_Textures.Request(path);
+    };
+
+    m_Materials.emplace_back(
+        material.Diffuse,
+        request(material.DiffuseTexture),
+        material.Emission,
+        request(material.EmissionTexture),
+        material.Roughness,
+        material.Metalness,
+        material.Transparency,
+        material.IR);
+    return static_cast<int>(m_Materials.size() - 1);
 }
 
-void pathtracer::Scene::Upload() const
+void pathtracer::Scene::Upload()
 {
     m_TriangleBuffer.Bind();
     m_TriangleBuffer.Data(m_Triangles.size() * sizeof(Triangle), m_Triangles.data());
@@ -184,10 +298,46 @@ void pathtracer::Scene::Upload() const
     m_BVHNodeBuffer.Data(m_BVHNodes.size() * sizeof(BVHNode), m_BVHNodes.data());
     m_BVHNodeBuffer.Unbind();
 
+    m_TriangleIndexBuffer.Bind();
+    m_TriangleIndexBuffer.Data(
+        m_TriangleIndices.size() * sizeof(std::uint32_t),
+        m_TriangleIndices.data());
+    m_TriangleIndexBuffer.Unbind();
+
     m_TriangleBuffer.BindBase(0);
     m_MaterialBuffer.BindBase(1);
     m_ModelBuffer.BindBase(2);
     m_BVHNodeBuffer.BindBase(3);
+    m_TriangleIndexBuffer.BindBase(8);
+
+    m_Textures.Upload();
+}
+
+void pathtracer::Scene::SetTransform(const size_t i, const glm::mat4 &transform)
+{
+    const auto inverse_transform = inverse(transform);
+    m_Models[i].Transform = transform;
+    m_Models[i].InverseTransform = inverse_transform;
+    m_Models[i].NormalTransform = glm::mat3(transpose(inverse_transform));
+}
+
+void pathtracer::Scene::UploadModels()
+{
+    m_ModelBuffer.Bind();
+    m_ModelBuffer.SubData(0, static_cast<GLsizeiptr>(m_Models.size() * sizeof(Model)), m_Models.data());
+    m_ModelBuffer.Unbind();
+}
+
+bool pathtracer::Scene::Poll()
+{
+    const auto ready = m_Textures.Poll();
+    m_Textures.Bind(0);
+    return ready;
+}
+
+const pathtracer::TextureCache &pathtracer::Scene::GetTextures() const
+{
+    return m_Textures;
 }
 
 pathtracer::Model &pathtracer::Scene::GetModel(const size_t i)
@@ -199,3 +349,33 @@ pathtracer::Model &pathtracer::Scene::GetLastModel()
 {
     return m_Models.back();
 }
+
+const std::vector<std::filesystem::path> &pathtracer::Scene::GetSources() const
+{
+    return m_Sources;
+}
+
+const std::vector<pathtracer::Triangle> &pathtracer::Scene::GetTriangles() const
+{
+    return m_Triangles;
+}
+
+const std::vector<pathtracer::BVHNode> &pathtracer::Scene::GetNodes() const
+{
+    return m_BVHNodes;
+}
+
+const std::vector<std::uint32_t> &pathtracer::Scene::GetTriangleIndices() const
+{
+    return m_TriangleIndices;
+}
+
+const std::vector<pathtracer::Model> &pathtracer::Scene::GetModels() const
+{
+    return m_Models;
+}
+
+const pathtracer::BuildStats &pathtracer::Scene::GetBuildStats() const
+{
+    return m_BuildStats;
+}
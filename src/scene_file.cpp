@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <tuple>
+#include <assimp/postprocess.h>
+#include <glm/ext.hpp>
+#include <pathtracer/scene_file.hpp>
+#include <yaml-cpp/yaml.h>
+
+static std::runtime_error scene_error(const std::filesystem::path &path, const YAML::Node &yaml, const std::string &what)
+{
+    return std::runtime_error(path.string() + ':' + std::to_string(yaml.Mark().line + 1) + ": " + what);
+}
+
+// a sequence of three numbers, or a single number for all of them
+static glm::vec3 parse_vec3(const std::filesystem::path &path, const YAML::Node &yaml)
+{
+    if (yaml.IsScalar())
+        return glm::vec3(yaml.as<float>());
+
+    const auto values = yaml.as<std::vector<float> >();
+    if (values.size() != 3)
+        throw scene_error(path, yaml, "expected three components");
+    return {values[0], values[1], values[2]};
+}
+
+// translate * rotate * scale, the euler angles are in degrees and applied about x first, then y, then z; whatever
+// is missing is taken from the base
+static pathtracer::SceneTransform parse_transform(
+    const std::filesystem::path &path,
+    const YAML::Node &yaml,
+    pathtracer::SceneTransform base = {})
+{
+    if (!yaml)
+        return base;
+
+    if (yaml["translate"])
+        base.Translate = parse_vec3(path, yaml["translate"]);
+    if (yaml["rotate"])
+    {
+        const auto angles = radians(parse_vec3(path, yaml["rotate"]));
+        base.Rotate = angleAxis(angles.z, glm::vec3(0.f, 0.f, 1.f))
+                      * angleAxis(angles.y, glm::vec3(0.f, 1.f, 0.f))
+                      * angleAxis(angles.x, glm::vec3(1.f, 0.f, 0.f));
+    }
+    if (yaml["scale"])
+        base.Scale = parse_vec3(path, yaml["scale"]);
+    return base;
+}
+
+// a target replaces yaw and pitch, explicit angles win over both
+static pathtracer::SceneCamera parse_camera(
+    const std::filesystem::path &path,
+    const YAML::Node &yaml,
+    pathtracer::SceneCamera base = {})
+{
+    if (yaml["position"])
+        base.Position = parse_vec3(path, yaml["position"]);
+    if (yaml["target"])
+    {
+        const auto forward = normalize(parse_vec3(path, yaml["target"]) - base.Position);
+        base.Pitch = glm::degrees(std::asin(forward.y));
+        base.Yaw = glm::degrees(std::atan2(forward.z, forward.x));
+    }
+    if (yaml["yaw"])
+        base.Yaw = yaml["yaw"].as<float>();
+    if (yaml["pitch"])
+        base.Pitch = yaml["pitch"].as<float>();
+    if (yaml["fov"])
+        base.Fov = yaml["fov"].as<float>();
+    return base;
+}
+
+// the pair of keys around the frame and how far it is from the first to the second
+template<typename Key>
+static std::tuple<const Key &, const Key &, float> find_keys(const std::vector<Key> &keys, const float frame)
+{
+    const auto next = std::ranges::upper_bound(keys, frame, {}, &Key::Frame);
+    if (next == keys.begin())
+        return {keys.front(), keys.front(), 0.f};
+    if (next == keys.end())
+        return {keys.back(), keys.back(), 0.f};
+
+    const auto &previous = *(next - 1);
+    return {previous, *next, (frame - previous.Frame) / (next->Frame - previous.Frame)};
+}
+
+static pathtracer::SceneMaterial parse_material(const std::filesystem::path &path, const YAML::Node &yaml)
+{
+    const auto directory = path.parent_path();
+
+    pathtracer::SceneMaterial material;
+    if (yaml["diffuse"])
+        material.Diffuse = parse_vec3(path, yaml["diffuse"]);
+    if (yaml["diffuse_texture"])
+        material.DiffuseTexture = directory / yaml["diffuse_texture"].as<std::string>();
+    if (yaml["emission"])
+        material.Emission = parse_vec3(path, yaml["emission"]);
+    if (yaml["emission_texture"])
+        material.EmissionTexture = directory / yaml["emission_texture"].as<std::string>();
+    if (yaml["roughness"])
+        material.Roughness = yaml["roughness"].as<float>();
+    if (yaml["metalness"])
+        material.Metalness = yaml["metalness"].as<float>();
+    if (yaml["transparency"])
+        material.Transparency = yaml["transparency"].as<float>();
+    if (yaml["ir"])
+        material.IR = yaml["ir"].as<float>();
+    return material;
+}
+
+static unsigned parse_normals(const std::filesystem::path &path, const YAML::Node &yaml)
+{
+    const auto normals = yaml ? yaml.as<std::string>() : std::string("smooth");
+    if (normals == "smooth")
+        return aiProcess_GenSmoothNormals;
+    if (normals == "flat")
+        return aiProcess_GenNormals;
+    throw scene_error(path, yaml, "unknown normals " + normals + ", expected smooth or flat");
+}
+
+// spatial splits pay off for long thin triangles like walls and floors, duplication bounds the extra references
+static pathtracer::SceneBvh parse_bvh(const std::filesystem::path &path, const YAML::Node &yaml)
+{
+    pathtracer::SceneBvh bvh;
+
+    if (const auto split = yaml["bvh"])
+    {
+        const auto name = split.as<std::string>();
+        if (name == "spatial")
+            bvh.Split = pathtracer::BvhSplit::Spatial;
+        else if (name != "median")
+            throw scene_error(path, split, "unknown bvh " + name + ", expected median or spatial");
+    }
+
+    if (const auto duplication = yaml["duplication"])
+    {
+        bvh.Duplication = duplication.as<float>();
+        if (bvh.Duplication < 0.f)
+            throw scene_error(path, duplication, "duplication must not be negative");
+    }
+
+    if (const auto layout = yaml["layout"])
+    {
+        const auto name = layout.as<std::string>();
+        if (name == "build")
+            bvh.Layout = pathtracer::BvhLayout::Build;
+        else if (name != "depth_first")
+            throw scene_error(path, layout, "unknown layout " + name + ", expected depth_first or build");
+    }
+    return bvh;
+}
+
+pathtracer::SceneFile pathtracer::SceneFile::Load(const std::filesystem::path &path)
+{
+    const auto yaml = YAML::LoadFile(path.string());
+    const auto directory = path.parent_path();
+
+    SceneFile file;
+
+    // names only exist in the file, two names for the same source, flags and tree share one import
+    std::map<std::string, unsigned> mesh_names;
+    std::map<std::tuple<std::filesystem::path, unsigned, BvhSplit, float, BvhLayout>, unsigned> mesh_indices;
+    for (const auto &entry: yaml["meshes"])
+    {
+        const auto &node = entry.second;
+        SceneMesh mesh{
+            .Path = weakly_canonical(directory / (node.IsScalar() ? node : node["path"]).as<std::string>()),
+            .Flags = node.IsMap() ? parse_normals(path, node["normals"]) : aiProcess_GenSmoothNormals,
+            .Bvh = node.IsMap() ? parse_bvh(path, node) : SceneBvh{},
+        };
+
+        const auto [it, inserted] = mesh_indices.try_emplace(
+            {mesh.Path, mesh.Flags, mesh.Bvh.Split, mesh.Bvh.Duplication, mesh.Bvh.Layout},
+            file.Meshes.size());
+        if (inserted)
+            file.Meshes.push_back(std::move(mesh));
+        mesh_names[entry.first.as<std::string>()] = it->second;
+    }
+
+    std::map<std::string, int> material_names;
+    for (const auto &entry: yaml["materials"])
+    {
+        material_names[entry.first.as<std::string>()] = static_cast<int>(file.Materials.size());
+        file.Materials.push_back(parse_material(path, entry.second));
+    }
+
+    // tracks start from the transform of their instance, a key only has to name what it changes
+    std::map<std::string, unsigned> instance_names;
+    std::vector<SceneTransform> transforms;
+    for (const auto &node: yaml["instances"])
+    {
+        if (node["name"])
+            instance_names[node["name"].as<std::string>()] = static_cast<unsigned>(file.Instances.size());
+
+        const auto name = node["mesh"].as<std::string>();
+        const auto mesh = mesh_names.find(name);
+        if (mesh == mesh_names.end())
+            throw scene_error(path, node, "unknown mesh " + name);
+
+        SceneInstance instance{
+            .Mesh = mesh->second,
+            .Transform = transforms.emplace_back(parse_transform(path, node["transform"])).Matrix(),
+        };
+
+        // either the name of a shared material or an inline one for this instance alone
+        if (const auto material = node["material"]; material && material.IsScalar())
+        {
+            const auto it = material_names.find(material.as<std::string>());
+            if (it == material_names.end())
+                throw scene_error(path, material, "unknown material " + material.as<std::string>());
+            instance.Material = it->second;
+        }
+        else if (material)
+        {
+            instance.Material = static_cast<int>(file.Materials.size());
+            file.Materials.push_back(parse_material(path, material));
+        }
+
+        file.Instances.push_back(instance);
+    }
+
+    if (const auto camera = yaml["camera"])
+        file.Camera = parse_camera(path, camera);
+
+    if (const auto render = yaml["render"])
+    {
+        if (render["exposure"])
+            file.Render.Exposure = render["exposure"].as<float>();
+        if (render["tonemap"])
+            file.Render.Tonemap = render["tonemap"].as<std::string>();
+        if (render["error_threshold"])
+            file.Render.ErrorThreshold = render["error_threshold"].as<float>();
+        if (render["environment"])
+            file.Render.Environment = directory / render["environment"].as<std::string>();
+        if (render["environment_rotation"])
+            file.Render.EnvironmentRotation = render["environment_rotation"].as<float>();
+        if (render["permutations"])
+            file.Render.Permutations = render["permutations"].as<ShaderDefines>();
+    }
+
+    if (const auto animation = yaml["animation"])
+    {
+        SceneAnimation result;
+        if (animation["frames"])
+            result.Frames = animation["frames"].as<unsigned>();
+        if (animation["samples"])
+            result.Samples = animation["samples"].as<unsigned>();
+        if (animation["error_threshold"])
+            result.ErrorThreshold = animation["error_threshold"].as<float>();
+        if (!result.Frames || !result.Samples)
+            throw scene_error(path, animation, "frames and samples have to be positive");
+
+        // every camera key continues from the one before, so a key that only turns keeps its position
+        auto camera = file.Camera.value_or(SceneCamera{});
+        for (const auto &node: animation["camera"])
+        {
+            camera = parse_camera(path, node, camera);
+            result.Camera.push_back({node["frame"].as<float>(), camera});
+        }
+        std::ranges::stable_sort(result.Camera, {}, &CameraKey::Frame);
+
+        for (const auto &entry: animation["instances"])
+        {
+            const auto name = entry.first.as<std::string>();
+            const auto instance = instance_names.find(name);
+            if (instance == instance_names.end())
+                throw scene_error(path, entry.first, "unknown instance " + name);
+
+            InstanceTrack track{.Instance = instance->second};
+            for (const auto &node: entry.second)
+                track.Keys.push_back(
+                    {node["frame"].as<float>(), parse_transform(path, node, transforms[instance->second])});
+            if (track.Keys.empty())
+                throw scene_error(path, entry.second, "instance " + name + " has no keys");
+            std::ranges::stable_sort(track.Keys, {}, &TransformKey::Frame);
+            result.Instances.push_back(std::move(track));
+        }
+
+        file.Animation = std::move(result);
+    }
+
+    return file;
+}
+
+glm::mat4 pathtracer::SceneTransform::Matrix() const
+{
+    return translate(glm::mat4(1.f), Translate) * mat4_cast(Rotate) * scale(glm::mat4(1.f), Scale);
+}
+
+pathtracer::SceneCamera pathtracer::SceneAnimation::CameraAt(const float frame) const
+{
+    const auto &[previous, next, t] = find_keys(Camera, frame);
+    const auto &a = previous.Camera;
+    const auto &b = next.Camera;
+
+    // yaw turns the short way around, a target behind the camera would otherwise spin it
+    const auto yaw = std::fmod(b.Yaw - a.Yaw + 540.f, 360.f) - 180.f;
+    return {
+        .Position = mix(a.Position, b.Position, t),
+        .Yaw = a.Yaw + yaw * t,
+        .Pitch = glm::mix(a.Pitch, b.Pitch, t),
+        .Fov = glm::mix(a.Fov, b.Fov, t),
+    };
+}
+
+glm::mat4 pathtracer::SceneAnimation::TransformAt(const InstanceTrack &track, const float frame)
+{
+    const auto &[previous, next, t] = find_keys(track.Keys, frame);
+    const auto &a = previous.Transform;
+    const auto &b = next.Transform;
+    return SceneTransform{
+        .Translate = mix(a.Translate, b.Translate, t),
+        .Rotate = slerp(a.Rotate, b.Rotate, t),
+        .Scale = mix(a.Scale, b.Scale, t),
+    }.Matrix();
+}
@@ -1,28 +1,68 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <ranges>
+#include <regex>
+#include <unordered_map>
+#include <vector>
 #include <pathtracer/shader.hpp>
+#include <pathtracer/shader_preprocessor.hpp>
 #include <yaml-cpp/yaml.h>
 
-using namespace std::string_view_literals;
-
 struct StageInfo
 {
     std::vector<std::string> Vertex;
     std::vector<std::string> Fragment;
+    std::vector<std::string> Compute;
 };
 
+static std::vector<std::string> parse_stage(YAML::Node yaml)
+{
+    return yaml ? yaml.as<std::vector<std::string> >() : std::vector<std::string>();
+}
+
 static StageInfo parse_stage_info(YAML::Node yaml)
 {
     return {
-        .Vertex = yaml["vertex"].as<std::vector<std::string> >(),
-        .Fragment = yaml["fragment"].as<std::vector<std::string> >(),
+        .Vertex = parse_stage(yaml["vertex"]),
+        .Fragment = parse_stage(yaml["fragment"]),
+        .Compute = parse_stage(yaml["compute"]),
     };
 }
 
+static std::vector<pathtracer::ShaderPermutation> parse_permutations(YAML::Node yaml)
+{
+    std::vector<pathtracer::ShaderPermutation> permutations;
+    if (!yaml)
+        return permutations;
+
+    for (const auto &entry: yaml)
+    {
+        pathtracer::ShaderPermutation permutation{.Name = entry.first.as<std::string>()};
+        if (entry.second.IsSequence())
+            permutation.Values = entry.second.as<std::vector<std::string> >();
+        else
+            permutation.Values.push_back(entry.second.as<std::string>());
+
+        if (permutation.Values.empty())
+            throw std::runtime_error("permutation " + permutation.Name + " has no values");
+        permutations.push_back(std::move(permutation));
+    }
+    return permutations;
+}
+
 struct ShaderInfo
 {
     std::string ID;
     StageInfo Stages;
+    std::vector<pathtracer::ShaderPermutation> Permutations;
+    std::string Spirv;
+    std::map<std::string, GLuint> Specialization;
 };
 
 static ShaderInfo parse_shader_info(const std::filesystem::path &path)
@@ -30,114 +70,499 @@ static ShaderInfo parse_shader_info(const std::filesystem::path &path)
     auto yaml = YAML::LoadFile(path.string());
     return {
         .ID = yaml["id"].as<std::string>(),
-        .Stages = parse_stage_info(yaml["stages"])
+        .Stages = parse_stage_info(yaml["stages"]),
+        .Permutations = parse_permutations(yaml["permutations"]),
+        .Spirv = yaml["spirv"] ? yaml["spirv"].as<std::string>() : std::string(),
+        .Specialization = yaml["specialization"]
+                              ? yaml["specialization"].as<std::map<std::string, GLuint> >()
+                              : std::map<std::string, GLuint>(),
     };
 }
 
-std::string load_shader_source(const std::filesystem::path &path, const bool is_recursive_call = false)
+// true defines the bare key and false leaves it undefined, so #ifdef keeps working; numbers become the value
+// of the key, and any other word selects a variant as KEY_WORD
+static std::string define_block(const pathtracer::ShaderDefines &defines)
 {
-    constexpr auto include_keyword = "#include "sv;
+    std::string block;
+    for (const auto &[key, value]: defines)
+    {
+        if (value == "false")
+            continue;
 
-    std::string source;
-    std::ifstream stream(path);
+        if (value == "true")
+            block += "#define " + key + '\n';
+        else if (!value.empty() && (std::isdigit(value.front()) || value.front() == '-' || value.front() == '.'))
+            block += "#define " + key + ' ' + value + '\n';
+        else
+        {
+            auto name = key + '_' + value;
+            std::transform(
+                name.begin(),
+                name.end(),
+                name.begin(),
+                [](const unsigned char c) { return std::isalnum(c) ? std::toupper(c) : '_'; });
+            block += "#define " + name + '\n';
+        }
+    }
+    return block;
+}
 
-    if (!stream)
+static std::string shader_info_log(const GLuint shader)
+{
+    GLint length = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+
+    std::string message(std::max(length, 1), '\0');
+    glGetShaderInfoLog(shader, length, nullptr, message.data());
+    message.resize(std::max(length, 1) - 1);
+    return message;
+}
+
+static std::string program_info_log(const GLuint program)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+
+    std::string message(std::max(length, 1), '\0');
+    glGetProgramInfoLog(program, length, nullptr, message.data());
+    message.resize(std::max(length, 1) - 1);
+    return message;
+}
+
+static std::shared_ptr<pathtracer::ShaderUnit> make_unit(
+    const std::filesystem::path &path,
+    const GLenum type,
+    pathtracer::PreprocessedSource source,
+    const std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &reuse)
+{
+    // an identical expansion compiles to the same object, no matter which file triggered the rebuild
+    for (const auto &unit: reuse)
+        if (unit->Handle() && unit->GetPath() == path && unit->Matches(type, source.Source, source.Files))
+            return unit;
+
+    return std::make_shared<pathtracer::ShaderUnit>(path, type, std::move(source.Source), std::move(source.Files));
+}
+
+// separate mode compiles every file on its own and lets the linker resolve calls between them, single mode
+// concatenates the whole stage so the compiler sees every call site
+static void collect_units(
+    const std::filesystem::path &path,
+    const GLenum type,
+    const bool single,
+    pathtracer::ShaderPreprocessor &preprocessor,
+    const std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &reuse,
+    std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &units)
+{
+    std::vector<std::filesystem::path> files;
+    pathtracer::ShaderPreprocessor::Collect(path, files);
+
+    if (single)
     {
-        std::cerr << "failed to open shader file " << path << std::endl;
-        return source;
+        if (!files.empty())
+            units.push_back(make_unit(path.lexically_normal(), type, preprocessor.Process(files), reuse));
+        return;
     }
 
-    std::string line;
-    while (std::getline(stream, line))
+    for (const auto &file: files)
+        units.push_back(make_unit(file.lexically_normal(), type, preprocessor.Process(file), reuse));
+}
+
+static void link_program(
+    const GLuint program,
+    const std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &units,
+    const bool retrievable)
+{
+    for (const auto &unit: units)
     {
-        if (line.find(include_keyword) != std::string::npos)
-        {
-            line.erase(0, include_keyword.size());
+        if (!unit->Handle())
+            unit->Compile();
+        glAttachShader(program, unit->Handle());
+    }
 
-            auto filename = line.substr(1, line.length() - 2); // Get rid of "" or <>
-            source += load_shader_source(path.parent_path() / filename, true);
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
-            continue;
-        }
+    glLinkProgram(program);
+
+    // the units outlive the program, they are only detached so it does not keep them alive
+    for (const auto &unit: units)
+        glDetachShader(program, unit->Handle());
 
-        source += line + '\n';
+    {
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!status)
+            throw std::runtime_error("Failed to link program:\n" + program_info_log(program));
     }
+    glValidateProgram(program);
+    {
+        GLint status;
+        glGetProgramiv(program, GL_VALIDATE_STATUS, &status);
+        if (!status)
+            throw std::runtime_error("Failed to validate program:\n" + program_info_log(program));
+    }
+}
 
-    if (!is_recursive_call)
-        source += '\0';
+// booleans become 0 or 1, numbers are passed as they are and any other word as its index in the value list
+static GLuint specialization_value(const pathtracer::ShaderPermutation &permutation, const std::string &value)
+{
+    if (value == "true")
+        return 1;
+    if (value == "false")
+        return 0;
+    if (!value.empty() && (std::isdigit(value.front()) || value.front() == '-'))
+        return static_cast<GLuint>(std::stoi(value));
 
-    stream.close();
-    return source;
+    const auto it = std::find(permutation.Values.begin(), permutation.Values.end(), value);
+    return static_cast<GLuint>(it - permutation.Values.begin());
 }
 
-static void attach_shader(const GLuint program, const std::filesystem::path &path, const GLenum type)
+static GLuint load_spirv_shader(
+    const std::filesystem::path &path,
+    const GLenum type,
+    const std::vector<GLuint> &indices,
+    const std::vector<GLuint> &values)
 {
-    if (is_directory(path))
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        return 0;
+
+    std::vector<char> binary;
+    binary.assign(std::istreambuf_iterator(stream), std::istreambuf_iterator<char>());
+    if (binary.empty())
+        return 0;
+
+    const auto shader = glCreateShader(type);
+    glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, binary.data(), static_cast<GLsizei>(binary.size()));
+    glSpecializeShader(shader, "main", static_cast<GLuint>(indices.size()), indices.data(), values.data());
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status)
     {
-        for (const auto &entry: std::filesystem::directory_iterator(path))
-            attach_shader(program, entry.path(), type);
-        return;
+        std::cerr << "failed to specialize shader from " << path << ":\n" << shader_info_log(shader) << std::endl;
+        glDeleteShader(shader);
+        return 0;
     }
+    return shader;
+}
 
-    if (path.extension() != ".glsl")
-        return;
+// offline compiled stages live in <spirv>/<id>.<stage>.spv; they are skipped when any source file of the stage
+// is newer, so edits made while running fall back to compiling the sources
+static bool load_spirv_program(
+    const GLuint program,
+    const std::filesystem::path &directory,
+    const std::string &id,
+    const std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &units,
+    const std::vector<GLuint> &indices,
+    const std::vector<GLuint> &values)
+{
+    constexpr std::pair<GLenum, const char *> stages[]{
+        {GL_VERTEX_SHADER, "vertex"},
+        {GL_FRAGMENT_SHADER, "fragment"},
+        {GL_COMPUTE_SHADER, "compute"},
+    };
 
-    const auto source = load_shader_source(path);
-    const auto source_ptr = source.c_str();
+    std::vector<GLuint> shaders;
+    auto ok = true;
+    for (const auto &[type, name]: stages)
+    {
+        if (std::ranges::none_of(units, [type](const auto &unit) { return unit->GetType() == type; }))
+            continue;
 
-    const auto shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source_ptr, nullptr);
-    glCompileShader(shader);
+        const auto path = directory / (id + '.' + name + ".spv");
+
+        std::error_code ec;
+        const auto time = last_write_time(path, ec);
+        ok = !ec;
+        for (const auto &unit: units)
+            for (const auto &file: unit->GetFiles())
+                if (ok && unit->GetType() == type && last_write_time(file, ec) > time)
+                    ok = false;
+        if (!ok)
+            break;
+
+        const auto shader = load_spirv_shader(path, type, indices, values);
+        if (!(ok = shader != 0))
+            break;
+        shaders.push_back(shader);
+    }
+
+    if (ok)
     {
+        for (const auto shader: shaders)
+            glAttachShader(program, shader);
+        glLinkProgram(program);
+        for (const auto shader: shaders)
+            glDetachShader(program, shader);
+
         GLint status;
-        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-        if (!status)
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!(ok = status))
+            std::cerr << "failed to link spir-v program " << id << ":\n" << program_info_log(program) << std::endl;
+    }
+
+    for (const auto shader: shaders)
+        glDeleteShader(shader);
+    return ok;
+}
+
+// spir-v programs do not have to keep names, so uniforms are resolved through their explicit locations
+static std::unordered_map<std::string, GLint> reflect_locations(
+    const std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &units)
+{
+    static const std::regex uniform(R"(layout\s*\(\s*location\s*=\s*(\d+)\s*\)\s*uniform\s+\w+\s+(\w+))");
+
+    std::unordered_map<std::string, GLint> locations;
+    for (const auto &unit: units)
+    {
+        const auto &source = unit->GetSource();
+        for (std::sregex_iterator it(source.begin(), source.end(), uniform), end; it != end; ++it)
+            locations[(*it)[2].str()] = std::stoi((*it)[1].str());
+    }
+    return locations;
+}
+
+// fnv-1a over the preprocessed sources and the driver identity, any change in either misses the cache
+static std::uint64_t program_key(const std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &units)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    const auto feed = [&hash](const void *data, const size_t size)
+    {
+        for (size_t i = 0; i < size; ++i)
         {
-            GLsizei length;
-            GLchar message[512];
-            glGetShaderInfoLog(shader, 512, &length, message);
-            throw std::runtime_error("failed to compile shader from " + path.string() + ":\n" + message);
+            hash ^= static_cast<const unsigned char *>(data)[i];
+            hash *= 0x100000001b3ull;
         }
+    };
+
+    for (const auto name: {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        if (const auto string = reinterpret_cast<const char *>(glGetString(name)))
+            feed(string, std::strlen(string));
+
+    for (const auto &unit: units)
+    {
+        const auto type = unit->GetType();
+        feed(&type, sizeof(type));
+        feed(unit->GetSource().data(), unit->GetSource().size());
     }
 
-    glAttachShader(program, shader);
-    glDeleteShader(shader);
+    return hash;
 }
 
-pathtracer::Shader::Shader(const std::filesystem::path &path)
+static bool load_program_binary(const GLuint program, const std::filesystem::path &path)
 {
-    m_Handle = glCreateProgram();
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+        return false;
+
+    GLenum format;
+    std::vector<char> binary;
+    if (!stream.read(reinterpret_cast<char *>(&format), sizeof(format)))
+        return false;
+    binary.assign(std::istreambuf_iterator(stream), std::istreambuf_iterator<char>());
+    if (binary.empty())
+        return false;
 
-    const auto [ID, Stages] = parse_shader_info(path);
+    glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    return status;
+}
+
+static void store_program_binary(const GLuint program, const std::filesystem::path &path)
+{
+    GLint length;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    GLenum format;
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char *>(&format), sizeof(format));
+    stream.write(binary.data(), static_cast<std::streamsize>(binary.size()));
+}
+
+pathtracer::Shader::Shader(
+    const std::filesystem::path &path,
+    const std::filesystem::path &cache,
+    const ShaderDefines &defines,
+    const std::vector<std::shared_ptr<ShaderUnit> > &reuse)
+{
+    const auto [ID, Stages, Permutations, Spirv, Specialization] = parse_shader_info(path);
+
+    // only declared keys are accepted, so a typo cannot silently compile yet another variant
+    for (const auto &[Name, Values]: Permutations)
+    {
+        const auto it = defines.find(Name);
+        m_Defines[Name] = it == defines.end() ? Values.front() : it->second;
+    }
+    for (const auto &key: defines | std::views::keys)
+        if (!m_Defines.contains(key))
+            throw std::runtime_error("unknown shader permutation " + key + " for " + path.string());
+
+    const auto link = m_Defines.find("LINK");
+    const auto single = link != m_Defines.end() && link->second == "single";
+
+    ShaderPreprocessor preprocessor(define_block(m_Defines));
     for (const auto &filename: Stages.Vertex)
-        attach_shader(m_Handle, path.parent_path() / filename, GL_VERTEX_SHADER);
+        collect_units(path.parent_path() / filename, GL_VERTEX_SHADER, single, preprocessor, reuse, m_Units);
     for (const auto &filename: Stages.Fragment)
-        attach_shader(m_Handle, path.parent_path() / filename, GL_FRAGMENT_SHADER);
+        collect_units(path.parent_path() / filename, GL_FRAGMENT_SHADER, single, preprocessor, reuse, m_Units);
+    for (const auto &filename: Stages.Compute)
+        collect_units(path.parent_path() / filename, GL_COMPUTE_SHADER, single, preprocessor, reuse, m_Units);
+
+    for (const auto *stage: {&Stages.Vertex, &Stages.Fragment, &Stages.Compute})
+        for (const auto &filename: *stage)
+            if (const auto stage_path = (path.parent_path() / filename).lexically_normal(); is_directory(stage_path))
+                m_StageDirectories.push_back(stage_path);
+
+    // the union of every unit's include graph
+    m_Dependencies.push_back(path.lexically_normal());
+    for (const auto &unit: m_Units)
+        for (const auto &file: unit->GetFiles())
+            if (std::find(m_Dependencies.begin(), m_Dependencies.end(), file) == m_Dependencies.end())
+                m_Dependencies.push_back(file);
 
-    glLinkProgram(m_Handle);
+    m_Handle = glCreateProgram();
+
+    if (!Spirv.empty() && GLEW_VERSION_4_6)
     {
-        GLint status;
-        glGetProgramiv(m_Handle, GL_LINK_STATUS, &status);
-        if (!status)
-        {
-            GLsizei length;
-            GLchar message[512];
-            glGetProgramInfoLog(m_Handle, 512, &length, message);
-            throw std::runtime_error(std::string("Failed to link program:\n") + message);
-        }
+        std::vector<GLuint> indices;
+        std::vector<GLuint> values;
+        for (const auto &permutation: Permutations)
+            if (const auto it = Specialization.find(permutation.Name); it != Specialization.end())
+            {
+                indices.push_back(it->second);
+                values.push_back(specialization_value(permutation, m_Defines.at(permutation.Name)));
+            }
+
+        // the stages the build compiled into its own tree come first, then those installed next to the yaml
+        std::vector<std::filesystem::path> directories;
+#ifdef PATHTRACER_SPIRV_DIRECTORY
+        directories.emplace_back(PATHTRACER_SPIRV_DIRECTORY);
+#endif
+        directories.push_back(path.parent_path() / Spirv);
+
+        for (const auto &directory: directories)
+            if (load_spirv_program(m_Handle, directory, ID, m_Units, indices, values))
+            {
+                m_Spirv = true;
+                m_Locations = reflect_locations(m_Units);
+                return;
+            }
+    }
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    std::filesystem::path binary_path;
+    if (!cache.empty() && formats > 0)
+    {
+        char key[17];
+        std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(program_key(m_Units)));
+        binary_path = cache / (ID + '-' + key + ".bin");
+
+        if (load_program_binary(m_Handle, binary_path))
+            return;
+    }
+
+    try
+    {
+        link_program(m_Handle, m_Units, !binary_path.empty());
     }
-    glValidateProgram(m_Handle);
+    catch (...)
+    {
+        glDeleteProgram(m_Handle);
+        throw;
+    }
+
+    if (!binary_path.empty())
+        store_program_binary(m_Handle, binary_path);
+}
+
+pathtracer::ShaderUnit::ShaderUnit(
+    std::filesystem::path path,
+    const GLenum type,
+    std::string source,
+    std::vector<std::filesystem::path> files)
+    : m_Path(std::move(path)),
+      m_Type(type),
+      m_Source(std::move(source)),
+      m_Files(std::move(files))
+{
+}
+
+pathtracer::ShaderUnit::~ShaderUnit()
+{
+    if (m_Handle)
+        glDeleteShader(m_Handle);
+}
+
+void pathtracer::ShaderUnit::Compile()
+{
+    const auto source_ptr = m_Source.c_str();
+
+    const auto shader = glCreateShader(m_Type);
+    glShaderSource(shader, 1, &source_ptr, nullptr);
+    glCompileShader(shader);
     {
         GLint status;
-        glGetProgramiv(m_Handle, GL_VALIDATE_STATUS, &status);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
         if (!status)
         {
-            GLsizei length;
-            GLchar message[512];
-            glGetProgramInfoLog(m_Handle, 512, &length, message);
-            throw std::runtime_error(std::string("Failed to validate program:\n") + message);
+            const auto message = ShaderPreprocessor::MapLog(shader_info_log(shader), m_Files);
+            glDeleteShader(shader);
+            throw std::runtime_error("failed to compile shader from " + m_Path.string() + ":\n" + message);
         }
     }
+
+    m_Handle = shader;
+}
+
+bool pathtracer::ShaderUnit::Matches(
+    const GLenum type,
+    const std::string &source,
+    const std::vector<std::filesystem::path> &files) const
+{
+    return m_Type == type && m_Source == source && m_Files == files;
+}
+
+const std::filesystem::path &pathtracer::ShaderUnit::GetPath() const
+{
+    return m_Path;
+}
+
+GLenum pathtracer::ShaderUnit::GetType() const
+{
+    return m_Type;
+}
+
+const std::string &pathtracer::ShaderUnit::GetSource() const
+{
+    return m_Source;
+}
+
+const std::vector<std::filesystem::path> &pathtracer::ShaderUnit::GetFiles() const
+{
+    return m_Files;
+}
+
+GLuint pathtracer::ShaderUnit::Handle() const
+{
+    return m_Handle;
+}
+
+std::vector<pathtracer::ShaderPermutation> pathtracer::Shader::LoadPermutations(const std::filesystem::path &path)
+{
+    return parse_shader_info(path).Permutations;
 }
 
 pathtracer::Shader::~Shader()
@@ -157,5 +582,37 @@ void pathtracer::Shader::Unbind() const
 
 void pathtracer::Shader::SetUniform(const std::string &name, const UniformConsumer &consumer) const
 {
+    if (m_Spirv)
+    {
+        const auto it = m_Locations.find(name);
+        consumer(it == m_Locations.end() ? -1 : it->second);
+        return;
+    }
+
     consumer(glGetUniformLocation(m_Handle, name.c_str()));
 }
+
+const std::vector<std::filesystem::path> &pathtracer::Shader::GetDependencies() const
+{
+    return m_Dependencies;
+}
+
+const std::vector<std::filesystem::path> &pathtracer::Shader::GetStageDirectories() const
+{
+    return m_StageDirectories;
+}
+
+const pathtracer::ShaderDefines &pathtracer::Shader::GetDefines() const
+{
+    return m_Defines;
+}
+
+const std::vector<std::shared_ptr<pathtracer::ShaderUnit> > &pathtracer::Shader::GetUnits() const
+{
+    return m_Units;
+}
+
+bool pathtracer::Shader::IsSpirv() const
+{
+    return m_Spirv;
+}
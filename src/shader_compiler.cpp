@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <pathtracer/shader_compiler.hpp>
+
+pathtracer::ShaderCompiler::ShaderCompiler(GLFWwindow *share)
+{
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_DEBUG, GLFW_TRUE);
+
+    m_Context = glfwCreateWindow(1, 1, "", nullptr, share);
+    glfwDefaultWindowHints();
+    if (!m_Context)
+        throw std::runtime_error("failed to create shader compiler context");
+
+    m_Thread = std::thread(&ShaderCompiler::Run, this);
+}
+
+pathtracer::ShaderCompiler::~ShaderCompiler()
+{
+    {
+        std::lock_guard lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_Condition.notify_all();
+    m_Thread.join();
+
+    glfwDestroyWindow(m_Context);
+}
+
+void pathtracer::ShaderCompiler::Submit(ShaderRequest request)
+{
+    {
+        std::lock_guard lock(m_Mutex);
+        const auto it = std::ranges::find(m_Requests, request.Path, &ShaderRequest::Path);
+        if (it != m_Requests.end())
+            *it = std::move(request);
+        else
+            m_Requests.push_back(std::move(request));
+    }
+    m_Condition.notify_one();
+}
+
+bool pathtracer::ShaderCompiler::Poll(ShaderResult &result)
+{
+    std::lock_guard lock(m_Mutex);
+    if (m_Results.empty())
+        return false;
+
+    result = std::move(m_Results.front());
+    m_Results.pop_front();
+    return true;
+}
+
+bool pathtracer::ShaderCompiler::IsBusy() const
+{
+    std::lock_guard lock(m_Mutex);
+    return m_Busy || !m_Requests.empty();
+}
+
+void pathtracer::ShaderCompiler::Run()
+{
+    glfwMakeContextCurrent(m_Context);
+
+    for (;;)
+    {
+        ShaderRequest request;
+        {
+            std::unique_lock lock(m_Mutex);
+            m_Condition.wait(lock, [this] { return m_Stop || !m_Requests.empty(); });
+            if (m_Stop)
+                break;
+
+            request = std::move(m_Requests.front());
+            m_Requests.pop_front();
+            m_Busy = true;
+        }
+
+        ShaderResult result{.Path = request.Path, .Defines = request.Defines};
+        try
+        {
+            result.Program = std::make_unique<Shader>(request.Path, request.Cache, request.Defines, request.Reuse);
+
+            // the program is shared, but the main context may only use it once the link has fully completed
+            glFinish();
+        }
+        catch (const std::exception &error)
+        {
+            result.Error = error.what();
+        }
+
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Results.push_back(std::move(result));
+            m_Busy = false;
+        }
+    }
+
+    glfwMakeContextCurrent(nullptr);
+}
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <pathtracer/shader_limits.hpp>
+#include <pathtracer/shader_preprocessor.hpp>
+
+// returns whether a block comment is still open at the end of the line
+static bool scan_comments(const std::string_view line, bool in_comment)
+{
+    for (size_t i = 0; i + 1 < line.size(); ++i)
+    {
+        if (in_comment)
+        {
+            if (line[i] == '*' && line[i + 1] == '/')
+            {
+                in_comment = false;
+                ++i;
+            }
+            continue;
+        }
+
+        if (line[i] == '/' && line[i + 1] == '/')
+            return false;
+        if (line[i] == '/' && line[i + 1] == '*')
+        {
+            in_comment = true;
+            ++i;
+        }
+    }
+    return in_comment;
+}
+
+// the directive name of a line that starts with '#', or an empty string for anything else
+static std::string_view directive_name(const std::string_view line, size_t &end)
+{
+    auto pos = line.find_first_not_of(" \t");
+    if (pos == std::string_view::npos || line[pos] != '#')
+        return {};
+
+    pos = line.find_first_not_of(" \t", pos + 1);
+    if (pos == std::string_view::npos)
+        return {};
+
+    end = pos;
+    while (end < line.size() && std::isalpha(static_cast<unsigned char>(line[end])))
+        ++end;
+    return line.substr(pos, end - pos);
+}
+
+pathtracer::ShaderPreprocessor::ShaderPreprocessor(std::string defines)
+    : m_Defines("#define BVH_STACK_SIZE (" + std::to_string(BVH_STACK_SIZE) + ")\n" + std::move(defines))
+{
+}
+
+pathtracer::PreprocessedSource pathtracer::ShaderPreprocessor::Process(const std::filesystem::path &path)
+{
+    return Process(std::vector{path});
+}
+
+pathtracer::PreprocessedSource pathtracer::ShaderPreprocessor::Process(const std::vector<std::filesystem::path> &paths)
+{
+    PreprocessedSource result;
+    std::set<std::filesystem::path> included;
+    auto version = false;
+
+    for (const auto &path: paths)
+        if (const auto normal = path.lexically_normal(); included.insert(normal).second)
+            Expand(normal, result, included, version);
+
+    if (!version)
+        result.Source.insert(0, m_Defines);
+
+    return result;
+}
+
+void pathtracer::ShaderPreprocessor::Collect(
+    const std::filesystem::path &path,
+    std::vector<std::filesystem::path> &files)
+{
+    if (is_directory(path))
+    {
+        std::vector<std::filesystem::path> entries;
+        for (const auto &entry: std::filesystem::directory_iterator(path))
+            entries.push_back(entry.path());
+
+        // directory order is unspecified, sort it so cache keys and bundles are stable
+        std::sort(entries.begin(), entries.end());
+        for (const auto &entry: entries)
+            Collect(entry, files);
+        return;
+    }
+
+    if (path.extension() == ".glsl")
+        files.push_back(path);
+}
+
+std::string pathtracer::ShaderPreprocessor::MapLog(
+    const std::string &log,
+    const std::vector<std::filesystem::path> &files)
+{
+    // covers "0:12:" (amd), "0:12(5):" (mesa) and "0(12) :" (nvidia)
+    static const std::regex location(R"((\d+)(?::(\d+)|\((\d+)\)))");
+
+    std::string result;
+    std::istringstream stream(log);
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        if (std::smatch match; std::regex_search(line, match, location))
+        {
+            const auto id = std::stoul(match[1].str());
+            const auto number = match[2].matched ? match[2].str() : match[3].str();
+            if (id < files.size())
+                line = match.prefix().str() + files[id].string() + ':' + number + match.suffix().str();
+        }
+        result += line + '\n';
+    }
+    return result;
+}
+
+const pathtracer::ShaderPreprocessor::ParsedFile &pathtracer::ShaderPreprocessor::Parse(
+    const std::filesystem::path &path)
+{
+    const auto key = path.string();
+    if (const auto it = m_Parsed.find(key); it != m_Parsed.end())
+        return it->second;
+
+    std::ifstream stream(path);
+    if (!stream)
+        throw std::runtime_error("failed to open shader file " + key);
+
+    ParsedFile file;
+    std::string text;
+    unsigned text_line = 1;
+    unsigned number = 0;
+    auto in_comment = false;
+
+    const auto flush = [&]
+    {
+        if (!text.empty())
+            file.Segments.push_back({SegmentType::Text, text_line, std::move(text)});
+        text.clear();
+    };
+
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        ++number;
+
+        size_t end;
+        if (const auto name = in_comment ? std::string_view() : directive_name(line, end); name == "include")
+        {
+            const auto open = line.find_first_of("\"<", end);
+            const auto close = open == std::string::npos
+                                   ? std::string::npos
+                                   : line.find(line[open] == '<' ? '>' : '"', open + 1);
+            if (close == std::string::npos)
+                throw std::runtime_error(key + ':' + std::to_string(number) + ": malformed #include");
+
+            flush();
+            file.Segments.push_back({SegmentType::Include, number, line.substr(open + 1, close - open - 1)});
+            in_comment = scan_comments(std::string_view(line).substr(close + 1), false);
+            continue;
+        }
+        else if (name == "version")
+        {
+            flush();
+            file.Segments.push_back({SegmentType::Version, number, line});
+            continue;
+        }
+
+        in_comment = scan_comments(line, in_comment);
+
+        if (text.empty())
+            text_line = number;
+        text += line;
+        text += '\n';
+    }
+    flush();
+
+    return m_Parsed.emplace(key, std::move(file)).first->second;
+}
+
+void pathtracer::ShaderPreprocessor::Expand(
+    const std::filesystem::path &path,
+    PreprocessedSource &result,
+    std::set<std::filesystem::path> &included,
+    bool &version)
+{
+    const auto id = std::to_string(result.Files.size());
+    result.Files.push_back(path);
+
+    const auto &segments = Parse(path).Segments;
+
+    // nothing but comments may precede #version, so the first #line has to wait for it
+    auto version_pending = !version && std::ranges::any_of(
+                               segments,
+                               [](const Segment &segment) { return segment.Type == SegmentType::Version; });
+
+    for (const auto &[Type, Line, Text]: segments)
+    {
+        switch (Type)
+        {
+        case SegmentType::Text:
+            if (!version_pending)
+                result.Source += "#line " + std::to_string(Line) + ' ' + id + '\n';
+            result.Source += Text;
+            break;
+
+        case SegmentType::Version:
+            // only the first one is kept when files are concatenated
+            if (!version)
+            {
+                result.Source += Text + '\n' + m_Defines;
+                version = true;
+                version_pending = false;
+            }
+            break;
+
+        case SegmentType::Include:
+        {
+            const auto include = (path.parent_path() / Text).lexically_normal();
+            if (!included.insert(include).second)
+                break;
+
+            if (!exists(include))
+                throw std::runtime_error(
+                    path.string() + ':' + std::to_string(Line) + ": cannot open include " + include.string());
+
+            Expand(include, result, included, version);
+            break;
+        }
+        }
+    }
+}
@@ -0,0 +1,781 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stb_image.h>
+#include <pathtracer/texture_cache.hpp>
+
+using pathtracer::TextureCache;
+
+static constexpr char MAGIC[4]{'P', 'T', 'V', 'T'};
+static constexpr std::uint32_t VERSION = 1;
+
+static unsigned level_count(const unsigned size)
+{
+    if (size <= TextureCache::TILE_SIZE)
+        return 1;
+    return std::countr_zero(size / TextureCache::TILE_SIZE) + 1;
+}
+
+static unsigned level_grid(const unsigned size, const unsigned level)
+{
+    return std::max((size >> level) / TextureCache::TILE_SIZE, 1u);
+}
+
+static unsigned entry_count(const unsigned size, const unsigned levels)
+{
+    unsigned count = 0;
+    for (unsigned level = 0; level < levels; ++level)
+        count += level_grid(size, level) * level_grid(size, level);
+    return count;
+}
+
+static void source_stamp(const std::filesystem::path &path, std::uint64_t &time, std::uint64_t &size)
+{
+    std::error_code ec;
+    time = static_cast<std::uint64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+    size = ec ? 0 : static_cast<std::uint64_t>(std::filesystem::file_size(path, ec));
+}
+
+static bool read_header(const std::filesystem::path &cache, const std::filesystem::path &source, pathtracer::TextureCacheHeader &header)
+{
+    std::ifstream stream(cache, std::ios::binary);
+    if (!stream || !stream.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+
+    std::uint64_t time, size;
+    source_stamp(source, time, size);
+
+    return std::memcmp(header.Magic, MAGIC, sizeof(MAGIC)) == 0
+           && header.Version == VERSION
+           && header.SourceTime == time
+           && header.SourceSize == size;
+}
+
+// bilinear with wrap-around, rows are flipped so that row 0 ends up at v = 0
+static void resample(
+    const unsigned char *src,
+    const int src_width,
+    const int src_height,
+    unsigned char *dst,
+    const int dst_size)
+{
+    for (int y = 0; y < dst_size; ++y)
+    {
+        const auto fy = (static_cast<float>(y) + 0.5f) / static_cast<float>(dst_size) * static_cast<float>(src_height)
+                        - 0.5f;
+        const auto y0 = static_cast<int>(std::floor(fy));
+        const auto ty = fy - static_cast<float>(y0);
+        const auto row0 = src_height - 1 - (y0 % src_height + src_height) % src_height;
+        const auto row1 = src_height - 1 - ((y0 + 1) % src_height + src_height) % src_height;
+
+        for (int x = 0; x < dst_size; ++x)
+        {
+            const auto fx = (static_cast<float>(x) + 0.5f) / static_cast<float>(dst_size) * static_cast<float>(src_width)
+                            - 0.5f;
+            const auto x0 = static_cast<int>(std::floor(fx));
+            const auto tx = fx - static_cast<float>(x0);
+            const auto col0 = (x0 % src_width + src_width) % src_width;
+            const auto col1 = ((x0 + 1) % src_width + src_width) % src_width;
+
+            for (int c = 0; c < 4; ++c)
+            {
+                const float p00 = src[(row0 * src_width + col0) * 4 + c];
+                const float p01 = src[(row0 * src_width + col1) * 4 + c];
+                const float p10 = src[(row1 * src_width + col0) * 4 + c];
+                const float p11 = src[(row1 * src_width + col1) * 4 + c];
+
+                const auto top = p00 + (p01 - p00) * tx;
+                const auto bottom = p10 + (p11 - p10) * tx;
+                dst[(y * dst_size + x) * 4 + c] = static_cast<unsigned char>(top + (bottom - top) * ty + 0.5f);
+            }
+        }
+    }
+}
+
+static std::vector<unsigned char> downsample(const std::vector<unsigned char> &src, const unsigned size)
+{
+    const auto half = size / 2;
+    std::vector<unsigned char> dst(static_cast<size_t>(half) * half * 4);
+    for (unsigned y = 0; y < half; ++y)
+        for (unsigned x = 0; x < half; ++x)
+            for (unsigned c = 0; c < 4; ++c)
+            {
+                const auto sum = src[((2 * y) * size + 2 * x) * 4 + c]
+                                 + src[((2 * y) * size + 2 * x + 1) * 4 + c]
+                                 + src[((2 * y + 1) * size + 2 * x) * 4 + c]
+                                 + src[((2 * y + 1) * size + 2 * x + 1) * 4 + c];
+                dst[(y * half + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+    return dst;
+}
+
+static std::uint16_t pack_565(const float *color)
+{
+    const auto r = static_cast<unsigned>(std::clamp(color[0], 0.f, 255.f) * 31.f / 255.f + 0.5f);
+    const auto g = static_cast<unsigned>(std::clamp(color[1], 0.f, 255.f) * 63.f / 255.f + 0.5f);
+    const auto b = static_cast<unsigned>(std::clamp(color[2], 0.f, 255.f) * 31.f / 255.f + 0.5f);
+    return static_cast<std::uint16_t>(r << 11 | g << 5 | b);
+}
+
+static void unpack_565(const std::uint16_t packed, float *color)
+{
+    color[0] = static_cast<float>(packed >> 11 & 31) * 255.f / 31.f;
+    color[1] = static_cast<float>(packed >> 5 & 63) * 255.f / 63.f;
+    color[2] = static_cast<float>(packed & 31) * 255.f / 31.f;
+}
+
+// endpoints are the extreme texels along the principal axis of the block colors
+static void encode_bc1_block(const unsigned char *texels, unsigned char *out)
+{
+    float mean[3]{};
+    for (unsigned i = 0; i < 16; ++i)
+        for (unsigned c = 0; c < 3; ++c)
+            mean[c] += texels[i * 4 + c] / 16.f;
+
+    float covariance[6]{};
+    for (unsigned i = 0; i < 16; ++i)
+    {
+        const float r = texels[i * 4 + 0] - mean[0];
+        const float g = texels[i * 4 + 1] - mean[1];
+        const float b = texels[i * 4 + 2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    float axis[3]{1.f, 1.f, 1.f};
+    for (unsigned iteration = 0; iteration < 4; ++iteration)
+    {
+        const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        const auto length = std::max({std::abs(x), std::abs(y), std::abs(z)});
+        if (length <= 0.f)
+            break;
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+
+    unsigned min_index = 0, max_index = 0;
+    auto min_projection = std::numeric_limits<float>::infinity();
+    auto max_projection = -std::numeric_limits<float>::infinity();
+    for (unsigned i = 0; i < 16; ++i)
+    {
+        const auto projection = texels[i * 4 + 0] * axis[0] + texels[i * 4 + 1] * axis[1] + texels[i * 4 + 2] *
+                                axis[2];
+        if (projection < min_projection)
+        {
+            min_projection = projection;
+            min_index = i;
+        }
+        if (projection > max_projection)
+        {
+            max_projection = projection;
+            max_index = i;
+        }
+    }
+
+    const float max_color[3]{
+        static_cast<float>(texels[max_index * 4 + 0]),
+        static_cast<float>(texels[max_index * 4 + 1]),
+        static_cast<float>(texels[max_index * 4 + 2]),
+    };
+    const float min_color[3]{
+        static_cast<float>(texels[min_index * 4 + 0]),
+        static_cast<float>(texels[min_index * 4 + 1]),
+        static_cast<float>(texels[min_index * 4 + 2]),
+    };
+
+    auto c0 = pack_565(max_color);
+    auto c1 = pack_565(min_color);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    std::uint32_t indices = 0;
+    if (c0 != c1)
+    {
+        float palette[4][3];
+        unpack_565(c0, palette[0]);
+        unpack_565(c1, palette[1]);
+        for (unsigned c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+            palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+        }
+
+        for (unsigned i = 0; i < 16; ++i)
+        {
+            unsigned best = 0;
+            auto best_distance = std::numeric_limits<float>::infinity();
+            for (unsigned p = 0; p < 4; ++p)
+            {
+                float distance = 0.f;
+                for (unsigned c = 0; c < 3; ++c)
+                {
+                    const auto d = texels[i * 4 + c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < best_distance)
+                {
+                    best_distance = distance;
+                    best = p;
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+
+    out[0] = c0 & 0xff;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xff;
+    out[3] = c1 >> 8;
+    out[4] = indices & 0xff;
+    out[5] = indices >> 8 & 0xff;
+    out[6] = indices >> 16 & 0xff;
+    out[7] = indices >> 24 & 0xff;
+}
+
+// one tile of a level with a wrapped border, so bilinear filtering inside the atlas never crosses tiles
+static void encode_tile(
+    const std::vector<unsigned char> &level,
+    const unsigned size,
+    const unsigned tx,
+    const unsigned ty,
+    unsigned char *out)
+{
+    constexpr auto stride = TextureCache::TILE_STRIDE;
+    constexpr auto blocks = stride / 4;
+
+    unsigned char texels[16 * 4];
+    for (unsigned by = 0; by < blocks; ++by)
+        for (unsigned bx = 0; bx < blocks; ++bx)
+        {
+            for (unsigned i = 0; i < 16; ++i)
+            {
+                const auto x = static_cast<int>(tx * TextureCache::TILE_SIZE + bx * 4 + i % 4)
+                               - static_cast<int>(TextureCache::TILE_BORDER);
+                const auto y = static_cast<int>(ty * TextureCache::TILE_SIZE + by * 4 + i / 4)
+                               - static_cast<int>(TextureCache::TILE_BORDER);
+                const auto sx = (x % static_cast<int>(size) + size) % size;
+                const auto sy = (y % static_cast<int>(size) + size) % size;
+                std::memcpy(texels + i * 4, level.data() + (static_cast<size_t>(sy) * size + sx) * 4, 4);
+            }
+            encode_bc1_block(texels, out + (by * blocks + bx) * 8);
+        }
+}
+
+static bool convert(const std::filesystem::path &source, const std::filesystem::path &cache, const unsigned size)
+{
+    int width, height;
+    const auto pixels = stbi_load(source.string().c_str(), &width, &height, nullptr, 4);
+    if (!pixels)
+    {
+        std::cerr << "failed to load texture " << source << ": " << stbi_failure_reason() << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> level(static_cast<size_t>(size) * size * 4);
+    resample(pixels, width, height, level.data(), static_cast<int>(size));
+    stbi_image_free(pixels);
+
+    pathtracer::TextureCacheHeader header{};
+    std::memcpy(header.Magic, MAGIC, sizeof(MAGIC));
+    header.Version = VERSION;
+    header.Size = size;
+    header.Levels = level_count(size);
+    source_stamp(source, header.SourceTime, header.SourceSize);
+
+    auto temporary = cache;
+    temporary += ".tmp";
+
+    std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    std::vector<unsigned char> tile(TextureCache::TILE_BYTES);
+    auto level_size = size;
+    for (unsigned l = 0; l < header.Levels; ++l)
+    {
+        const auto grid = level_grid(size, l);
+        for (unsigned ty = 0; ty < grid; ++ty)
+            for (unsigned tx = 0; tx < grid; ++tx)
+            {
+                encode_tile(level, level_size, tx, ty, tile.data());
+                stream.write(reinterpret_cast<const char *>(tile.data()), static_cast<std::streamsize>(tile.size()));
+            }
+
+        if (l + 1 < header.Levels)
+        {
+            level = downsample(level, level_size);
+            level_size /= 2;
+        }
+    }
+
+    if (!stream)
+    {
+        std::cerr << "failed to write texture cache " << temporary << std::endl;
+        return false;
+    }
+    stream.close();
+
+    std::error_code ec;
+    std::filesystem::rename(temporary, cache, ec);
+    return !ec;
+}
+
+pathtracer::TextureCache::TextureCache(ThreadPool &pool, std::filesystem::path directory, const size_t budget)
+    : m_Pool(pool),
+      m_Directory(std::move(directory)),
+      m_Budget(budget),
+      m_PageTableBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW),
+      m_FeedbackBuffer(GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY)
+{
+}
+
+pathtracer::TextureCache::~TextureCache()
+{
+    for (auto &texture: m_Textures)
+        if (texture.Conversion.valid())
+            texture.Conversion.wait();
+    for (auto &load: m_Loads)
+        load.Data.wait();
+
+    for (auto &readback: m_Readbacks)
+    {
+        if (readback.Fence)
+            glDeleteSync(readback.Fence);
+        if (readback.Handle)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readback.Handle);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &readback.Handle);
+        }
+    }
+
+    if (m_Atlas)
+        glDeleteTextures(1, &m_Atlas);
+}
+
+int pathtracer::TextureCache::Request(const std::filesystem::path &path)
+{
+    std::error_code ec;
+    auto canonical = std::filesystem::weakly_canonical(path, ec);
+    const auto key = (ec ? path : canonical).string();
+
+    if (const auto it = m_Indices.find(key); it != m_Indices.end())
+        return it->second;
+
+    const auto index = static_cast<int>(m_Textures.size());
+    auto &texture = m_Textures.emplace_back();
+    texture.Source = key;
+    texture.Cache = m_Directory / (std::to_string(std::hash<std::string>()(key)) + ".ptvt");
+    m_Indices.emplace(key, index);
+    return index;
+}
+
+void pathtracer::TextureCache::Upload()
+{
+    if (m_Textures.empty() || m_Atlas)
+        return;
+
+    std::filesystem::create_directories(m_Directory);
+
+    for (auto &texture: m_Textures)
+    {
+        texture.FirstEntry = m_Entries.size();
+
+        if (TextureCacheHeader header{}; read_header(texture.Cache, texture.Source, header))
+        {
+            texture.Size = header.Size;
+        }
+        else if (int width, height, channels;
+            stbi_info(texture.Source.string().c_str(), &width, &height, &channels))
+        {
+            texture.Size = std::clamp(std::bit_ceil(static_cast<unsigned>(std::max(width, height))), 4u, MAX_SIZE);
+            texture.Conversion = m_Pool.Submit(
+                [source = texture.Source, cache = texture.Cache, size = texture.Size]
+                {
+                    return convert(source, cache, size);
+                });
+        }
+        else
+        {
+            std::cerr << "failed to load texture " << texture.Source << ": " << stbi_failure_reason() << std::endl;
+            continue;
+        }
+
+        texture.Levels = level_count(texture.Size);
+        texture.EntryCount = entry_count(texture.Size, texture.Levels);
+
+        const auto index = static_cast<unsigned>(&texture - m_Textures.data());
+        m_Entries.resize(m_Entries.size() + texture.EntryCount, Entry{.Texture = index});
+        m_Entries.back().Pinned = true;
+    }
+
+    constexpr auto page_slots = PAGE_TILES * PAGE_TILES;
+    const auto minimum = static_cast<unsigned>(m_Textures.size()) + MAX_LOADS;
+    const auto slots = std::max(static_cast<unsigned>(m_Budget / TILE_BYTES), minimum);
+    const auto pages = (slots + page_slots - 1) / page_slots;
+    m_SlotCount = pages * page_slots;
+
+    glGenTextures(1, &m_Atlas);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_Atlas);
+    glTexStorage3D(
+        GL_TEXTURE_2D_ARRAY,
+        1,
+        GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,
+        PAGE_TILES * TILE_STRIDE,
+        PAGE_TILES * TILE_STRIDE,
+        static_cast<GLsizei>(pages));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    m_SlotEntry.assign(m_SlotCount, NOT_RESIDENT);
+    m_SlotUsage.assign(m_SlotCount, 0);
+    m_FreeSlots.clear();
+    for (auto slot = m_SlotCount; slot > 0; --slot)
+        m_FreeSlots.push_back(slot - 1);
+
+    std::vector<std::uint32_t> page_table(m_Textures.size() * 4 + m_Entries.size(), NOT_RESIDENT);
+    for (size_t i = 0; i < m_Textures.size(); ++i)
+    {
+        page_table[i * 4 + 0] = level_grid(m_Textures[i].Size, 0);
+        page_table[i * 4 + 1] = 0;
+        page_table[i * 4 + 2] = m_Textures[i].FirstEntry;
+        page_table[i * 4 + 3] = m_Textures[i].Size;
+    }
+    m_PageTableBuffer.Bind();
+    m_PageTableBuffer.Data(static_cast<GLsizeiptr>(page_table.size() * sizeof(std::uint32_t)), page_table.data());
+    m_PageTableBuffer.Unbind();
+
+    m_FlagWords = (m_Entries.size() + 31) / 32;
+    const std::vector<std::uint32_t> feedback(1 + MAX_REQUESTS + m_FlagWords + m_SlotCount, 0);
+    m_FeedbackBuffer.Bind();
+    m_FeedbackBuffer.Data(static_cast<GLsizeiptr>(feedback.size() * sizeof(std::uint32_t)), feedback.data());
+    m_FeedbackBuffer.Unbind();
+
+    const auto readback_size = static_cast<GLsizeiptr>((1 + MAX_REQUESTS + m_SlotCount) * sizeof(std::uint32_t));
+    constexpr GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (auto &readback: m_Readbacks)
+    {
+        glGenBuffers(1, &readback.Handle);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback.Handle);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, readback_size, nullptr, flags);
+        readback.Mapped = static_cast<const std::uint32_t *>(glMapBufferRange(
+            GL_COPY_WRITE_BUFFER,
+            0,
+            readback_size,
+            flags));
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    m_PageTableBuffer.BindBase(4);
+    m_FeedbackBuffer.BindBase(5);
+}
+
+bool pathtracer::TextureCache::Poll()
+{
+    if (!m_Atlas)
+        return false;
+
+    ++m_Frame;
+    m_Uploaded = false;
+
+    for (auto &texture: m_Textures)
+    {
+        if (texture.Ready || !texture.EntryCount)
+            continue;
+
+        if (texture.Conversion.valid())
+        {
+            if (texture.Conversion.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                continue;
+            if (!texture.Conversion.get())
+            {
+                texture.EntryCount = 0;
+                continue;
+            }
+        }
+
+        if (const auto pinned = texture.FirstEntry + texture.EntryCount - 1;
+            !m_Entries[pinned].Loading && m_Entries[pinned].Slot == NOT_RESIDENT)
+            StartLoad(pinned);
+    }
+
+    // the slot about to be reused holds the oldest copy, the rest follow in ring order and the gpu finishes them in
+    // the order they were issued
+    for (unsigned i = 0; i < READBACK_COUNT; ++i)
+    {
+        auto &pending = m_Readbacks[(m_ReadbackIndex + i) % READBACK_COUNT];
+        if (!pending.Fence)
+            continue;
+
+        if (const auto status = glClientWaitSync(pending.Fence, 0, 0);
+            status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync(pending.Fence);
+        pending.Fence = nullptr;
+        ProcessFeedback(pending.Mapped);
+    }
+
+    if (auto &readback = m_Readbacks[m_ReadbackIndex]; !readback.Fence)
+    {
+        constexpr auto request_bytes = static_cast<GLsizeiptr>((1 + MAX_REQUESTS) * sizeof(std::uint32_t));
+        const auto flag_bytes = static_cast<GLsizeiptr>(m_FlagWords * sizeof(std::uint32_t));
+
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_COPY_READ_BUFFER, m_FeedbackBuffer.Handle());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback.Handle);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, request_bytes);
+        glCopyBufferSubData(
+            GL_COPY_READ_BUFFER,
+            GL_COPY_WRITE_BUFFER,
+            request_bytes + flag_bytes,
+            request_bytes,
+            static_cast<GLsizeiptr>(m_SlotCount * sizeof(std::uint32_t)));
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        readback.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        m_FeedbackBuffer.Bind();
+        glClearBufferSubData(
+            GL_SHADER_STORAGE_BUFFER,
+            GL_R32UI,
+            0,
+            sizeof(std::uint32_t),
+            GL_RED_INTEGER,
+            GL_UNSIGNED_INT,
+            nullptr);
+        glClearBufferSubData(
+            GL_SHADER_STORAGE_BUFFER,
+            GL_R32UI,
+            request_bytes,
+            flag_bytes,
+            GL_RED_INTEGER,
+            GL_UNSIGNED_INT,
+            nullptr);
+        m_FeedbackBuffer.Unbind();
+
+        m_ReadbackIndex = (m_ReadbackIndex + 1) % READBACK_COUNT;
+    }
+
+    for (auto it = m_Loads.begin(); it != m_Loads.end();)
+    {
+        if (it->Data.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++it;
+            continue;
+        }
+
+        const auto data = it->Data.get();
+        const auto entry = it->Entry;
+        it = m_Loads.erase(it);
+
+        auto &e = m_Entries[entry];
+        e.Loading = false;
+        if (data.size() != TILE_BYTES)
+        {
+            // without its coarsest tile the texture has nothing to fall back to, so it is dropped like a failed
+            // conversion
+            e.Failed = true;
+            std::cerr << "failed to load tile " << entry - m_Textures[e.Texture].FirstEntry << " of "
+                      << m_Textures[e.Texture].Cache << std::endl;
+            if (e.Pinned)
+                m_Textures[e.Texture].EntryCount = 0;
+            continue;
+        }
+
+        const auto slot = AllocateSlot();
+        if (slot == NOT_RESIDENT)
+            continue;
+
+        constexpr auto page_slots = PAGE_TILES * PAGE_TILES;
+        const auto page = slot / page_slots;
+        const auto x = slot % page_slots % PAGE_TILES * TILE_STRIDE;
+        const auto y = slot % page_slots / PAGE_TILES * TILE_STRIDE;
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, m_Atlas);
+        glCompressedTexSubImage3D(
+            GL_TEXTURE_2D_ARRAY,
+            0,
+            static_cast<GLint>(x),
+            static_cast<GLint>(y),
+            static_cast<GLint>(page),
+            TILE_STRIDE,
+            TILE_STRIDE,
+            1,
+            GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,
+            TILE_BYTES,
+            data.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        e.Slot = slot;
+        m_SlotEntry[slot] = entry;
+        m_SlotUsage[slot] = m_Frame;
+
+        m_FeedbackBuffer.Bind();
+        m_FeedbackBuffer.SubData(
+            static_cast<GLintptr>((1 + MAX_REQUESTS + m_FlagWords + slot) * sizeof(std::uint32_t)),
+            sizeof(std::uint32_t),
+            &m_Frame);
+        m_FeedbackBuffer.Unbind();
+
+        SetPageTableEntry(entry, slot);
+
+        if (e.Pinned)
+        {
+            m_Textures[e.Texture].Ready = true;
+            SetDescriptor(e.Texture);
+        }
+
+        m_Uploaded = true;
+    }
+
+    return m_Uploaded;
+}
+
+void pathtracer::TextureCache::Bind(const GLuint unit) const
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_Atlas);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+GLsizei pathtracer::TextureCache::Count() const
+{
+    return static_cast<GLsizei>(m_Textures.size());
+}
+
+unsigned pathtracer::TextureCache::GetFrame() const
+{
+    return m_Frame;
+}
+
+unsigned pathtracer::TextureCache::GetUsageOffset() const
+{
+    return m_FlagWords;
+}
+
+size_t pathtracer::TextureCache::GetResidentBytes() const
+{
+    return static_cast<size_t>(m_SlotCount - m_FreeSlots.size()) * TILE_BYTES;
+}
+
+size_t pathtracer::TextureCache::GetBudget() const
+{
+    return static_cast<size_t>(m_SlotCount) * TILE_BYTES;
+}
+
+void pathtracer::TextureCache::StartLoad(const unsigned entry)
+{
+    auto &e = m_Entries[entry];
+    const auto &texture = m_Textures[e.Texture];
+    e.Loading = true;
+
+    const auto offset = static_cast<std::streamoff>(sizeof(TextureCacheHeader))
+                        + static_cast<std::streamoff>(entry - texture.FirstEntry) * TILE_BYTES;
+
+    m_Loads.emplace_back(
+        entry,
+        m_Pool.Submit(
+            [path = texture.Cache, offset]
+            {
+                std::vector<unsigned char> data(TILE_BYTES);
+                std::ifstream stream(path, std::ios::binary);
+                if (!stream.seekg(offset) || !stream.read(reinterpret_cast<char *>(data.data()), TILE_BYTES))
+                    data.clear();
+                return data;
+            }));
+}
+
+unsigned pathtracer::TextureCache::AllocateSlot()
+{
+    if (!m_FreeSlots.empty())
+    {
+        const auto slot = m_FreeSlots.back();
+        m_FreeSlots.pop_back();
+        return slot;
+    }
+
+    // least recently used, never a pinned fallback tile or one the shader may still see through in-flight feedback
+    auto best = NOT_RESIDENT;
+    auto best_usage = std::numeric_limits<std::uint32_t>::max();
+    for (unsigned slot = 0; slot < m_SlotCount; ++slot)
+    {
+        const auto entry = m_SlotEntry[slot];
+        if (entry == NOT_RESIDENT || m_Entries[entry].Pinned)
+            continue;
+
+        const auto usage = m_SlotUsage[slot];
+        if (usage + READBACK_COUNT + 1 >= m_Frame || usage >= best_usage)
+            continue;
+
+        best = slot;
+        best_usage = usage;
+    }
+
+    if (best == NOT_RESIDENT)
+        return best;
+
+    const auto evicted = m_SlotEntry[best];
+    m_Entries[evicted].Slot = NOT_RESIDENT;
+    m_SlotEntry[best] = NOT_RESIDENT;
+    SetPageTableEntry(evicted, NOT_RESIDENT);
+
+    return best;
+}
+
+void pathtracer::TextureCache::SetPageTableEntry(const unsigned entry, const std::uint32_t slot) const
+{
+    m_PageTableBuffer.Bind();
+    m_PageTableBuffer.SubData(
+        static_cast<GLintptr>((m_Textures.size() * 4 + entry) * sizeof(std::uint32_t)),
+        sizeof(std::uint32_t),
+        &slot);
+    m_PageTableBuffer.Unbind();
+}
+
+void pathtracer::TextureCache::SetDescriptor(const unsigned texture) const
+{
+    const auto &t = m_Textures[texture];
+    const std::uint32_t descriptor[4]{level_grid(t.Size, 0), t.Levels, t.FirstEntry, t.Size};
+
+    m_PageTableBuffer.Bind();
+    m_PageTableBuffer.SubData(
+        static_cast<GLintptr>(texture * sizeof(descriptor)),
+        sizeof(descriptor),
+        descriptor);
+    m_PageTableBuffer.Unbind();
+}
+
+void pathtracer::TextureCache::ProcessFeedback(const std::uint32_t *data)
+{
+    const auto count = std::min(data[0], MAX_REQUESTS);
+    for (unsigned i = 0; i < count && m_Loads.size() < MAX_LOADS; ++i)
+    {
+        const auto entry = data[1 + i];
+        if (entry >= m_Entries.size())
+            continue;
+
+        if (const auto &e = m_Entries[entry];
+            e.Slot != NOT_RESIDENT || e.Loading || e.Failed || !m_Textures[e.Texture].Ready)
+            continue;
+
+        StartLoad(entry);
+    }
+
+    const auto usage = data + 1 + MAX_REQUESTS;
+    for (unsigned slot = 0; slot < m_SlotCount; ++slot)
+        m_SlotUsage[slot] = std::max(m_SlotUsage[slot], usage[slot]);
+}
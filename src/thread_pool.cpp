@@ -0,0 +1,192 @@
+#include <pathtracer/thread_pool.hpp>
+
+// the pool and deque of the worker running on this thread, tasks it schedules stay local until stolen
+static thread_local const pathtracer::ThreadPool *current_pool = nullptr;
+static thread_local unsigned current_index = 0;
+
+pathtracer::ThreadPool::Task::Task(std::shared_ptr<State> state)
+    : m_State(std::move(state))
+{
+}
+
+bool pathtracer::ThreadPool::Task::IsValid() const
+{
+    return m_State != nullptr;
+}
+
+bool pathtracer::ThreadPool::Task::IsDone() const
+{
+    return !m_State || m_State->Done;
+}
+
+pathtracer::ThreadPool::ThreadPool(unsigned count)
+{
+    if (count == 0)
+        count = 1;
+
+    for (unsigned i = 0; i < count; ++i)
+        m_Queues.push_back(std::make_unique<Queue>());
+    for (unsigned i = 0; i < count; ++i)
+        m_Threads.emplace_back(&ThreadPool::Run, this, i);
+}
+
+pathtracer::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_Condition.notify_all();
+
+    for (auto &thread: m_Threads)
+        thread.join();
+}
+
+pathtracer::ThreadPool::Task pathtracer::ThreadPool::Schedule(
+    std::function<void()> task,
+    const std::vector<Task> &dependencies)
+{
+    auto state = std::make_shared<State>();
+    state->Function = std::move(task);
+    state->Remaining = dependencies.size() + 1;
+
+    for (const auto &dependency: dependencies)
+    {
+        if (dependency.m_State)
+        {
+            std::lock_guard lock(dependency.m_State->Mutex);
+            if (!dependency.m_State->Done)
+            {
+                dependency.m_State->Dependents.push_back(state);
+                continue;
+            }
+        }
+        --state->Remaining;
+    }
+
+    if (--state->Remaining == 0)
+        Push(state);
+    return Task(state);
+}
+
+void pathtracer::ThreadPool::Wait(const Task &task)
+{
+    while (!task.IsDone())
+        if (!RunOne())
+            std::this_thread::sleep_for(IDLE_WAIT);
+}
+
+unsigned pathtracer::ThreadPool::Size() const
+{
+    return m_Threads.size();
+}
+
+void pathtracer::ThreadPool::Run(const unsigned index)
+{
+    current_pool = this;
+    current_index = index;
+
+    for (;;)
+    {
+        if (RunOne())
+            continue;
+
+        std::unique_lock lock(m_Mutex);
+        m_Condition.wait(lock, [this] { return m_Stop || m_Queued > 0; });
+        if (m_Stop && m_Queued == 0)
+            return;
+    }
+}
+
+void pathtracer::ThreadPool::Push(std::shared_ptr<State> state)
+{
+    // counted before it is queued so a thief never takes the count below zero
+    ++m_Queued;
+
+    auto &queue = current_pool == this ? *m_Queues[current_index] : m_Shared;
+    {
+        std::lock_guard lock(queue.Mutex);
+        queue.Tasks.push_back(std::move(state));
+    }
+
+    // taking the lock orders the count against a worker that just found it zero and is about to sleep
+    {
+        std::lock_guard lock(m_Mutex);
+    }
+    m_Condition.notify_one();
+}
+
+std::shared_ptr<pathtracer::ThreadPool::State> pathtracer::ThreadPool::Pop()
+{
+    if (m_Queued == 0)
+        return nullptr;
+
+    const auto take = [this](Queue &queue, const bool newest) -> std::shared_ptr<State>
+    {
+        std::lock_guard lock(queue.Mutex);
+        if (queue.Tasks.empty())
+            return nullptr;
+
+        std::shared_ptr<State> state;
+        if (newest)
+        {
+            state = std::move(queue.Tasks.back());
+            queue.Tasks.pop_back();
+        }
+        else
+        {
+            state = std::move(queue.Tasks.front());
+            queue.Tasks.pop_front();
+        }
+        --m_Queued;
+        return state;
+    };
+
+    // the newest local task is the one whose data is still in cache, stealing the oldest takes the biggest piece
+    const auto own = current_pool == this;
+    if (own)
+        if (auto state = take(*m_Queues[current_index], true))
+            return state;
+
+    if (auto state = take(m_Shared, false))
+        return state;
+
+    const auto count = static_cast<unsigned>(m_Queues.size());
+    const auto first = own ? current_index + 1 : 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const auto victim = (first + i) % count;
+        if (own && victim == current_index)
+            continue;
+        if (auto state = take(*m_Queues[victim], false))
+            return state;
+    }
+    return nullptr;
+}
+
+bool pathtracer::ThreadPool::RunOne()
+{
+    const auto state = Pop();
+    if (!state)
+        return false;
+
+    Execute(state);
+    return true;
+}
+
+void pathtracer::ThreadPool::Execute(const std::shared_ptr<State> &state)
+{
+    state->Function();
+    state->Function = nullptr;
+
+    std::vector<std::shared_ptr<State> > dependents;
+    {
+        std::lock_guard lock(state->Mutex);
+        state->Done = true;
+        dependents.swap(state->Dependents);
+    }
+
+    for (auto &dependent: dependents)
+        if (--dependent->Remaining == 0)
+            Push(std::move(dependent));
+}
@@ -46,12 +46,15 @@ pathtracer::Window::Window(
     const int width,
     const int height,
     const std::string &title,
-    const std::filesystem::path &icon)
+    const std::filesystem::path &icon,
+    const bool visible)
 {
     initialize();
 
     glfwDefaultWindowHints();
     glfwWindowHint(GLFW_CONTEXT_DEBUG, GLFW_TRUE);
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
     m_Handle = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
     if (!m_Handle)
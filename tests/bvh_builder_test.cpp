@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pathtracer/bvh_builder.hpp>
+
+static int failures = 0;
+
+static void check(const bool condition, const std::string &what)
+{
+    if (condition)
+        return;
+
+    std::cerr << "failed: " << what << std::endl;
+    ++failures;
+}
+
+static pathtracer::Triangle triangle(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2)
+{
+    pathtracer::Triangle triangle{};
+    triangle.P0 = p0;
+    triangle.P1 = p1;
+    triangle.P2 = p2;
+    return triangle;
+}
+
+static unsigned max_leaf_depth(const std::vector<pathtracer::BVHNode> &nodes, const unsigned index, const unsigned depth)
+{
+    const auto &node = nodes[index];
+    if (!node.Left)
+        return depth;
+    return std::max(max_leaf_depth(nodes, node.Left, depth + 1), max_leaf_depth(nodes, node.Right, depth + 1));
+}
+
+// the push order of models_hit with every box hit, which is the most the stack ever holds
+static unsigned max_stack(const std::vector<pathtracer::BVHNode> &nodes)
+{
+    std::vector<unsigned> stack{0};
+    size_t most = stack.size();
+    while (!stack.empty())
+    {
+        const auto &node = nodes[stack.back()];
+        stack.pop_back();
+        if (!node.Left)
+            continue;
+
+        stack.push_back(node.Left);
+        stack.push_back(node.Right);
+        most = std::max(most, stack.size());
+    }
+    return static_cast<unsigned>(most);
+}
+
+// trees of inputs that split badly have to fit the traversal stack of the shader
+int main()
+{
+    // every triangle half the size of the previous one and next to it, surface area splits peel them off one by one
+    std::vector<pathtracer::Triangle> shrinking;
+    for (auto i = 0; i < 120; ++i)
+    {
+        const auto size = std::ldexp(1.f, -i);
+        shrinking.push_back(triangle({size, 0.f, 0.f}, {2.f * size, 0.f, 0.f}, {size, size, size}));
+    }
+
+    // nothing to split
+    const std::vector stacked(1000, triangle({0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {0.f, 1.f, 0.f}));
+
+    // a long row of slivers, every one crossing most of the others
+    std::vector<pathtracer::Triangle> slivers;
+    for (auto i = 0; i < 4000; ++i)
+    {
+        const auto x = static_cast<float>(i) * .001f;
+        slivers.push_back(triangle({x, 0.f, 0.f}, {x + 100.f, .001f, 0.f}, {x, 0.f, .001f}));
+    }
+
+    pathtracer::ThreadPool pool(4);
+    for (const auto &[name, input]: {
+             std::pair{"shrinking", shrinking},
+             std::pair{"stacked", stacked},
+             std::pair{"slivers", slivers},
+         })
+        for (const auto split: {pathtracer::BvhSplit::Median, pathtracer::BvhSplit::Spatial})
+            for (const auto layout: {pathtracer::BvhLayout::Build, pathtracer::BvhLayout::DepthFirst})
+            {
+                const auto label = std::string(name) + (split == pathtracer::BvhSplit::Spatial ? " spatial" : " median")
+                                   + (layout == pathtracer::BvhLayout::DepthFirst ? " depth first" : " build order");
+
+                auto triangles = input;
+                pathtracer::BuildStats stats;
+                pathtracer::BvhBuilder builder(pool, stats);
+                const auto tree = builder.Build(triangles, {.Split = split, .Layout = layout});
+
+                const auto depth = max_leaf_depth(tree.Nodes, 0, 0);
+                check(depth <= pathtracer::BvhBuilder::MAX_DEPTH, label + ": leaf at depth " + std::to_string(depth));
+                check(depth + 1 <= pathtracer::BVH_STACK_SIZE, label + ": leaf depth exceeds the shader stack");
+
+                const auto stack = max_stack(tree.Nodes);
+                check(stack <= pathtracer::BVH_STACK_SIZE, label + ": " + std::to_string(stack) + " stack entries");
+            }
+
+    return failures ? 1 : 0;
+}
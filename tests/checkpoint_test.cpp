@@ -0,0 +1,100 @@
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <pathtracer/checkpoint.hpp>
+
+static int failures = 0;
+
+static void check(const bool condition, const char *what)
+{
+    if (condition)
+        return;
+
+    std::cerr << "failed: " << what << std::endl;
+    ++failures;
+}
+
+// the file round trips, damaged files are refused, and a refused resume names the mismatch and moves later
+// checkpoints off the file it refused
+int main()
+{
+    pathtracer::Checkpoint checkpoint;
+    checkpoint.Header.Width = 640;
+    checkpoint.Header.Height = 480;
+    checkpoint.Header.SceneHash = 42;
+
+    check(checkpoint.Mismatch(640, 480, 42).empty(), "matching checkpoint is accepted");
+    check(!checkpoint.Mismatch(600, 480, 42).empty(), "different width is refused");
+    check(!checkpoint.Mismatch(640, 600, 42).empty(), "different height is refused");
+    check(!checkpoint.Mismatch(640, 480, 7).empty(), "different scene hash is refused");
+
+    const auto directory = std::filesystem::temp_directory_path() / "path_tracer_checkpoint_test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    const auto path = directory / "checkpoint.ptc";
+    pathtracer::Checkpoint written;
+    written.Header.Width = 3;
+    written.Header.Height = 2;
+    written.Header.SampleCount = 17;
+    written.Header.Frame = 5;
+    written.Header.SceneHash = 0x0123456789abcdefull;
+    written.Header.Camera[5] = 45.f;
+    written.Scene = "scenes/cornell_box.yaml";
+
+    std::vector<float> images(3 * 2 * 4 * pathtracer::CHECKPOINT_IMAGES);
+    for (size_t i = 0; i < images.size(); ++i)
+        images[i] = static_cast<float>(i) * .5f;
+    written.Write(path, images.data());
+
+    const auto read = pathtracer::Checkpoint::Read(path);
+    check(read.Header.Width == 3 && read.Header.Height == 2, "size survives the round trip");
+    check(read.Header.SampleCount == 17 && read.Header.Frame == 5, "progress survives the round trip");
+    check(read.Header.SceneHash == written.Header.SceneHash, "scene hash survives the round trip");
+    check(read.Header.Camera[5] == 45.f, "camera survives the round trip");
+    check(read.Scene == written.Scene, "scene path survives the round trip");
+    for (unsigned i = 0; i < pathtracer::CHECKPOINT_IMAGES; ++i)
+        check(
+            read.Images[i] == std::vector(images.begin() + i * 24, images.begin() + (i + 1) * 24),
+            "images survive the round trip");
+    check(!std::filesystem::exists(directory / "checkpoint.ptc.tmp"), "the temporary file is renamed");
+
+    const auto rejects = [](const std::filesystem::path &file)
+    {
+        try
+        {
+            pathtracer::Checkpoint::Read(file);
+        }
+        catch (const std::runtime_error &)
+        {
+            return true;
+        }
+        return false;
+    };
+
+    const auto truncated = directory / "truncated.ptc";
+    std::filesystem::copy_file(path, truncated);
+    std::filesystem::resize_file(truncated, std::filesystem::file_size(path) - 1);
+    check(rejects(truncated), "truncated checkpoint is refused");
+
+    // width is the third field, after the magic and the version
+    const auto oversized = directory / "oversized.ptc";
+    std::filesystem::copy_file(path, oversized);
+    {
+        std::fstream stream(oversized, std::ios::binary | std::ios::in | std::ios::out);
+        constexpr std::uint32_t width = 0xffffffffu;
+        stream.seekp(8);
+        stream.write(reinterpret_cast<const char *>(&width), sizeof(width));
+    }
+    check(rejects(oversized), "checkpoint with an impossible size is refused");
+
+    // the refused checkpoint keeps its name, later writes go to the first free sibling
+    std::ofstream(directory / "checkpoint-1.ptc") << "taken";
+    const auto fresh = pathtracer::Checkpoint::FreshPath(path);
+    check(fresh == directory / "checkpoint-2.ptc", "fresh path skips files that exist");
+    check(!std::filesystem::exists(fresh), "fresh path is unused");
+
+    std::filesystem::remove_all(directory);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+#include <fstream>
+#include <iostream>
+#include <pathtracer/shader_preprocessor.hpp>
+
+// concatenates the files of one shader stage into a single unit for the offline spir-v compiler,
+// the same way the loader builds a stage with LINK set to single
+int main(const int argc, const char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <output> <stage path>..." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::filesystem::path> files;
+    for (auto i = 2; i < argc; ++i)
+        pathtracer::ShaderPreprocessor::Collect(argv[i], files);
+
+    try
+    {
+        pathtracer::ShaderPreprocessor preprocessor;
+        const auto [Source, Files] = preprocessor.Process(files);
+
+        std::ofstream stream(argv[1], std::ios::trunc);
+        if (!stream)
+        {
+            std::cerr << "failed to open output file " << argv[1] << std::endl;
+            return 1;
+        }
+        stream << Source;
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}